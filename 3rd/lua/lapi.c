@@ -858,6 +858,7 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   }
   switch (ttnov(obj)) {
     case LUA_TTABLE: {
+      luaH_checkshared(L, hvalue(obj));
       hvalue(obj)->metatable = mt;
       if (mt) {
         luaC_objbarrier(L, gcvalue(obj), mt);
@@ -1066,6 +1067,155 @@ LUA_API void lua_clonefunction (lua_State *L, const void * fp) {
   lua_unlock(L);
 }
 
+/*
+** shared table : a frozen table which can be read by all the states.
+** Its short strings are moved to the global short string table, and its
+** objects are removed from the 'allgc' list of the state, so they are
+** never collected (even after lua_close).
+*/
+
+#define MAXSHAREDEPTH	128
+
+static const char *checkshare (Table *t, int depth);
+
+static const char *checksharevalue (const TValue *o, int depth) {
+  switch (ttnov(o)) {
+    case LUA_TNIL: case LUA_TBOOLEAN: case LUA_TLIGHTUSERDATA:
+    case LUA_TNUMBER: case LUA_TSTRING:
+      return NULL;
+    case LUA_TTABLE:
+      return checkshare(hvalue(o), depth + 1);
+    default:
+      return ttypename(ttnov(o));
+  }
+}
+
+/* mark the new tables with SHAREDBIT (they are still white) */
+static const char *checkshare (Table *t, int depth) {
+  const char *err;
+  unsigned int i;
+  Node *n, *limit = gnode(t, cast(size_t, sizenode(t)));
+  if (isshared(t))  /* visited, or shared before */
+    return NULL;
+  if (depth > MAXSHAREDEPTH)
+    return "too deep table";
+  if (t->metatable)
+    return "table with metatable";
+  l_setbit(t->marked, SHAREDBIT);
+  for (i = 0; i < t->sizearray; i++) {
+    if ((err = checksharevalue(&t->array[i], depth)) != NULL)
+      return err;
+  }
+  for (n = gnode(t, 0); n < limit; n++) {
+    if (!ttisnil(gval(n))) {
+      if ((err = checksharevalue(gkey(n), depth)) != NULL ||
+          (err = checksharevalue(gval(n), depth)) != NULL)
+        return err;
+    }
+  }
+  return NULL;
+}
+
+static void uncheckshare (Table *t) {
+  unsigned int i;
+  Node *n, *limit = gnode(t, cast(size_t, sizenode(t)));
+  if (!isshared(t) || !iswhite(t))
+    return;
+  resetbit(t->marked, SHAREDBIT);
+  for (i = 0; i < t->sizearray; i++) {
+    if (ttistable(&t->array[i]))
+      uncheckshare(hvalue(&t->array[i]));
+  }
+  for (n = gnode(t, 0); n < limit; n++) {
+    if (ttistable(gkey(n)))
+      uncheckshare(hvalue(gkey(n)));
+    if (ttistable(gval(n)))
+      uncheckshare(hvalue(gval(n)));
+  }
+}
+
+static void sharetable (lua_State *L, Table *t);
+
+static void sharevalue (lua_State *L, TValue *o) {
+  switch (ttype(o)) {
+    case LUA_TSHRSTR:
+      setsvalue(L, o, luaS_sharestring(tsvalue(o)));
+      break;
+    case LUA_TLNGSTR: {
+      TString *ts = tsvalue(o);
+      if (!isshared(ts)) {
+        luaS_hashlongstr(ts);  /* the readers never write it */
+        makeshared(ts);
+      }
+      break;
+    }
+    case LUA_TTABLE:
+      sharetable(L, hvalue(o));
+      break;
+    default:
+      break;
+  }
+}
+
+static void sharetable (lua_State *L, Table *t) {
+  unsigned int i;
+  Node *n, *limit = gnode(t, cast(size_t, sizenode(t)));
+  if (!iswhite(t))  /* shared before */
+    return;
+  makeshared(t);
+  for (i = 0; i < t->sizearray; i++)
+    sharevalue(L, &t->array[i]);
+  for (n = gnode(t, 0); n < limit; n++) {
+    if (ttisnil(gval(n))) {
+      /* the key may be collected by this state */
+      if (iscollectable(gkey(n)))
+        setdeadvalue(wgkey(n));
+    }
+    else {
+      sharevalue(L, cast(TValue *, gkey(n)));
+      sharevalue(L, gval(n));
+    }
+  }
+}
+
+static void unlinkshared (GCObject **p) {
+  while (*p != NULL) {
+    GCObject *curr = *p;
+    if (isshared(curr))
+      *p = curr->next;
+    else
+      p = &curr->next;
+  }
+}
+
+LUA_API void lua_sharetable (lua_State *L, int idx) {
+  Table *t;
+  const char *err;
+  lua_lock(L);
+  api_check(L, ttistable(index2addr(L, idx)), "table expected");
+  t = hvalue(index2addr(L, idx));
+  /* all the live objects are white and not in a gray list after a full gc */
+  luaC_fullgc(L, 0);
+  err = checkshare(t, 0);
+  if (err != NULL) {
+    uncheckshare(t);
+    luaG_runerror(L, "can't share %s", err);
+  }
+  sharetable(L, t);
+  unlinkshared(&G(L)->allgc);
+  lua_unlock(L);
+}
+
+LUA_API void lua_clonetable (lua_State *L, const void *tp) {
+  Table *t = cast(Table *, tp);
+  lua_lock(L);
+  if (t->tt != LUA_TTABLE || !isshared(t))
+    luaG_runerror(L, "not a shared table");
+  sethvalue(L, L->top, t);
+  api_incr_top(L);
+  lua_unlock(L);
+}
+
 LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
   int status;
   TValue *o;
@@ -1158,6 +1308,35 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
 }
 
 
+LUA_API void lua_setgcclock (lua_State *L, lua_GCClock f) {
+  lua_lock(L);
+  G(L)->gcclock = f;
+  lua_unlock(L);
+}
+
+
+LUA_API lua_Integer lua_gctime (lua_State *L) {
+  return G(L)->gctime;
+}
+
+
+/*
+** shrink the stack of a thread to the part in use and free the unused
+** CallInfo list, if the stack is larger than 'limit'
+*/
+LUA_API int lua_shrinkstack (lua_State *L, int limit) {
+  int size;
+  lua_lock(L);
+  if (L->stacksize > limit) {
+    luaE_freeCI(L);
+    luaD_shrinkstack(L);
+  }
+  size = L->stacksize;
+  lua_unlock(L);
+  return size;
+}
+
+
 
 /*
 ** miscellaneous functions
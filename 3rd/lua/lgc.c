@@ -1119,6 +1119,14 @@ void luaC_runtilstate (lua_State *L, int statesmask) {
 }
 
 
+/*
+** time of the collector (a step or a full collection), if the clock is
+** set. (A step interrupted by an error in a finalizer is not counted.)
+*/
+#define gctimer(g)	((g)->gcclock ? (g)->gcclock() : 0)
+#define gctimed(g,t0)	{ if ((g)->gcclock) (g)->gctime += (g)->gcclock() - (t0); }
+
+
 /*
 ** get GC debt and convert it from Kb to 'work units' (avoid zero debt
 ** and overflows)
@@ -1140,10 +1148,12 @@ static l_mem getdebt (global_State *g) {
 void luaC_step (lua_State *L) {
   global_State *g = G(L);
   l_mem debt = getdebt(g);  /* GC deficit (be paid now) */
+  lua_Integer t0;
   if (!g->gcrunning) {  /* not running? */
     luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
     return;
   }
+  t0 = gctimer(g);
   do {  /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
@@ -1155,6 +1165,7 @@ void luaC_step (lua_State *L) {
     luaE_setdebt(g, debt);
     runafewfinalizers(L);
   }
+  gctimed(g, t0);
 }
 
 
@@ -1169,6 +1180,7 @@ void luaC_step (lua_State *L) {
 */
 void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
+  lua_Integer t0 = gctimer(g);
   lua_assert(g->gckind == KGC_NORMAL);
   if (isemergency) g->gckind = KGC_EMERGENCY;  /* set flag */
   if (keepinvariant(g)) {  /* black objects? */
@@ -1183,6 +1195,7 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
   g->gckind = KGC_NORMAL;
   setpause(g);
+  gctimed(g, t0);
 }
 
 /* }====================================================== */
@@ -79,6 +79,7 @@
 #define WHITE1BIT	1  /* object is white (type 1) */
 #define BLACKBIT	2  /* object is black */
 #define FINALIZEDBIT	3  /* object has been marked for finalization */
+#define SHAREDBIT	4  /* object is shared by all the states (lua_sharetable) */
 /* bit 7 is currently used by tests (luaL_checkmemory) */
 
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
@@ -91,6 +92,13 @@
 
 #define tofinalize(x)	testbit((x)->marked, FINALIZEDBIT)
 
+/*
+** A shared object is neither white nor black, so no state marks, sweeps
+** or barriers it. It is in no 'allgc' list and never collected.
+*/
+#define isshared(x)	testbit((x)->marked, SHAREDBIT)
+#define makeshared(x)	((x)->marked = cast_byte(((x)->marked & 	~(WHITEBITS | bitmask(BLACKBIT))) | bitmask(SHAREDBIT)))
+
 #define otherwhite(g)	((g)->currentwhite ^ WHITEBITS)
 #define isdeadm(ow,m)	(!(((m) ^ WHITEBITS) & (ow)))
 #define isdead(g,v)	isdeadm(otherwhite(g), (v)->marked)
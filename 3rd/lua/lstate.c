@@ -79,6 +79,11 @@ typedef struct LG {
     memcpy(b + p, &t, sizeof(t)); p += sizeof(t); }
 
 static unsigned int makeseed (lua_State *L) {
+#if defined(ENABLE_SHORT_STRING_TABLE)
+  /* one seed for all the states, a short string hashes the same in each of them */
+  (void)L;
+  return luaS_shrseed();
+#else
   char buff[4 * sizeof(size_t)];
   unsigned int h = luai_makeseed();
   int p = 0;
@@ -88,6 +93,7 @@ static unsigned int makeseed (lua_State *L) {
   addbuff(buff, p, &lua_newstate);  /* public function */
   lua_assert(p == sizeof(buff));
   return luaS_hash(buff, p, h);
+#endif
 }
 
 
@@ -328,6 +334,8 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gcfinnum = 0;
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->gcclock = NULL;
+  g->gctime = 0;
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
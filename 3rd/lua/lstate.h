@@ -162,6 +162,8 @@ typedef struct global_State {
   unsigned int gcfinnum;  /* number of finalizers to call in each GC step */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC 'granularity' */
+  lua_GCClock gcclock;  /* clock to time the collector (may be NULL) */
+  lua_Integer gctime;  /* time spent in the collector, in 'gcclock' unit */
   lua_CFunction panic;  /* to be called in unprotected errors */
   struct lua_State *mainthread;
   const lua_Number *version;  /* pointer to version number */
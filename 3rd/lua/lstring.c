@@ -260,6 +260,7 @@ Udata *luaS_newudata (lua_State *L, size_t s) {
 #include "rwlock.h"
 #include "atomic.h"
 #include <stdlib.h>
+#include <time.h>
 
 #define SHRSTR_SLOT 0x10000
 #define HASH_NODE(h) ((h) % SHRSTR_SLOT)
@@ -273,6 +274,7 @@ struct shrmap_slot {
 struct shrmap {
 	struct shrmap_slot h[SHRSTR_SLOT];
 	int n;
+	unsigned int seed;
 };
 
 static struct shrmap SSM;
@@ -285,6 +287,13 @@ luaS_initshr() {
 	for (i=0;i<SHRSTR_SLOT;i++) {
 		rwlock_init(&s->h[i].lock);
 	}
+	// the seed of all the states (makeseed in lstate.c) : a string has the same hash in SSM and in each state
+	s->seed = luaS_hash((const char *)&s, sizeof(s), (unsigned int)time(NULL));
+}
+
+LUAI_FUNC unsigned int
+luaS_shrseed(void) {
+	return SSM.seed;
 }
 
 LUA_API void
@@ -338,6 +347,7 @@ new_string(unsigned int h, const char *str, lu_byte l) {
 	TString *ts = malloc(sz);
 	memset(ts, 0, sz);
 	ts->tt = LUA_TSHRSTR;
+	ts->marked = bitmask(SHAREDBIT);
 	ts->hash = h;
 	ts->shrlen = l;
 	memcpy(ts+1, str, l);
@@ -382,8 +392,8 @@ internshrstr (lua_State *L, const char *str, size_t l) {
   ts = queryshrstr (L, str, l, h);
   if (ts)
     return ts;
-  // lookup SSM again
-  h0 = luaS_hash(str, l, 0);
+  // lookup SSM again, the hash is the same (g->seed == SSM.seed)
+  h0 = h;
   ts = query_string(h0, str, l);
   if (ts)
     return ts;
@@ -420,7 +430,7 @@ luaS_clonestring(lua_State *L, TString *ts) {
   result = query_ptr(ts);
   if (result)
     return result;
-  h = luaS_hash(str, l, 0);
+  h = luaS_hash(str, l, SSM.seed);
   result = query_string(h, str, l);
   if (result)
     return result;
@@ -428,6 +438,25 @@ luaS_clonestring(lua_State *L, TString *ts) {
   return add_string(h, str, l);
 }
 
+// the twin of a short string in SSM (lua_sharetable)
+LUAI_FUNC TString *
+luaS_sharestring(TString *ts) {
+  TString *result;
+  if (isshared(ts))
+    return ts;
+  // the hash of ts is the hash in SSM, because the seeds are the same
+  result = query_string(ts->hash, getaddrstr(ts), ts->shrlen);
+  if (result)
+    return result;
+  return add_string(ts->hash, getaddrstr(ts), ts->shrlen);
+}
+
+LUAI_FUNC int
+luaS_eqshrtwin(TString *a, TString *b) {
+  return a->hash == b->hash && a->shrlen == b->shrlen &&
+    memcmp(getaddrstr(a), getaddrstr(b), a->shrlen) == 0;
+}
+
 struct slotinfo {
 	int len;
 	int size;
@@ -28,9 +28,13 @@
 
 
 /*
-** equality for short strings, which are always internalized
+** equality for short strings, which are always internalized. A string of
+** a shared table may be the twin (in the global short string table) of a
+** string of this state, they have the same hash (all states use the same
+** seed, see luaS_initshr)
 */
-#define eqshrstr(a,b)	check_exp((a)->tt == LUA_TSHRSTR, (a) == (b))
+#define eqshrstr(a,b)	check_exp((a)->tt == LUA_TSHRSTR, (a) == (b) || \
+	(isshared(a) != isshared(b) && luaS_eqshrtwin(a,b)))
 
 
 LUAI_FUNC unsigned int luaS_hash (const char *str, size_t l, unsigned int seed);
@@ -51,6 +55,9 @@ LUA_API void luaS_initshr();
 LUA_API void luaS_exitshr();
 LUA_API void luaS_expandshr(int n);
 LUAI_FUNC TString *luaS_clonestring(lua_State *L, TString *);
+LUAI_FUNC TString *luaS_sharestring(TString *);
+LUAI_FUNC int luaS_eqshrtwin(TString *a, TString *b);
+LUAI_FUNC unsigned int luaS_shrseed(void);
 LUA_API int luaS_shrinfo(lua_State *L);
 
 #endif
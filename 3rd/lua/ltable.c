@@ -451,6 +451,15 @@ static Node *getfreepos (Table *t) {
 
 
 
+/*
+** a shared table (see 'lua_sharetable') is read by all the states, so
+** any write (a new key, an existing key or the metatable) is an error
+*/
+l_noret luaH_sharederror (lua_State *L) {
+  luaG_runerror(L, "attempt to modify a shared table");
+}
+
+
 /*
 ** inserts a new key into a hash table; first, check whether key's main
 ** position is free. If not, check whether colliding node is in its main
@@ -461,6 +470,7 @@ static Node *getfreepos (Table *t) {
 TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
   Node *mp;
   TValue aux;
+  luaH_checkshared(L, t);
   if (ttisnil(key)) luaG_runerror(L, "table index is nil");
   else if (ttisfloat(key)) {
     lua_Integer k;
@@ -608,7 +618,9 @@ const TValue *luaH_get (Table *t, const TValue *key) {
 ** barrier and invalidate the TM cache.
 */
 TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
-  const TValue *p = luaH_get(t, key);
+  const TValue *p;
+  luaH_checkshared(L, t);
+  p = luaH_get(t, key);
   if (p != luaO_nilobject)
     return cast(TValue *, p);
   else return luaH_newkey(L, t, key);
@@ -616,8 +628,10 @@ TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
 
 
 void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
-  const TValue *p = luaH_getint(t, key);
+  const TValue *p;
   TValue *cell;
+  luaH_checkshared(L, t);
+  p = luaH_getint(t, key);
   if (p != luaO_nilobject)
     cell = cast(TValue *, p);
   else {
@@ -283,6 +283,8 @@ LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data, int strip);
 
 LUA_API void (lua_clonefunction) (lua_State *L, const void *eL);
+LUA_API void (lua_sharetable) (lua_State *L, int idx);
+LUA_API void (lua_clonetable) (lua_State *L, const void *t);
 
 
 /*
@@ -296,6 +298,9 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 
 #define lua_yield(L,n)		lua_yieldk(L, (n), 0, NULL)
 
+/* shrink the stack of 'L' if it's larger than 'limit' slots, return the size */
+LUA_API int (lua_shrinkstack) (lua_State *L, int limit);
+
 
 /*
 ** garbage-collection function and options
@@ -313,6 +318,15 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
+/*
+** time spent in the collector: 'f' is a clock in any unit, the steps
+** and the full collections are timed with it (not set : no timing)
+*/
+typedef lua_Integer (*lua_GCClock) (void);
+
+LUA_API void (lua_setgcclock) (lua_State *L, lua_GCClock f);
+LUA_API lua_Integer (lua_gctime) (lua_State *L);
+
 
 /*
 ** miscellaneous functions
@@ -12,9 +12,10 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define QUEUESIZE 1024
+#define QUEUESIZE 1024	// power of 2, the queue is a ring buffer and doubles when it's full
 #define HASHSIZE 4096
 #define SMALLSTRING 2048
+#define POPN 128
 
 #define TYPE_DATA 1
 #define TYPE_MORE 2
@@ -69,11 +70,8 @@ lclear(lua_State *L) {
 		clear_list(q->hash[i]);
 		q->hash[i] = NULL;
 	}
-	if (q->head > q->tail) {
-		q->tail += q->cap;
-	}
-	for (i=q->head;i<q->tail;i++) {
-		struct netpack *np = &q->queue[i % q->cap];
+	for (i=q->head;i!=q->tail;i=(i+1) & (q->cap-1)) {
+		struct netpack *np = &q->queue[i];
 		skynet_free(np->buffer);
 	}
 	q->head = q->tail = 0;
@@ -130,19 +128,19 @@ get_queue(lua_State *L) {
 	return q;
 }
 
+// the queue is full (head == tail after push), double the capacity and unroll the ring
 static void
 expand_queue(lua_State *L, struct queue *q) {
-	struct queue *nq = lua_newuserdata(L, sizeof(struct queue) + q->cap * sizeof(struct netpack));
-	nq->cap = q->cap + QUEUESIZE;
+	int cap = q->cap * 2;
+	struct queue *nq = lua_newuserdata(L, sizeof(struct queue) + (cap - QUEUESIZE) * sizeof(struct netpack));
+	nq->cap = cap;
 	nq->head = 0;
 	nq->tail = q->cap;
 	memcpy(nq->hash, q->hash, sizeof(nq->hash));
 	memset(q->hash, 0, sizeof(q->hash));
-	int i;
-	for (i=0;i<q->cap;i++) {
-		int idx = (q->head + i) % q->cap;
-		nq->queue[i] = q->queue[idx];
-	}
+	int n = q->cap - q->head;
+	memcpy(nq->queue, q->queue + q->head, n * sizeof(struct netpack));
+	memcpy(nq->queue + n, q->queue, q->head * sizeof(struct netpack));
 	q->head = q->tail = 0;
 	lua_replace(L,1);
 }
@@ -156,8 +154,7 @@ push_data(lua_State *L, int fd, void *buffer, int size, int clone) {
 	}
 	struct queue *q = get_queue(L);
 	struct netpack *np = &q->queue[q->tail];
-	if (++q->tail >= q->cap)
-		q->tail -= q->cap;
+	q->tail = (q->tail + 1) & (q->cap - 1);
 	np->id = fd;
 	np->buffer = buffer;
 	np->size = size;
@@ -224,8 +221,9 @@ close_uncomplete(lua_State *L, int fd) {
 	}
 }
 
+// *keep is set when the socket buffer is reused by a package, so it mustn't be freed
 static int
-filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
+filter_data_(lua_State *L, int fd, uint8_t * buffer, int size, int *keep) {
 	struct queue *q = lua_touserdata(L,1);
 	struct uncomplete * uc = find_uncomplete(q, fd);
 	if (uc) {
@@ -286,21 +284,22 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 			memcpy(uc->pack.buffer, buffer, size);
 			return 1;
 		}
+		// The first package reuses the socket buffer : move it over its header, the package needn't a new buffer
+		uint8_t * head = buffer - 2;
+		*keep = 1;
 		if (size == pack_size) {
 			// just one package
+			memmove(head, buffer, size);
 			lua_pushvalue(L, lua_upvalueindex(TYPE_DATA));
 			lua_pushinteger(L, fd);
-			void * result = skynet_malloc(pack_size);
-			memcpy(result, buffer, size);
-			lua_pushlightuserdata(L, result);
+			lua_pushlightuserdata(L, head);
 			lua_pushinteger(L, size);
 			return 5;
 		}
-		// more data
-		push_data(L, fd, buffer, pack_size, 1);
-		buffer += pack_size;
-		size -= pack_size;
-		push_more(L, fd, buffer, size);
+		// more data, clone the following packages before moving the first one
+		push_data(L, fd, head, pack_size, 0);
+		push_more(L, fd, buffer + pack_size, size - pack_size);
+		memmove(head, buffer, pack_size);
 		lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
 		return 2;
 	}
@@ -308,10 +307,13 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 
 static inline int
 filter_data(lua_State *L, int fd, uint8_t * buffer, int size) {
-	int ret = filter_data_(L, fd, buffer, size);
+	int keep = 0;
+	int ret = filter_data_(L, fd, buffer, size, &keep);
 	// buffer is the data of socket message, it malloc at socket_server.c : function forward_message .
-	// it should be free before return,
-	skynet_free(buffer);
+	// it should be free before return, unless a package takes it over
+	if (!keep) {
+		skynet_free(buffer);
+	}
 	return ret;
 }
 
@@ -402,9 +404,7 @@ lpop(lua_State *L) {
 	if (q == NULL || q->head == q->tail)
 		return 0;
 	struct netpack *np = &q->queue[q->head];
-	if (++q->head >= q->cap) {
-		q->head = 0;
-	}
+	q->head = (q->head + 1) & (q->cap - 1);
 	lua_pushinteger(L, np->id);
 	lua_pushlightuserdata(L, np->buffer);
 	lua_pushinteger(L, np->size);
@@ -412,6 +412,40 @@ lpop(lua_State *L) {
 	return 3;
 }
 
+/*
+	userdata queue
+	table t
+	integer max (default POPN)
+	return
+		integer n
+
+	Pop at most max packages in one call, t[3*i-2], t[3*i-1], t[3*i] are fd, msg, size of the ith package.
+	The table can be reused, the values after 3*n are left untouched.
+ */
+static int
+lpopn(lua_State *L) {
+	struct queue * q = lua_touserdata(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	int max = luaL_optinteger(L, 3, POPN);
+	int n = 0;
+	if (q) {
+		int idx = 0;
+		while (n < max && q->head != q->tail) {
+			struct netpack *np = &q->queue[q->head];
+			q->head = (q->head + 1) & (q->cap - 1);
+			lua_pushinteger(L, np->id);
+			lua_rawseti(L, 2, ++idx);
+			lua_pushlightuserdata(L, np->buffer);
+			lua_rawseti(L, 2, ++idx);
+			lua_pushinteger(L, np->size);
+			lua_rawseti(L, 2, ++idx);
+			++n;
+		}
+	}
+	lua_pushinteger(L, n);
+	return 1;
+}
+
 /*
 	string msg | lightuserdata/integer
 
@@ -467,14 +501,49 @@ ltostring(lua_State *L) {
 	return 1;
 }
 
+/*
+	lightuserdata msg
+	integer size
+	integer header (2 or 4, default 2)
+
+	string ...
+ */
+// unpack the vector message of the c gate : whole packages with big-endian headers, the msg isn't freed
+static int
+lunpackv(lua_State *L) {
+	const uint8_t * ptr = (const uint8_t *)lua_touserdata(L, 1);
+	int sz = luaL_checkinteger(L, 2);
+	int header = luaL_optinteger(L, 3, 2);
+	if (header != 2 && header != 4) {
+		return luaL_error(L, "Invalid header size %d", header);
+	}
+	int n = 0;
+	while (sz >= header) {
+		int size = header == 2 ? (ptr[0] << 8 | ptr[1]) : (int)((uint32_t)ptr[0] << 24 | ptr[1] << 16 | ptr[2] << 8 | ptr[3]);
+		ptr += header;
+		sz -= header;
+		if (size < 0 || size > sz) {
+			return luaL_error(L, "Invalid vector message");
+		}
+		luaL_checkstack(L, 1, NULL);
+		lua_pushlstring(L, (const char *)ptr, size);
+		ptr += size;
+		sz -= size;
+		++n;
+	}
+	return n;
+}
+
 LUAMOD_API int
 luaopen_skynet_netpack(lua_State *L) {
 	luaL_checkversion(L);
 	luaL_Reg l[] = {
 		{ "pop", lpop },
+		{ "popn", lpopn },
 		{ "pack", lpack },
 		{ "clear", lclear },
 		{ "tostring", ltostring },
+		{ "unpackv", lunpackv },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
@@ -30,81 +30,113 @@
 // hibits 0~31 : len
 #define TYPE_LONG_STRING 5
 #define TYPE_TABLE 6
+#define TYPE_DICT 7
+// The stream packed in dictionary mode begins with COMBINE_TYPE(TYPE_DICT, 0).
+// Every short string (2 ~ MAX_COOKIE-1 bytes) written in full is added to the dictionary (both sides, in stream order),
+// and a string already in it is written as a back-reference :
+// hibits 1~30 : index 0~29 , 31 : index is the following integer
 
 #define MAX_COOKIE 32
 #define COMBINE_TYPE(t,v) ((t) | (v) << 3)
 
-#define BLOCK_SIZE 128
+#define BLOCK_SIZE 256
 #define MAX_DEPTH 32
+#define MAX_DICT 1024
+#define DICT_HASH (MAX_DICT * 2)
+#define DICT_MINLEN 2
 
-struct block {
-	struct block * next;
-	char buffer[BLOCK_SIZE];
+// The dictionary of pack, short strings are interned by lua, so the pointer is the key.
+// A __pairs metamethod may run the gc during pack, so the strings in the dictionary are kept in
+// the anchor table, otherwise the address of a collected string could be reused by another one.
+struct pack_dict {
+	int n;
+	int anchor;	// stack index of the anchor table
+	const char * key[DICT_HASH];
+	int index[DICT_HASH];
 };
 
+struct unpack_dict {
+	int n;
+	struct {
+		const char * str;
+		int len;
+	} s[MAX_DICT];
+};
+
+// The stream is written into one contiguous buffer, it begins with the block on the C stack,
+// and moves to the heap (doubles) when it's full. So pack needs no malloc for small messages,
+// and only one realloc chain for the large ones.
 struct write_block {
-	struct block * head;
-	struct block * current;
+	char * buffer;
 	int len;
-	int ptr;
+	int cap;
+	char * stack;
+	struct pack_dict * dict;	// NULL when it's not in dictionary mode
 };
 
 struct read_block {
 	char * buffer;
 	int len;
 	int ptr;
+	struct unpack_dict * dict;
+	int anchor;	// lazy mode : the stack index of the string which holds the stream, the tables become lazy_table
+};
+
+#define LAZY_TABLE "skynet.lazytable"
+
+// A table in the stream which is decoded on access (see luaseri_unpacklazy), the positions are offsets in buffer.
+// Its user value is the cache of the decoded fields, and it anchors the string of buffer.
+struct lazy_table {
+	const char * buffer;
+	int start;	// the type byte
+	int size;	// the bytes of the whole table
+	int array_size;
+	int array;	// the first item of array part
+	int hash;	// the first key of hash part, -1 when unknown
 };
 
-inline static struct block *
-blk_alloc(void) {
-	struct block *b = skynet_malloc(sizeof(struct block));
-	b->next = NULL;
-	return b;
+static void lazy_materialize(lua_State *L, struct lazy_table *lt);
+
+static void
+wb_expand(struct write_block *b, int sz) {
+	int cap = b->cap * 2;
+	while (cap < b->len + sz) {
+		cap *= 2;
+	}
+	if (b->buffer == b->stack) {
+		char * buffer = skynet_malloc(cap);
+		memcpy(buffer, b->buffer, b->len);
+		b->buffer = buffer;
+	} else {
+		b->buffer = skynet_realloc(b->buffer, cap);
+	}
+	b->cap = cap;
 }
 
 inline static void
 wb_push(struct write_block *b, const void *buf, int sz) {
-	const char * buffer = buf;
-	if (b->ptr == BLOCK_SIZE) {
-_again:
-		b->current = b->current->next = blk_alloc();
-		b->ptr = 0;
-	}
-	if (b->ptr <= BLOCK_SIZE - sz) {
-		memcpy(b->current->buffer + b->ptr, buffer, sz);
-		b->ptr+=sz;
-		b->len+=sz;
-	} else {
-		int copy = BLOCK_SIZE - b->ptr;
-		memcpy(b->current->buffer + b->ptr, buffer, copy);
-		buffer += copy;
-		b->len += copy;
-		sz -= copy;
-		goto _again;
+	if (b->len + sz > b->cap) {
+		wb_expand(b, sz);
 	}
+	memcpy(b->buffer + b->len, buf, sz);
+	b->len += sz;
 }
 
 static void
-wb_init(struct write_block *wb , struct block *b) {
-	wb->head = b;
-	assert(b->next == NULL);
+wb_init(struct write_block *wb , char *stack, int sz) {
+	wb->buffer = stack;
+	wb->stack = stack;
 	wb->len = 0;
-	wb->current = wb->head;
-	wb->ptr = 0;
+	wb->cap = sz;
+	wb->dict = NULL;
 }
 
 static void
 wb_free(struct write_block *wb) {
-	struct block *blk = wb->head;
-	blk = blk->next;	// the first block is on stack
-	while (blk) {
-		struct block * next = blk->next;
-		skynet_free(blk);
-		blk = next;
-	}
-	wb->head = NULL;
-	wb->current = NULL;
-	wb->ptr = 0;
+	if (wb->buffer != wb->stack) {
+		skynet_free(wb->buffer);
+	}
+	wb->buffer = wb->stack;
 	wb->len = 0;
 }
 
@@ -113,6 +145,8 @@ rball_init(struct read_block * rb, char * buffer, int size) {
 	rb->buffer = buffer;
 	rb->len = size;
 	rb->ptr = 0;
+	rb->dict = NULL;
+	rb->anchor = 0;
 }
 
 static void *
@@ -212,6 +246,48 @@ wb_string(struct write_block *wb, const char *str, int len) {
 	}
 }
 
+// returns the index of str in the dictionary, or -1 (and add it when there is room)
+static int
+dict_lookup(lua_State *L, struct pack_dict *d, int index, const char *str) {
+	uint32_t h = (uint32_t)(((uintptr_t)str >> 3) * 2654435761u);
+	int slot = h & (DICT_HASH - 1);
+	for (;;) {
+		const char * key = d->key[slot];
+		if (key == str) {
+			return d->index[slot];
+		}
+		if (key == NULL) {
+			if (d->n < MAX_DICT) {
+				d->key[slot] = str;
+				d->index[slot] = d->n++;
+				lua_pushvalue(L, index);
+				lua_rawseti(L, d->anchor, d->n);
+			}
+			return -1;
+		}
+		slot = (slot + 1) & (DICT_HASH - 1);
+	}
+}
+
+static inline void
+wb_dict_string(lua_State *L, struct write_block *wb, int index, const char *str, int len) {
+	if (len >= DICT_MINLEN && len < MAX_COOKIE) {
+		int ref = dict_lookup(L, wb->dict, index, str);
+		if (ref >= 0) {
+			if (ref < MAX_COOKIE - 2) {
+				uint8_t n = COMBINE_TYPE(TYPE_DICT, ref + 1);
+				wb_push(wb, &n, 1);
+			} else {
+				uint8_t n = COMBINE_TYPE(TYPE_DICT, MAX_COOKIE - 1);
+				wb_push(wb, &n, 1);
+				wb_integer(wb, ref);
+			}
+			return;
+		}
+	}
+	wb_string(wb, str, len);
+}
+
 static void pack_one(lua_State *L, struct write_block *b, int index, int depth);
 
 static int
@@ -320,12 +396,33 @@ pack_one(lua_State *L, struct write_block *b, int index, int depth) {
 	case LUA_TSTRING: {
 		size_t sz = 0;
 		const char *str = lua_tolstring(L,index,&sz);
-		wb_string(b, str, (int)sz);
+		if (b->dict) {
+			wb_dict_string(L, b, index, str, (int)sz);
+		} else {
+			wb_string(b, str, (int)sz);
+		}
 		break;
 	}
 	case LUA_TLIGHTUSERDATA:
 		wb_pointer(b, lua_touserdata(L,index));
 		break;
+	case LUA_TUSERDATA: {
+		struct lazy_table * lt = luaL_testudata(L, index, LAZY_TABLE);
+		if (lt == NULL) {
+			wb_free(b);
+			luaL_error(L, "Unsupport type %s to serialize", lua_typename(L, type));
+		}
+		if (b->dict == NULL) {
+			// forward without decoding
+			wb_push(b, lt->buffer + lt->start, lt->size);
+		} else {
+			// the strings in it should be in the dictionary
+			lazy_materialize(L, lt);
+			wb_table(L, b, lua_gettop(L), depth+1);
+			lua_pop(L, 1);
+		}
+		break;
+	}
 	case LUA_TTABLE: {
 		if (index < 0) {
 			index = lua_gettop(L) + index + 1;
@@ -429,7 +526,44 @@ get_buffer(lua_State *L, struct read_block *rb, int len) {
 	lua_pushlstring(L,p,len);
 }
 
+// a short string in dictionary mode, the same rule as wb_dict_string
+static void
+get_short_string(lua_State *L, struct read_block *rb, int len) {
+	struct unpack_dict *d = rb->dict;
+	if (d && len >= DICT_MINLEN && d->n < MAX_DICT) {
+		d->s[d->n].str = rb->buffer + rb->ptr;
+		d->s[d->n].len = len;
+		get_buffer(L,rb,len);
+		++d->n;
+	} else {
+		get_buffer(L,rb,len);
+	}
+}
+
+static void
+get_dict_string(lua_State *L, struct read_block *rb, int cookie) {
+	struct unpack_dict *d = rb->dict;
+	if (d == NULL || cookie == 0) {
+		invalid_stream(L,rb);
+	}
+	lua_Integer index;
+	if (cookie == MAX_COOKIE - 1) {
+		uint8_t *t = rb_read(rb, 1);
+		if (t == NULL || (*t & 7) != TYPE_NUMBER || (*t >> 3) == TYPE_NUMBER_REAL) {
+			invalid_stream(L,rb);
+		}
+		index = get_integer(L,rb,*t >> 3);
+	} else {
+		index = cookie - 1;
+	}
+	if (index < 0 || index >= d->n) {
+		invalid_stream(L,rb);
+	}
+	lua_pushlstring(L, d->s[index].str, d->s[index].len);
+}
+
 static void unpack_one(lua_State *L, struct read_block *rb);
+static void lazy_table(lua_State *L, struct read_block *rb, int cookie);
 
 static void
 unpack_table(lua_State *L, struct read_block *rb, int array_size) {
@@ -484,7 +618,10 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		lua_pushlightuserdata(L,get_pointer(L,rb));
 		break;
 	case TYPE_SHORT_STRING:
-		get_buffer(L,rb,cookie);
+		get_short_string(L,rb,cookie);
+		break;
+	case TYPE_DICT:
+		get_dict_string(L,rb,cookie);
 		break;
 	case TYPE_LONG_STRING: {
 		if (cookie == 2) {
@@ -510,7 +647,11 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		break;
 	}
 	case TYPE_TABLE: {
-		unpack_table(L,rb,cookie);
+		if (rb->anchor) {
+			lazy_table(L,rb,cookie);
+		} else {
+			unpack_table(L,rb,cookie);
+		}
 		break;
 	}
 	default: {
@@ -532,24 +673,225 @@ unpack_one(lua_State *L, struct read_block *rb) {
 }
 
 static void
-seri(lua_State *L, struct block *b, int len) {
-	uint8_t * buffer = skynet_malloc(len);
-	uint8_t * ptr = buffer;
-	int sz = len;
-	while(len>0) {
-		if (len >= BLOCK_SIZE) {
-			memcpy(ptr, b->buffer, BLOCK_SIZE);
-			ptr += BLOCK_SIZE;
-			len -= BLOCK_SIZE;
-			b = b->next;
+rb_skip(lua_State *L, struct read_block *rb, int sz) {
+	if (rb_read(rb, sz) == NULL) {
+		invalid_stream(L,rb);
+	}
+}
+
+static void skip_value(lua_State *L, struct read_block *rb);
+
+static int
+get_array_size(lua_State *L, struct read_block *rb, int cookie) {
+	if (cookie != MAX_COOKIE-1)
+		return cookie;
+	uint8_t *t = rb_read(rb, 1);
+	if (t == NULL || (*t & 7) != TYPE_NUMBER || (*t >> 3) == TYPE_NUMBER_REAL) {
+		invalid_stream(L,rb);
+	}
+	return (int)get_integer(L,rb,*t >> 3);
+}
+
+static inline int
+hash_end(lua_State *L, struct read_block *rb) {
+	if (rb->len < 1) {
+		invalid_stream(L,rb);
+	}
+	return rb->buffer[rb->ptr] == TYPE_NIL;
+}
+
+// skip the hash part and the end mark (nil)
+static void
+skip_hash(lua_State *L, struct read_block *rb) {
+	while (!hash_end(L, rb)) {
+		skip_value(L,rb);
+		skip_value(L,rb);
+	}
+	rb_skip(L,rb,1);
+}
+
+// skip a value without decoding it, the dictionary mode isn't supported
+static void
+skip_value(lua_State *L, struct read_block *rb) {
+	uint8_t *t = rb_read(rb, 1);
+	if (t == NULL) {
+		invalid_stream(L,rb);
+	}
+	int type = *t & 7;
+	int cookie = *t >> 3;
+	switch (type) {
+	case TYPE_NIL:
+	case TYPE_BOOLEAN:
+		break;
+	case TYPE_NUMBER:
+		if (cookie == TYPE_NUMBER_REAL) {
+			rb_skip(L,rb,sizeof(double));
 		} else {
-			memcpy(ptr, b->buffer, len);
-			break;
+			get_integer(L,rb,cookie);
+		}
+		break;
+	case TYPE_USERDATA:
+		rb_skip(L,rb,sizeof(void *));
+		break;
+	case TYPE_SHORT_STRING:
+		rb_skip(L,rb,cookie);
+		break;
+	case TYPE_LONG_STRING: {
+		uint32_t n;
+		if (cookie == 2) {
+			uint16_t n16;
+			void * p = rb_read(rb, 2);
+			if (p == NULL)
+				invalid_stream(L,rb);
+			memcpy(&n16, p, 2);
+			n = n16;
+		} else {
+			void * p = rb_read(rb, 4);
+			if (cookie != 4 || p == NULL)
+				invalid_stream(L,rb);
+			memcpy(&n, p, 4);
+		}
+		rb_skip(L,rb,n);
+		break;
+	}
+	case TYPE_TABLE: {
+		int array_size = get_array_size(L,rb,cookie);
+		int i;
+		for (i=0;i<array_size;i++) {
+			skip_value(L,rb);
+		}
+		skip_hash(L,rb);
+		break;
+	}
+	default:
+		invalid_stream(L,rb);
+	}
+}
+
+static char LAZY_ANCHOR;
+
+// the type byte of the table has been read, push a lazy_table and skip the table
+static void
+lazy_table(lua_State *L, struct read_block *rb, int cookie) {
+	luaL_checkstack(L,LUA_MINSTACK,NULL);
+	int start = rb->ptr - 1;
+	int array_size = get_array_size(L,rb,cookie);
+	int array = rb->ptr;
+	int i;
+	for (i=0;i<array_size;i++) {
+		skip_value(L,rb);
+	}
+	int hash = rb->ptr;
+	skip_hash(L,rb);
+
+	struct lazy_table *lt = lua_newuserdata(L, sizeof(*lt));
+	lt->buffer = rb->buffer;
+	lt->start = start;
+	lt->size = rb->ptr - start;
+	lt->array_size = array_size;
+	lt->array = array;
+	lt->hash = hash;
+	luaL_setmetatable(L, LAZY_TABLE);
+	lua_createtable(L, 0, 1);
+	lua_pushvalue(L, rb->anchor);
+	lua_rawsetp(L, -2, &LAZY_ANCHOR);
+	lua_setuservalue(L, -2);
+}
+
+static void
+lazy_materialize(lua_State *L, struct lazy_table *lt) {
+	struct read_block rb;
+	rball_init(&rb, (char *)lt->buffer + lt->start, lt->size);
+	luaL_checkstack(L,LUA_MINSTACK,NULL);
+	unpack_one(L, &rb);
+}
+
+static int
+lazy_index(lua_State *L) {
+	struct lazy_table *lt = luaL_checkudata(L, 1, LAZY_TABLE);
+	lua_settop(L, 2);
+	lua_getuservalue(L, 1);	// 3 : cache
+	lua_pushvalue(L, 2);
+	if (lua_rawget(L, 3) != LUA_TNIL) {
+		return 1;
+	}
+	lua_pop(L, 1);
+	lua_rawgetp(L, 3, &LAZY_ANCHOR);	// 4 : the string of stream
+	struct read_block rb;
+	rball_init(&rb, (char *)lt->buffer, lt->start + lt->size);
+	rb.anchor = 4;
+	int isnum;
+	lua_Integer key = lua_tointegerx(L, 2, &isnum);
+	if (isnum && key > 0 && key <= lt->array_size) {
+		rb_skip(L, &rb, lt->array);
+		int i;
+		for (i=1;i<key;i++) {
+			skip_value(L, &rb);
+		}
+		unpack_one(L, &rb);
+	} else {
+		rb_skip(L, &rb, lt->hash);
+		for (;;) {
+			if (hash_end(L, &rb)) {
+				return 0;
+			}
+			unpack_one(L, &rb);
+			int found = lua_rawequal(L, -1, 2);
+			lua_pop(L, 1);
+			if (found) {
+				unpack_one(L, &rb);
+				break;
+			}
+			skip_value(L, &rb);
+		}
+	}
+	lua_pushvalue(L, 2);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, 3);
+	return 1;
+}
+
+static int
+lazy_len(lua_State *L) {
+	struct lazy_table *lt = luaL_checkudata(L, 1, LAZY_TABLE);
+	lua_pushinteger(L, lt->array_size);
+	return 1;
+}
+
+// pairs decodes the whole table (the nested tables too)
+static int
+lazy_pairs(lua_State *L) {
+	struct lazy_table *lt = luaL_checkudata(L, 1, LAZY_TABLE);
+	lua_getglobal(L, "next");
+	lazy_materialize(L, lt);
+	lua_pushnil(L);
+	return 3;
+}
+
+static int
+lazy_newindex(lua_State *L) {
+	return luaL_error(L, "The lazy table is read only");
+}
+
+// hand off the stream as one exact-size allocation
+static void
+seri(lua_State *L, struct write_block *wb) {
+	int len = wb->len;
+	char * buffer;
+	if (wb->buffer == wb->stack) {
+		buffer = skynet_malloc(len);
+		memcpy(buffer, wb->buffer, len);
+	} else {
+		buffer = wb->buffer;
+		if (wb->cap != len) {
+			buffer = skynet_realloc(buffer, len);
 		}
 	}
-	
+	wb->buffer = wb->stack;
+	wb->len = 0;
+
 	lua_pushlightuserdata(L, buffer);
-	lua_pushinteger(L, sz);
+	lua_pushinteger(L, len);
 }
 
 int
@@ -577,6 +919,12 @@ luaseri_unpack(lua_State *L) {
 	lua_settop(L,1);
 	struct read_block rb;
 	rball_init(&rb, buffer, len);
+	struct unpack_dict dict;
+	if (*(uint8_t *)buffer == COMBINE_TYPE(TYPE_DICT, 0)) {
+		rb_read(&rb, 1);
+		dict.n = 0;
+		rb.dict = &dict;
+	}
 
 	int i;
 	for (i=0;;i++) {
@@ -596,17 +944,119 @@ luaseri_unpack(lua_State *L) {
 	return lua_gettop(L) - 1;
 }
 
+/*
+	lightuserdata msg
+	integer size
+	(or string msg)
+
+	Like luaseri_unpack, but the tables are returned as lazy tables (userdata) : the fields are decoded on access,
+	and they are packed again (forwarded) by copying the bytes, without decoding.
+	The stream is copied into a lua string once, so msg can be freed after.
+	The stream of dictionary mode is unpacked eagerly.
+ */
+int
+luaseri_unpacklazy(lua_State *L) {
+	if (lua_isnoneornil(L,1)) {
+		return 0;
+	}
+	if (lua_type(L,1) != LUA_TSTRING) {
+		const char * buffer = lua_touserdata(L,1);
+		int len = luaL_checkinteger(L,2);
+		if (len == 0) {
+			return 0;
+		}
+		if (buffer == NULL) {
+			return luaL_error(L, "deserialize null pointer");
+		}
+		if (*(uint8_t *)buffer == COMBINE_TYPE(TYPE_DICT, 0)) {
+			return luaseri_unpack(L);
+		}
+		lua_pushlstring(L, buffer, len);
+		lua_replace(L, 1);
+	}
+	lua_settop(L,1);
+	size_t sz;
+	char * buffer = (char *)lua_tolstring(L,1,&sz);
+	if (sz == 0) {
+		return 0;
+	}
+	if (*(uint8_t *)buffer == COMBINE_TYPE(TYPE_DICT, 0)) {
+		return luaseri_unpack(L);
+	}
+	if (luaL_newmetatable(L, LAZY_TABLE)) {
+		luaL_Reg l[] = {
+			{ "__index", lazy_index },
+			{ "__len", lazy_len },
+			{ "__pairs", lazy_pairs },
+			{ "__newindex", lazy_newindex },
+			{ NULL, NULL },
+		};
+		luaL_setfuncs(L, l, 0);
+	}
+	lua_pop(L, 1);
+	struct read_block rb;
+	rball_init(&rb, buffer, (int)sz);
+	rb.anchor = 1;
+
+	int i;
+	for (i=0;;i++) {
+		if (i%8==7) {
+			luaL_checkstack(L,LUA_MINSTACK,NULL);
+		}
+		uint8_t type = 0;
+		uint8_t *t = rb_read(&rb, sizeof(type));
+		if (t==NULL)
+			break;
+		type = *t;
+		push_value(L, &rb, type & 0x7, type>>3);
+	}
+
+	return lua_gettop(L) - 1;
+}
+
 LUAMOD_API int
 luaseri_pack(lua_State *L) {
-	struct block temp;
-	temp.next = NULL;
+	char temp[BLOCK_SIZE];
 	struct write_block wb;
-	wb_init(&wb, &temp);
+	wb_init(&wb, temp, sizeof(temp));
 	pack_from(L,&wb,0);
-	assert(wb.head == &temp);
-	seri(L, &temp, wb.len);
+	seri(L, &wb);
 
-	wb_free(&wb);
+	return 2;
+}
+
+// pack in dictionary mode, repeated short strings (table keys, enums) are written as back-references.
+// luaseri_unpack accepts both modes.
+LUAMOD_API int
+luaseri_packdict(lua_State *L) {
+	char temp[BLOCK_SIZE];
+	struct pack_dict dict;
+	dict.n = 0;
+	memset(dict.key, 0, sizeof(dict.key));
+	lua_newtable(L);
+	lua_insert(L, 1);
+	dict.anchor = 1;
+	struct write_block wb;
+	wb_init(&wb, temp, sizeof(temp));
+	wb.dict = &dict;
+	uint8_t n = COMBINE_TYPE(TYPE_DICT, 0);
+	wb_push(&wb, &n, 1);
+	pack_from(L,&wb,1);
+	wb.dict = NULL;
+	seri(L, &wb);
 
 	return 2;
 }
+
+// pack into a lua string, the stream needn't be handed off
+LUAMOD_API int
+luaseri_packstring(lua_State *L) {
+	char temp[BLOCK_SIZE];
+	struct write_block wb;
+	wb_init(&wb, temp, sizeof(temp));
+	pack_from(L,&wb,0);
+	lua_pushlstring(L, wb.buffer, wb.len);
+	wb_free(&wb);
+
+	return 1;
+}
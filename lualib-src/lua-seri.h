@@ -5,5 +5,8 @@
 
 int luaseri_pack(lua_State *L);
 int luaseri_unpack(lua_State *L);
+int luaseri_packstring(lua_State *L);
+int luaseri_packdict(lua_State *L);
+int luaseri_unpacklazy(lua_State *L);
 
 #endif
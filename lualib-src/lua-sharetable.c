@@ -0,0 +1,46 @@
+// 只读共享表 : 表被冻结后, 所有服务的 lua 虚拟机都可以直接读取它, 而不需要各自复制一份
+#define LUA_LIB
+
+#include <lua.h>
+#include <lauxlib.h>
+
+/*
+	table
+	return lightuserdata (the shared table)
+
+	The table (and all the tables in it) can't be modified after freezing, and it's never freed.
+	It can only have strings, numbers, booleans, lightuserdata and tables without metatable.
+ */
+static int
+lfreeze(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	lua_sharetable(L, 1);
+	lua_pushlightuserdata(L, (void *)lua_topointer(L, 1));
+	return 1;
+}
+
+/*
+	lightuserdata (the shared table)
+	return table
+ */
+static int
+lclone(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	lua_clonetable(L, lua_touserdata(L, 1));
+	return 1;
+}
+
+LUAMOD_API int
+luaopen_skynet_sharetable_core(lua_State *L) {
+	luaL_checkversion(L);
+
+	luaL_Reg l[] = {
+		{ "freeze", lfreeze },
+		{ "clone", lclone },
+		{ NULL, NULL },
+	};
+
+	luaL_newlib(L,l);
+
+	return 1;
+}
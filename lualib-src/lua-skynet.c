@@ -41,6 +41,252 @@ struct snlua {
 	const char * preload;
 };
 
+// 服务的 gc 策略，见 lgcpolicy
+// idle 模式下收集器是停止的，不会在消息处理的中途运行。每个消息处理完之后，如果内存达到了阈值(上一轮收集后的内存 * pause)，
+// 就按这个消息的分配量推进一步；如果消息队列已经空了，就在 budget 时间内尽量完成这一轮收集。
+// 消息处理完时队列为空还不算空闲：刚发出的回应可能还在全局队列里，对方处理完马上就会发来下一个请求。
+// 所以这时先给自己发一个 gc 消息 (PTYPE_RESPONSE, session 0)，它排在其它服务的后面，到达时队列仍然为空才算空闲。
+#define GC_MINSTEP 32	// KB, 消息之间推进一步的最小分配量
+#define GC_IDLESTEP 16	// KB, 队列空闲时每次推进的分配量，每一步之后检查一次队列
+#define GC_SESSION 0
+
+struct gc_policy {
+	int idle;	// 1 : 只在消息之间推进收集器
+	int pause;
+	int cycle;	// 1 : 正在进行一轮收集
+	int threshold;	// KB, 内存达到后开始新的一轮收集
+	int lastkb;	// KB, 上次推进之后的内存
+	int64_t budget;	// nsec
+	int pending;	// 1 : 已经给自己发了 gc 消息
+	uint32_t self;
+};
+
+// 等待回应的 session -> 协程，开放寻址 (线性探测) 的散列表，_cb 收到回应时直接找到要唤醒的协程，
+// 不再经过 skynet.lua 中的 session_id_coroutine 表。
+// 协程放在 anchor 表 (callback_context 的 uservalue) 的数组部分，下标是槽位 + 1；anchor[0] 是槽位数组 (userdata)
+#define SESSION_INITCAP 64
+
+struct session_slot {
+	int session;	// 0 : 空槽
+	int wakeup;	// 1 : 协程已经被 skynet.wakeup 唤醒 ("BREAK")，回应到达的时候丢弃
+};
+
+struct session_map {
+	struct session_slot * slot;
+	int cap;	// 2 的幂
+	int n;
+};
+
+// skynet_callback 的 ud，每个服务一个，放在注册表中
+struct callback_context {
+	lua_State * L;	// 主线程
+	lua_Integer gctime;	// 上次报告给 skynet_gcstat 的 gc 耗时
+	struct gc_policy gc;
+	struct session_map sessions;
+};
+
+static int callback_key;
+
+static struct callback_context *
+callback_context(lua_State *L) {
+	if (lua_rawgetp(L, LUA_REGISTRYINDEX, &callback_key) == LUA_TUSERDATA) {
+		struct callback_context *cb = lua_touserdata(L, -1);
+		lua_pop(L, 1);
+		return cb;
+	}
+	lua_pop(L, 1);
+	struct callback_context *cb = lua_newuserdata(L, sizeof(*cb));
+	memset(cb, 0, sizeof(*cb));
+	lua_newtable(L);	// anchor
+	lua_setuservalue(L, -2);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &callback_key);
+	lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+	cb->L = lua_tothread(L, -1);
+	lua_pop(L, 1);
+	return cb;
+}
+
+static int
+session_find(struct session_map *m, int session) {
+	if (m->cap == 0 || session == 0)
+		return -1;
+	int mask = m->cap - 1;
+	int i = session & mask;
+	for (;;) {
+		int s = m->slot[i].session;
+		if (s == session)
+			return i;
+		if (s == 0)
+			return -1;
+		i = (i + 1) & mask;
+	}
+}
+
+// 把槽位 i 的协程压栈，已经唤醒的压入 "BREAK" (和原来 session_id_coroutine 中的值一样)
+static void
+session_push(lua_State *L, int anchor, struct session_map *m, int i) {
+	if (m->slot[i].wakeup) {
+		lua_pushliteral(L, "BREAK");
+	} else {
+		lua_rawgeti(L, anchor, i + 1);
+	}
+}
+
+static void
+session_resize(lua_State *L, int anchor, struct session_map *m, int cap) {
+	struct session_slot *old = m->slot;
+	int oldcap = m->cap;
+	struct session_slot *slot = lua_newuserdata(L, cap * sizeof(*slot));
+	memset(slot, 0, cap * sizeof(*slot));
+	// 暂存协程，anchor 表不变 (_cb 把它放在主线程的栈上)
+	lua_createtable(L, oldcap, 0);
+	int i;
+	for (i = 0; i < oldcap; i++) {
+		if (old[i].session) {
+			lua_rawgeti(L, anchor, i + 1);
+			lua_rawseti(L, -2, i + 1);
+			lua_pushnil(L);
+			lua_rawseti(L, anchor, i + 1);
+		}
+	}
+	int mask = cap - 1;
+	for (i = 0; i < oldcap; i++) {
+		if (old[i].session) {
+			int j = old[i].session & mask;
+			while (slot[j].session) {
+				j = (j + 1) & mask;
+			}
+			slot[j] = old[i];
+			lua_rawgeti(L, -1, i + 1);
+			lua_rawseti(L, anchor, j + 1);
+		}
+	}
+	lua_pop(L, 1);
+	lua_rawseti(L, anchor, 0);	// 新的槽位数组，旧的随之回收
+	m->slot = slot;
+	m->cap = cap;
+}
+
+// co 是协程在栈上的位置，返回 0 表示 session 已经存在
+static int
+session_insert(lua_State *L, int anchor, struct session_map *m, int session, int co) {
+	if (session_find(m, session) >= 0)
+		return 0;
+	if ((m->n + 1) * 2 > m->cap) {
+		session_resize(L, anchor, m, m->cap ? m->cap * 2 : SESSION_INITCAP);
+	}
+	int mask = m->cap - 1;
+	int i = session & mask;
+	while (m->slot[i].session) {
+		i = (i + 1) & mask;
+	}
+	m->slot[i].session = session;
+	m->slot[i].wakeup = 0;
+	++m->n;
+	lua_pushvalue(L, co);
+	lua_rawseti(L, anchor, i + 1);
+	return 1;
+}
+
+// 删除槽位 i，后面同一个探测序列中的项向前移动，不需要删除标记
+static void
+session_remove(lua_State *L, int anchor, struct session_map *m, int i) {
+	int mask = m->cap - 1;
+	int j = i;
+	--m->n;
+	for (;;) {
+		m->slot[i].session = 0;
+		lua_pushnil(L);
+		lua_rawseti(L, anchor, i + 1);
+		int k;
+		for (;;) {
+			j = (j + 1) & mask;
+			if (m->slot[j].session == 0)
+				return;
+			k = m->slot[j].session & mask;
+			// 原来的位置 k 在 (i, j] 之间的项不能移动到 i
+			if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+				continue;
+			break;
+		}
+		m->slot[i] = m->slot[j];
+		lua_rawgeti(L, anchor, j + 1);
+		lua_rawseti(L, anchor, i + 1);
+		i = j;
+	}
+}
+
+// 收集器停止的时候，lua_gc(LUA_GCSTEP, kb) 按 kb 的分配量推进收集器。先 restart 把欠账清零，一步的工作量只由 kb 决定
+// 返回 1 表示完成了一轮收集
+static int
+gc_advance(lua_State *L, int kb) {
+	lua_gc(L, LUA_GCRESTART, 0);
+	lua_gc(L, LUA_GCSTOP, 0);
+	return lua_gc(L, LUA_GCSTEP, kb);
+}
+
+static inline int
+mq_idle(struct skynet_context * context) {
+	return strcmp(skynet_command(context, "STAT", "mqlen"), "0") == 0;
+}
+
+// tick : 1 表示由 gc 消息触发
+// 给自己发一个消息，等消息队列里前面的消息处理完再继续 gc
+static void
+gc_tick(struct skynet_context * context, struct gc_policy *gc) {
+	if (gc->pending)
+		return;
+	if (gc->self == 0) {
+		gc->self = strtoul(skynet_command(context, "REG", NULL) + 1, NULL, 16);
+	}
+	gc->pending = 1;
+	skynet_send(context, 0, gc->self, PTYPE_RESPONSE, GC_SESSION, NULL, 0);
+}
+
+static void
+gc_step(struct skynet_context * context, struct gc_policy *gc, lua_State *L, int tick) {
+	int kb = lua_gc(L, LUA_GCCOUNT, 0);
+	int debt = kb - gc->lastkb;
+	if (!gc->cycle) {
+		if (kb < gc->threshold)
+			return;
+		gc->cycle = 1;
+		debt = GC_MINSTEP;
+	}
+	int done;
+	if (!mq_idle(context)) {
+		done = gc_advance(L, debt < GC_MINSTEP ? GC_MINSTEP : debt);
+	} else if (!tick) {
+		gc_tick(context, gc);
+		return;
+	} else {
+		// 有消息到达就马上停下
+		int64_t deadline = get_time() + gc->budget;
+		do {
+			done = gc_advance(L, GC_IDLESTEP);
+		} while (!done && get_time() < deadline && mq_idle(context));
+		if (!done && mq_idle(context)) {
+			// 时间片用完了还是空闲，再发一次，在之后的空闲时间里做完这一轮
+			gc_tick(context, gc);
+		}
+	}
+	kb = lua_gc(L, LUA_GCCOUNT, 0);
+	if (done) {
+		gc->cycle = 0;
+		gc->threshold = kb / 100 * gc->pause;
+	}
+	gc->lastkb = kb;
+}
+
+static void
+gc_report(struct skynet_context * context, struct callback_context *cb) {
+	lua_Integer gctime = lua_gctime(cb->L);
+	if (gctime != cb->gctime) {
+		cb->gctime = gctime;
+		skynet_gcstat(context, (uint64_t)gctime);
+	}
+}
+
 static int
 traceback (lua_State *L) {
 	const char *msg = lua_tostring(L, 1);
@@ -55,15 +301,28 @@ traceback (lua_State *L) {
 // snlua服务对应C回调的函数，只是简单封装，为了方便调用真正的lua回调函数
 static int
 _cb(struct skynet_context * context, void * ud, int type, int session, uint32_t source, const void * msg, size_t sz) {
-	lua_State *L = ud;
+	struct callback_context *cb = ud;
+	lua_State *L = cb->L;
+	if (type == PTYPE_RESPONSE && session == GC_SESSION && source == cb->gc.self) {
+		cb->gc.pending = 0;
+		if (cb->gc.idle) {
+			gc_step(context, &cb->gc, L, 1);
+			gc_report(context, cb);
+		}
+		return 0;
+	}
 	int trace = 1;
 	int r;
+	int nargs = 5;
 	int top = lua_gettop(L);
 	if (top == 0) {
 		lua_pushcfunction(L, traceback);
 		lua_rawgetp(L, LUA_REGISTRYINDEX, _cb);
+		lua_rawgetp(L, LUA_REGISTRYINDEX, &callback_key);
+		lua_getuservalue(L, -1);	// anchor of the sessions
+		lua_remove(L, -2);
 	} else {
-		assert(top == 2);
+		assert(top == 3);
 	}
 	lua_pushvalue(L,2);
 
@@ -72,29 +331,42 @@ _cb(struct skynet_context * context, void * ud, int type, int session, uint32_t
 	lua_pushinteger(L,sz);
 	lua_pushinteger(L, session);
 	lua_pushinteger(L, source);
+	if (type == PTYPE_RESPONSE) {
+		// 6th argument : the coroutine waiting for the response (or "BREAK")
+		int i = session_find(&cb->sessions, session);
+		if (i >= 0) {
+			session_push(L, 3, &cb->sessions, i);
+			session_remove(L, 3, &cb->sessions, i);
+			nargs = 6;
+		}
+	}
 
-	r = lua_pcall(L, 5, 0 , trace);
+	r = lua_pcall(L, nargs, 0 , trace);
 
-	if (r == LUA_OK) {
-		return 0;
+	if (r != LUA_OK) {
+		const char * self = skynet_command(context, "REG", NULL);
+		switch (r) {
+		case LUA_ERRRUN:
+			skynet_error(context, "lua call [%x to %s : %d msgsz = %d] error : " KRED "%s" KNRM, source , self, session, sz, lua_tostring(L,-1));
+			break;
+		case LUA_ERRMEM:
+			skynet_error(context, "lua memory error : [%x to %s : %d]", source , self, session);
+			break;
+		case LUA_ERRERR:
+			skynet_error(context, "lua error in error : [%x to %s : %d]", source , self, session);
+			break;
+		case LUA_ERRGCMM:
+			skynet_error(context, "lua gc error : [%x to %s : %d]", source , self, session);
+			break;
+		};
+
+		lua_pop(L,1);
 	}
-	const char * self = skynet_command(context, "REG", NULL);
-	switch (r) {
-	case LUA_ERRRUN:
-		skynet_error(context, "lua call [%x to %s : %d msgsz = %d] error : " KRED "%s" KNRM, source , self, session, sz, lua_tostring(L,-1));
-		break;
-	case LUA_ERRMEM:
-		skynet_error(context, "lua memory error : [%x to %s : %d]", source , self, session);
-		break;
-	case LUA_ERRERR:
-		skynet_error(context, "lua error in error : [%x to %s : %d]", source , self, session);
-		break;
-	case LUA_ERRGCMM:
-		skynet_error(context, "lua gc error : [%x to %s : %d]", source , self, session);
-		break;
-	};
 
-	lua_pop(L,1);
+	if (cb->gc.idle) {
+		gc_step(context, &cb->gc, L, 0);
+	}
+	gc_report(context, cb);
 
 	return 0;
 }
@@ -115,18 +387,49 @@ lcallback(lua_State *L) {
 	lua_settop(L,1);
 	lua_rawsetp(L, LUA_REGISTRYINDEX, _cb);
 
-	lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
-	lua_State *gL = lua_tothread(L,-1);
+	struct callback_context *cb = callback_context(L);
 
 	if (forward) {
-		skynet_callback(context, gL, forward_cb);
+		skynet_callback(context, cb, forward_cb);
 	} else {
-		skynet_callback(context, gL, _cb);
+		skynet_callback(context, cb, _cb);
 	}
 
 	return 0;
 }
 
+/*
+	integer pause (nil : 不变)
+	integer stepmul (nil : 不变)
+	boolean idle (true : 只在消息之间推进收集器)
+	number budget (ms, idle 模式下队列空闲时一次最多推进收集器的时间，默认 1ms)
+ */
+static int
+lgcpolicy(lua_State *L) {
+	struct callback_context *cb = callback_context(L);
+	struct gc_policy *gc = &cb->gc;
+	if (!lua_isnoneornil(L, 1)) {
+		lua_gc(L, LUA_GCSETPAUSE, (int)luaL_checkinteger(L, 1));
+	}
+	if (!lua_isnoneornil(L, 2)) {
+		lua_gc(L, LUA_GCSETSTEPMUL, (int)luaL_checkinteger(L, 2));
+	}
+	int idle = lua_toboolean(L, 3);
+	gc->budget = (int64_t)(luaL_optnumber(L, 4, 1) * 1000000);
+	gc->pause = lua_gc(L, LUA_GCSETPAUSE, 0);
+	lua_gc(L, LUA_GCSETPAUSE, gc->pause);
+	if (idle && !gc->idle) {
+		// 当前可能正在一轮收集中，由消息之间的推进来完成
+		lua_gc(L, LUA_GCSTOP, 0);
+		gc->cycle = 1;
+		gc->lastkb = lua_gc(L, LUA_GCCOUNT, 0);
+	} else if (!idle && gc->idle) {
+		lua_gc(L, LUA_GCRESTART, 0);
+	}
+	gc->idle = idle;
+	return 0;
+}
+
 // 执行服务命令，参数和返回值都是字符串的类型
 static int
 lcommand(lua_State *L) {
@@ -376,16 +679,6 @@ lharbor(lua_State *L) {
 	return 2;
 }
 
-static int
-lpackstring(lua_State *L) {
-	luaseri_pack(L);
-	char * str = (char *)lua_touserdata(L, -2);
-	int sz = lua_tointeger(L, -1);
-	lua_pushlstring(L, str, sz);
-	skynet_free(str);
-	return 1;
-}
-
 static int
 ltrash(lua_State *L) {
 	int t = lua_type(L,1);
@@ -486,6 +779,116 @@ ltrace(lua_State *L) {
 	return 0;
 }
 
+// 下面的函数的 upvalue 1 是 callback_context，upvalue 2 是 anchor 表
+
+/*
+	integer session
+	thread co (或者 "BREAK"，把 popsession 取出的值放回去)
+	co 等待 session 的回应，session 已经存在的时候抛出错误
+ */
+static int
+lwaitsession(lua_State *L) {
+	struct callback_context *cb = lua_touserdata(L, lua_upvalueindex(1));
+	int session = (int)luaL_checkinteger(L, 1);
+	int wakeup = 0;
+	if (lua_type(L, 2) == LUA_TSTRING && strcmp(lua_tostring(L, 2), "BREAK") == 0) {
+		wakeup = 1;
+		lua_pushnil(L);
+		lua_replace(L, 2);
+	} else {
+		luaL_checktype(L, 2, LUA_TTHREAD);
+	}
+	if (session == 0 || !session_insert(L, lua_upvalueindex(2), &cb->sessions, session, 2)) {
+		return luaL_error(L, "Invalid session %d", session);
+	}
+	if (wakeup) {
+		cb->sessions.slot[session_find(&cb->sessions, session)].wakeup = 1;
+	}
+	return 0;
+}
+
+/*
+	integer session
+	return thread (等待 session 的协程，并且标记为 "BREAK"，回应到达时丢弃) or nil
+ */
+static int
+lbreaksession(lua_State *L) {
+	struct callback_context *cb = lua_touserdata(L, lua_upvalueindex(1));
+	int i = session_find(&cb->sessions, (int)luaL_checkinteger(L, 1));
+	if (i < 0 || cb->sessions.slot[i].wakeup)
+		return 0;
+	lua_rawgeti(L, lua_upvalueindex(2), i + 1);
+	lua_pushnil(L);
+	lua_rawseti(L, lua_upvalueindex(2), i + 1);
+	cb->sessions.slot[i].wakeup = 1;
+	return 1;
+}
+
+/*
+	integer session
+	return thread or "BREAK" or nil, 并且删除 session
+ */
+static int
+lpopsession(lua_State *L) {
+	struct callback_context *cb = lua_touserdata(L, lua_upvalueindex(1));
+	int i = session_find(&cb->sessions, (int)luaL_checkinteger(L, 1));
+	if (i < 0)
+		return 0;
+	session_push(L, lua_upvalueindex(2), &cb->sessions, i);
+	session_remove(L, lua_upvalueindex(2), &cb->sessions, i);
+	return 1;
+}
+
+/*
+	integer session
+	return thread or "BREAK" or nil
+ */
+static int
+lgetsession(lua_State *L) {
+	struct callback_context *cb = lua_touserdata(L, lua_upvalueindex(1));
+	int i = session_find(&cb->sessions, (int)luaL_checkinteger(L, 1));
+	if (i < 0)
+		return 0;
+	session_push(L, lua_upvalueindex(2), &cb->sessions, i);
+	return 1;
+}
+
+/*
+	table t (可选，填入 t[session] = thread or "BREAK")
+	return integer (等待中的 session 数量)
+ */
+static int
+lsessions(lua_State *L) {
+	struct callback_context *cb = lua_touserdata(L, lua_upvalueindex(1));
+	struct session_map *m = &cb->sessions;
+	if (!lua_isnoneornil(L, 1)) {
+		luaL_checktype(L, 1, LUA_TTABLE);
+		int i;
+		for (i = 0; i < m->cap; i++) {
+			if (m->slot[i].session) {
+				session_push(L, lua_upvalueindex(2), m, i);
+				lua_rawseti(L, 1, m->slot[i].session);
+			}
+		}
+	}
+	lua_pushinteger(L, m->n);
+	return 1;
+}
+
+// 协程放回 skynet.lua 的协程池之前调用，收缩曾经增长过的栈
+#define COROUTINE_STACK 256	// 栈超过这个槽数就收缩
+
+/*
+	thread co (默认是当前的协程)
+	return integer (收缩后栈的大小)
+ */
+static int
+lshrinkstack(lua_State *L) {
+	lua_State *co = lua_isthread(L, 1) ? lua_tothread(L, 1) : L;
+	lua_pushinteger(L, lua_shrinkstack(co, COROUTINE_STACK));
+	return 1;
+}
+
 LUAMOD_API int
 luaopen_skynet_core(lua_State *L) {
 	luaL_checkversion(L);
@@ -509,14 +912,28 @@ luaopen_skynet_core(lua_State *L) {
 		{ "tostring", ltostring },
 		{ "pack", luaseri_pack },
 		{ "unpack", luaseri_unpack },
-		{ "packstring", lpackstring },
+		{ "unpacklazy", luaseri_unpacklazy },
+		{ "packstring", luaseri_packstring },
+		{ "packdict", luaseri_packdict },
 		{ "trash" , ltrash },
 		{ "now", lnow },
 		{ "hpc", lhpc },	// getHPCounter
+		{ "gcpolicy", lgcpolicy },
+		{ "shrinkstack", lshrinkstack },
 		{ NULL, NULL },
 	};
 
-	lua_createtable(L, 0, sizeof(l)/sizeof(l[0]) + sizeof(l2)/sizeof(l2[0]) -2);
+	// functions of the sessions waiting for response, see _cb
+	luaL_Reg l3[] = {
+		{ "waitsession", lwaitsession },
+		{ "breaksession", lbreaksession },
+		{ "popsession", lpopsession },
+		{ "getsession", lgetsession },
+		{ "sessions", lsessions },
+		{ NULL, NULL },
+	};
+
+	lua_createtable(L, 0, sizeof(l)/sizeof(l[0]) + sizeof(l2)/sizeof(l2[0]) + sizeof(l3)/sizeof(l3[0]) -3);
 
 	lua_getfield(L, LUA_REGISTRYINDEX, "skynet_context");
 	struct skynet_context *ctx = lua_touserdata(L,-1);
@@ -529,5 +946,10 @@ luaopen_skynet_core(lua_State *L) {
 
 	luaL_setfuncs(L,l2,0);
 
+	callback_context(L);
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &callback_key);
+	lua_getuservalue(L, -1);
+	luaL_setfuncs(L,l3,2);
+
 	return 1;
 }
@@ -2,6 +2,7 @@
 
 #include "skynet_malloc.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
@@ -12,59 +13,51 @@
 #include <lauxlib.h>
 
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
 
 #include "skynet_socket.h"
 
 #define BACKLOG 32
-// 2 ** 12 == 4096
-#define LARGE_PAGE_NODE 12
 #define BUFFER_LIMIT (256 * 1024)
+#define SEP_CACHE 8
 
-struct buffer_node {
-	char * msg;
-	int sz;
-	struct buffer_node *next;
-};
-
+/*
+	The received data of a socket is kept in one contiguous block : buffer[offset, offset+size).
+	The first message pushed into an empty buffer is adopted as the block (no copy),
+	the following messages are appended, the block is compacted or grows (doubles) when there is no room at the end.
+	So read and readline never walk a list, and a line is searched by memchr.
+	A failed readline remembers how far it searched (scan) for the separator (sep),
+	so a long line which arrives in many messages isn't scanned from the beginning each time.
+ */
 struct socket_buffer {
 	int size;
 	int offset;
-	struct buffer_node *head;
-	struct buffer_node *tail;
+	int cap;
+	char * buffer;
+	int scan;	// [offset, offset + scan) has no sep, 0 when unknown
+	int seplen;
+	char sep[SEP_CACHE];
 };
 
-static int
-lfreepool(lua_State *L) {
-	struct buffer_node * pool = lua_touserdata(L, 1);
-	int sz = lua_rawlen(L,1) / sizeof(*pool);
-	int i;
-	for (i=0;i<sz;i++) {
-		struct buffer_node *node = &pool[i];
-		if (node->msg) {
-			skynet_free(node->msg);
-			node->msg = NULL;
-		}
-	}
-	return 0;
+static inline void
+reset_buffer(struct socket_buffer *sb) {
+	skynet_free(sb->buffer);
+	sb->buffer = NULL;
+	sb->size = 0;
+	sb->offset = 0;
+	sb->cap = 0;
+	sb->scan = 0;
 }
 
 static int
-lnewpool(lua_State *L, int sz) {
-	struct buffer_node * pool = lua_newuserdata(L, sizeof(struct buffer_node) * sz);
-	int i;
-	for (i=0;i<sz;i++) {
-		pool[i].msg = NULL;
-		pool[i].sz = 0;
-		pool[i].next = &pool[i+1];
-	}
-	pool[sz-1].next = NULL;
-	if (luaL_newmetatable(L, "buffer_pool")) {
-		lua_pushcfunction(L, lfreepool);
-		lua_setfield(L, -2, "__gc");
-	}
-	lua_setmetatable(L, -2);
-	return 1;
+lfreebuffer(lua_State *L) {
+	struct socket_buffer * sb = lua_touserdata(L, 1);
+	reset_buffer(sb);
+	return 0;
 }
 
 static int
@@ -72,28 +65,27 @@ lnewbuffer(lua_State *L) {
 	struct socket_buffer * sb = lua_newuserdata(L, sizeof(*sb));	
 	sb->size = 0;
 	sb->offset = 0;
-	sb->head = NULL;
-	sb->tail = NULL;
+	sb->cap = 0;
+	sb->buffer = NULL;
+	sb->scan = 0;
+	sb->seplen = 0;
+	if (luaL_newmetatable(L, "socket_buffer")) {
+		lua_pushcfunction(L, lfreebuffer);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
 	
 	return 1;
 }
 
 /*
 	userdata send_buffer
-	table pool
 	lightuserdata msg
 	int size
 
 	return size
 
-	Comment: The table pool record all the buffers chunk, 
-	and the first index [1] is a lightuserdata : free_node. We can always use this pointer for struct buffer_node .
-	The following ([2] ...)  userdatas in table pool is the buffer chunk (for struct buffer_node), 
-	we never free them until the VM closed. The size of first chunk ([2]) is 16 struct buffer_node,
-	and the second size is 32 ... The largest size of chunk is LARGE_PAGE_NODE (4096)
-
-	lpushbbuffer will get a free struct buffer_node from table pool, and then put the msg/size in it.
-	lpopbuffer return the struct buffer_node back to table pool (By calling return_free_node).
+	The buffer takes over msg.
  */
 static int
 lpushbuffer(lua_State *L) {
@@ -101,109 +93,57 @@ lpushbuffer(lua_State *L) {
 	if (sb == NULL) {
 		return luaL_error(L, "need buffer object at param 1");
 	}
-	char * msg = lua_touserdata(L,3);
+	char * msg = lua_touserdata(L,2);
 	if (msg == NULL) {
-		return luaL_error(L, "need message block at param 3");
+		return luaL_error(L, "need message block at param 2");
 	}
-	int pool_index = 2;
-	luaL_checktype(L,pool_index,LUA_TTABLE);
-	int sz = luaL_checkinteger(L,4);
-	lua_rawgeti(L,pool_index,1);
-	struct buffer_node * free_node = lua_touserdata(L,-1);	// sb poolt msg size free_node
-	lua_pop(L,1);
-	if (free_node == NULL) {
-		int tsz = lua_rawlen(L,pool_index);
-		if (tsz == 0)
-			tsz++;
-		int size = 8;
-		if (tsz <= LARGE_PAGE_NODE-3) {
-			size <<= tsz;
-		} else {
-			size <<= LARGE_PAGE_NODE-3;
-		}
-		lnewpool(L, size);	
-		free_node = lua_touserdata(L,-1);
-		lua_rawseti(L, pool_index, tsz+1);
-	}
-	lua_pushlightuserdata(L, free_node->next);	
-	lua_rawseti(L, pool_index, 1);	// sb poolt msg size
-	free_node->msg = msg;
-	free_node->sz = sz;
-	free_node->next = NULL;
-
-	if (sb->head == NULL) {
-		assert(sb->tail == NULL);
-		sb->head = sb->tail = free_node;
+	int sz = luaL_checkinteger(L,3);
+	if (sb->size == 0) {
+		// adopt the message
+		skynet_free(sb->buffer);
+		sb->buffer = msg;
+		sb->cap = sz;
+		sb->offset = 0;
+		sb->size = sz;
 	} else {
-		sb->tail->next = free_node;
-		sb->tail = free_node;
+		if (sb->offset + sb->size + sz > sb->cap) {
+			int need = sb->size + sz;
+			if (need <= sb->cap && sb->offset >= sb->size) {
+				// enough room after moving the data to the front, and the data is smaller than the hole
+				memmove(sb->buffer, sb->buffer + sb->offset, sb->size);
+			} else {
+				int cap = sb->cap * 2;
+				if (cap < need)
+					cap = need;
+				char * buffer = skynet_malloc(cap);
+				memcpy(buffer, sb->buffer + sb->offset, sb->size);
+				skynet_free(sb->buffer);
+				sb->buffer = buffer;
+				sb->cap = cap;
+			}
+			sb->offset = 0;
+		}
+		memcpy(sb->buffer + sb->offset + sb->size, msg, sz);
+		sb->size += sz;
+		skynet_free(msg);
 	}
-	sb->size += sz;
 
 	lua_pushinteger(L, sb->size);
 
 	return 1;
 }
 
-static void
-return_free_node(lua_State *L, int pool, struct socket_buffer *sb) {
-	struct buffer_node *free_node = sb->head;
-	sb->offset = 0;
-	sb->head = free_node->next;
-	if (sb->head == NULL) {
-		sb->tail = NULL;
-	}
-	lua_rawgeti(L,pool,1);
-	free_node->next = lua_touserdata(L,-1);
-	lua_pop(L,1);
-	skynet_free(free_node->msg);
-	free_node->msg = NULL;
-
-	free_node->sz = 0;
-	lua_pushlightuserdata(L, free_node);
-	lua_rawseti(L, pool, 1);
-}
-
+// push sz bytes from the head of buffer (the last skip bytes are dropped), then remove them
 static void
 pop_lstring(lua_State *L, struct socket_buffer *sb, int sz, int skip) {
-	struct buffer_node * current = sb->head;
-	if (sz < current->sz - sb->offset) {
-		lua_pushlstring(L, current->msg + sb->offset, sz-skip);
-		sb->offset+=sz;
-		return;
-	}
-	if (sz == current->sz - sb->offset) {
-		lua_pushlstring(L, current->msg + sb->offset, sz-skip);
-		return_free_node(L,2,sb);
-		return;
-	}
-
-	luaL_Buffer b;
-	luaL_buffinit(L, &b);
-	for (;;) {
-		int bytes = current->sz - sb->offset;
-		if (bytes >= sz) {
-			if (sz > skip) {
-				luaL_addlstring(&b, current->msg + sb->offset, sz - skip);
-			} 
-			sb->offset += sz;
-			if (bytes == sz) {
-				return_free_node(L,2,sb);
-			}
-			break;
-		}
-		int real_sz = sz - skip;
-		if (real_sz > 0) {
-			luaL_addlstring(&b, current->msg + sb->offset, (real_sz < bytes) ? real_sz : bytes);
-		}
-		return_free_node(L,2,sb);
-		sz-=bytes;
-		if (sz==0)
-			break;
-		current = sb->head;
-		assert(current);
+	lua_pushlstring(L, sb->buffer + sb->offset, sz - skip);
+	sb->size -= sz;
+	sb->scan = 0;
+	if (sb->size == 0) {
+		sb->offset = 0;
+	} else {
+		sb->offset += sz;
 	}
-	luaL_pushresult(&b);
 }
 
 static int
@@ -227,7 +167,6 @@ lheader(lua_State *L) {
 
 /*
 	userdata send_buffer
-	table pool
 	integer sz 
  */
 static int
@@ -236,13 +175,11 @@ lpopbuffer(lua_State *L) {
 	if (sb == NULL) {
 		return luaL_error(L, "Need buffer object at param 1");
 	}
-	luaL_checktype(L,2,LUA_TTABLE);
-	int sz = luaL_checkinteger(L,3);
+	int sz = luaL_checkinteger(L,2);
 	if (sb->size < sz || sz == 0) {
 		lua_pushnil(L);
 	} else {
 		pop_lstring(L,sb,sz,0);
-		sb->size -= sz;
 	}
 	lua_pushinteger(L, sb->size);
 
@@ -251,7 +188,6 @@ lpopbuffer(lua_State *L) {
 
 /*
 	userdata send_buffer
-	table pool
  */
 static int
 lclearbuffer(lua_State *L) {
@@ -262,11 +198,7 @@ lclearbuffer(lua_State *L) {
 		}
 		return luaL_error(L, "Need buffer object at param 1");
 	}
-	luaL_checktype(L,2,LUA_TTABLE);
-	while(sb->head) {
-		return_free_node(L,2,sb);
-	}
-	sb->size = 0;
+	reset_buffer(sb);
 	return 0;
 }
 
@@ -276,16 +208,10 @@ lreadall(lua_State *L) {
 	if (sb == NULL) {
 		return luaL_error(L, "Need buffer object at param 1");
 	}
-	luaL_checktype(L,2,LUA_TTABLE);
-	luaL_Buffer b;
-	luaL_buffinit(L, &b);
-	while(sb->head) {
-		struct buffer_node *current = sb->head;
-		luaL_addlstring(&b, current->msg + sb->offset, current->sz - sb->offset);
-		return_free_node(L,2,sb);
-	}
-	luaL_pushresult(&b);
+	lua_pushlstring(L, sb->buffer + sb->offset, sb->size);
 	sb->size = 0;
+	sb->offset = 0;
+	sb->scan = 0;
 	return 1;
 }
 
@@ -297,29 +223,28 @@ ldrop(lua_State *L) {
 	return 0;
 }
 
-static bool
-check_sep(struct buffer_node * node, int from, const char *sep, int seplen) {
-	for (;;) {
-		int sz = node->sz - from;
-		if (sz >= seplen) {
-			return memcmp(node->msg+from,sep,seplen) == 0;
-		}
-		if (sz > 0) {
-			if (memcmp(node->msg + from, sep, sz)) {
-				return false;
-			}
-		}
-		node = node->next;
-		sep += sz;
-		seplen -= sz;
-		from = 0;
+// returns the offset of sep in [data, data+sz), or -1
+static int
+find_sep(const char * data, int sz, const char *sep, int seplen) {
+	if (seplen == 0)
+		return 0;
+	const char * p = data;
+	const char * last = data + sz - seplen;
+	while (p <= last) {
+		p = memchr(p, sep[0], last - p + 1);
+		if (p == NULL)
+			return -1;
+		if (memcmp(p + 1, sep + 1, seplen - 1) == 0)
+			return (int)(p - data);
+		++p;
 	}
+	return -1;
 }
 
 /*
 	userdata send_buffer
-	table pool , nil for check
 	string sep
+	boolean check (only check)
  */
 static int
 lreadline(lua_State *L) {
@@ -327,37 +252,32 @@ lreadline(lua_State *L) {
 	if (sb == NULL) {
 		return luaL_error(L, "Need buffer object at param 1");
 	}
-	// only check
-	bool check = !lua_istable(L, 2);
 	size_t seplen = 0;
-	const char *sep = luaL_checklstring(L,3,&seplen);
-	int i;
-	struct buffer_node *current = sb->head;
-	if (current == NULL)
+	const char *sep = luaL_checklstring(L,2,&seplen);
+	bool check = lua_toboolean(L, 3);
+	if (sb->size == 0)
 		return 0;
-	int from = sb->offset;
-	int bytes = current->sz - from;
-	for (i=0;i<=sb->size - (int)seplen;i++) {
-		if (check_sep(current, from, sep, seplen)) {
-			if (check) {
-				lua_pushboolean(L,true);
-			} else {
-				pop_lstring(L, sb, i+seplen, seplen);
-				sb->size -= i+seplen;
-			}
-			return 1;
-		}
-		++from;
-		--bytes;
-		if (bytes == 0) {
-			current = current->next;
-			from = 0;
-			if (current == NULL)
-				break;
-			bytes = current->sz;
+	int from = 0;
+	if (sb->scan > 0 && (int)seplen == sb->seplen && memcmp(sep, sb->sep, seplen) == 0) {
+		from = sb->scan;
+	}
+	int i = find_sep(sb->buffer + sb->offset + from, sb->size - from, sep, (int)seplen);
+	if (i < 0) {
+		// remember the searched range for the next readline with the same sep
+		if (seplen <= SEP_CACHE && sb->size >= (int)seplen) {
+			sb->scan = sb->size - seplen + 1;
+			sb->seplen = seplen;
+			memcpy(sb->sep, sep, seplen);
 		}
+		return 0;
 	}
-	return 0;
+	i += from;
+	if (check) {
+		lua_pushboolean(L,true);
+	} else {
+		pop_lstring(L, sb, i+seplen, seplen);
+	}
+	return 1;
 }
 
 static int
@@ -451,8 +371,14 @@ lconnect(lua_State *L) {
 	if (port == 0) {
 		return luaL_error(L, "Invalid port");
 	}
+	int tls = luaL_optinteger(L, 3, -1);
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
-	int id = skynet_socket_connect(ctx, host, port);
+	int id;
+	if (tls >= 0) {
+		id = skynet_socket_connect_tls(ctx, host, port, tls);
+	} else {
+		id = skynet_socket_connect(ctx, host, port);
+	}
 	lua_pushinteger(L, id);
 
 	return 1;
@@ -479,8 +405,17 @@ llisten(lua_State *L) {
 	const char * host = luaL_checkstring(L,1);
 	int port = luaL_checkinteger(L,2);
 	int backlog = luaL_optinteger(L,3,BACKLOG);
+	int reuseport = lua_toboolean(L,4);
+	int tls = luaL_optinteger(L,5,-1);
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
-	int id = skynet_socket_listen(ctx, host,port,backlog);
+	int id;
+	if (tls >= 0) {
+		id = skynet_socket_listen_tls(ctx, host,port,backlog,reuseport,tls);
+	} else if (reuseport) {
+		id = skynet_socket_listen_reuseport(ctx, host,port,backlog);
+	} else {
+		id = skynet_socket_listen(ctx, host,port,backlog);
+	}
 	if (id < 0) {
 		return luaL_error(L, "Listen error");
 	}
@@ -575,6 +510,55 @@ lsendlow(lua_State *L) {
 	return 1;
 }
 
+/*
+	integer id
+	string filename
+	integer offset (optional, default 0)
+	integer size (optional, default to the end of file)
+
+	return true or false, and the bytes would be sent
+ */
+static int
+lsendfile(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	const char * filename = luaL_checkstring(L, 2);
+	lua_Integer offset = luaL_optinteger(L, 3, 0);
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return luaL_error(L, "Can't open %s", filename);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return luaL_error(L, "Can't stat %s", filename);
+	}
+	lua_Integer size = st.st_size - offset;
+	if (!lua_isnoneornil(L, 4)) {
+		size = luaL_checkinteger(L, 4);
+	}
+	if (offset < 0 || size < 0 || offset + size > st.st_size || size > INT_MAX) {
+		close(fd);
+		// lua_pushfstring 不支持 LUA_INTEGER_FMT ，先用 snprintf 格式化
+		char range[64];
+		snprintf(range, sizeof(range), "[" LUA_INTEGER_FMT ", +" LUA_INTEGER_FMT ")", (LUAI_UACINT)offset, (LUAI_UACINT)size);
+		return luaL_error(L, "Invalid file range %s %s", filename, range);
+	}
+	int err = skynet_socket_sendfile(ctx, id, fd, offset, (int)size);
+	lua_pushboolean(L, !err);
+	lua_pushinteger(L, size);
+	return 2;
+}
+
+static int
+lproxy(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	int peer = luaL_checkinteger(L, 2);
+	skynet_socket_proxy(ctx, id, peer);
+	return 0;
+}
+
 static int
 lbind(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -600,6 +584,34 @@ lnodelay(lua_State *L) {
 	return 0;
 }
 
+// framing(id, header, max) : header is 2 or 4 (0 to cancel), then only whole packages are reported
+static int
+lframing(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	int header = luaL_checkinteger(L, 2);
+	int max = luaL_optinteger(L, 3, 0);
+	if (header != 0 && header != 2 && header != 4) {
+		return luaL_error(L, "Invalid header size %d", header);
+	}
+	skynet_socket_framing(ctx, id, header, max);
+	return 0;
+}
+
+// limit(id, hwm [, policy, rate]) : policy is "drop", "close" or "pause", rate is bytes per second
+static int
+llimit(lua_State *L) {
+	// the index is SOCKET_HWM_* in socket_server.h
+	static const char * policies[] = { "drop", "close", "pause", NULL };
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	lua_Integer hwm = luaL_optinteger(L, 2, 0);
+	int policy = luaL_checkoption(L, 3, "drop", policies);
+	int rate = luaL_optinteger(L, 4, 0);
+	skynet_socket_limit(ctx, id, hwm, policy, rate);
+	return 0;
+}
+
 static int
 ludp(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -654,6 +666,40 @@ ludp_send(lua_State *L) {
 	return 1;
 }
 
+/*
+	lightuserdata msg
+	integer size
+
+	return string package1, string address1, package2, address2 ...
+	The message is SKYNET_SOCKET_TYPE_UDP_BATCH, each package is [2 bytes size][1 byte address size][address][data]
+ */
+static int
+ludp_unpack(lua_State *L) {
+	const uint8_t * ptr = lua_touserdata(L, 1);
+	int size = luaL_checkinteger(L, 2);
+	if (ptr == NULL) {
+		return luaL_error(L, "Need udp message at param 1");
+	}
+	const uint8_t * end = ptr + size;
+	int n = 0;
+	while (ptr + 3 <= end) {
+		uint16_t sz;
+		memcpy(&sz, ptr, sizeof(sz));
+		int addrsz = ptr[2];
+		const uint8_t * addr = ptr + 3;
+		const uint8_t * data = addr + addrsz;
+		if (data + sz > end) {
+			return luaL_error(L, "Invalid udp message");
+		}
+		luaL_checkstack(L, 2, NULL);
+		lua_pushlstring(L, (const char *)data, sz);
+		lua_pushlstring(L, (const char *)addr, addrsz);
+		n += 2;
+		ptr = data + sz;
+	}
+	return n;
+}
+
 static int
 ludp_address(lua_State *L) {
 	size_t sz = 0;
@@ -680,6 +726,22 @@ ludp_address(lua_State *L) {
 	return 2;
 }
 
+// tls_context(server, cert, key, ca) : returns the context id for listen (server) or connect, or nil when failed
+static int
+ltls_context(lua_State *L) {
+	int server = lua_toboolean(L, 1);
+	const char * cert = luaL_optstring(L, 2, NULL);
+	const char * key = luaL_optstring(L, 3, NULL);
+	const char * ca = luaL_optstring(L, 4, NULL);
+	int tls = skynet_socket_tls_context(server, cert, key, ca);
+	if (tls < 0)
+		return 0;
+	lua_pushinteger(L, tls);
+	return 1;
+}
+
+static const char * tls_state[] = { NULL, "handshake", "established", "resumed" };
+
 static void
 getinfo(lua_State *L, struct socket_info *si) {
 	lua_newtable(L);
@@ -729,6 +791,24 @@ getinfo(lua_State *L, struct socket_info *si) {
 		lua_pushstring(L, si->name);
 		lua_setfield(L, -2, "peer");
 	}
+	lua_pushinteger(L, si->rpacket);
+	lua_setfield(L, -2, "rpacket");
+	lua_pushinteger(L, si->wpacket);
+	lua_setfield(L, -2, "wpacket");
+	lua_pushinteger(L, si->rcall);
+	lua_setfield(L, -2, "rcall");
+	lua_pushinteger(L, si->wcall);
+	lua_setfield(L, -2, "wcall");
+	lua_pushinteger(L, si->eagain);
+	lua_setfield(L, -2, "eagain");
+	lua_pushinteger(L, si->wqueue);
+	lua_setfield(L, -2, "wqueue");
+	lua_pushinteger(L, si->wbmax);
+	lua_setfield(L, -2, "wbmax");
+	if (si->tls > 0 && si->tls < (int)(sizeof(tls_state)/sizeof(tls_state[0]))) {
+		lua_pushstring(L, tls_state[si->tls]);
+		lua_setfield(L, -2, "tls");
+	}
 }
 
 static int
@@ -746,6 +826,47 @@ linfo(lua_State *L) {
 	return 1;
 }
 
+// statistics of socket.write : the number of sends which are written by worker directly (direct),
+// partly (partial), queued after the rest of direct writes (queued), or passed to the socket thread (request)
+static int
+lsendstat(lua_State *L) {
+	struct socket_sendstat stat;
+	skynet_socket_sendstat(&stat);
+	lua_createtable(L, 0, 4);
+	lua_pushinteger(L, stat.direct);
+	lua_setfield(L, -2, "direct");
+	lua_pushinteger(L, stat.partial);
+	lua_setfield(L, -2, "partial");
+	lua_pushinteger(L, stat.queued);
+	lua_setfield(L, -2, "queued");
+	lua_pushinteger(L, stat.request);
+	lua_setfield(L, -2, "request");
+	return 1;
+}
+
+static void
+push_histogram(lua_State *L, const uint64_t *hist, const char *name) {
+	lua_createtable(L, SOCKET_HISTOGRAM, 0);
+	int i;
+	for (i=0;i<SOCKET_HISTOGRAM;i++) {
+		lua_pushinteger(L, hist[i]);
+		lua_rawseti(L, -2, i+1);
+	}
+	lua_setfield(L, -2, name);
+}
+
+// histograms of the socket thread : { rsize = {...}, wlatency = {...} }, [i] counts the values in [2^(i-1), 2^i)
+// rsize is the bytes of each read, wlatency is the microseconds from queued to sent
+static int
+lhistogram(lua_State *L) {
+	struct socket_histogram hist;
+	skynet_socket_histogram(&hist);
+	lua_createtable(L, 0, 2);
+	push_histogram(L, hist.rsize, "rsize");
+	push_histogram(L, hist.wlatency, "wlatency");
+	return 1;
+}
+
 LUAMOD_API int
 luaopen_skynet_socketdriver(lua_State *L) {
 	luaL_checkversion(L);
@@ -760,8 +881,12 @@ luaopen_skynet_socketdriver(lua_State *L) {
 		{ "str2p", lstr2p },
 		{ "header", lheader },
 		{ "info", linfo },
+		{ "sendstat", lsendstat },
+		{ "histogram", lhistogram },
+		{ "tls_context", ltls_context },
 
 		{ "unpack", lunpack },
+		{ "udp_unpack", ludp_unpack },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
@@ -772,9 +897,13 @@ luaopen_skynet_socketdriver(lua_State *L) {
 		{ "listen", llisten },
 		{ "send", lsend },
 		{ "lsend", lsendlow },
+		{ "sendfile", lsendfile },
+		{ "proxy", lproxy },
 		{ "bind", lbind },
 		{ "start", lstart },
 		{ "nodelay", lnodelay },
+		{ "framing", lframing },
+		{ "limit", llimit },
 		{ "udp", ludp },
 		{ "udp_connect", ludp_connect },
 		{ "udp_send", ludp_send },
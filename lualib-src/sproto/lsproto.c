@@ -368,7 +368,7 @@ decode(const struct sproto_arg *args) {
 	case SPROTO_TSTRUCT: {
 		struct decode_ud sub;
 		int r;
-		lua_newtable(L);
+		lua_createtable(L, 0, sproto_fieldn(args->subtype));
 		sub.L = L;
 		sub.result_index = lua_gettop(L);
 		sub.deep = self->deep + 1;
@@ -442,13 +442,14 @@ getbuffer(lua_State *L, int index, size_t *sz) {
 
 /*
 	lightuserdata sproto_type
-	string source	/  (lightuserdata , integer)
-	return table
+	string source [, integer offset]	/  (lightuserdata , integer)
+	[table result]
+	return table, integer (the bytes decoded, not including offset)
  */
 static int
 ldecode(lua_State *L) {
 	struct sproto_type * st = lua_touserdata(L, 1);
-	const void * buffer;
+	const char * buffer;
 	struct decode_ud self;
 	size_t sz;
 	int r;
@@ -458,8 +459,15 @@ ldecode(lua_State *L) {
 	}
 	sz = 0;
 	buffer = getbuffer(L, 2, &sz);
+	if (lua_type(L, 2) == LUA_TSTRING && lua_type(L, 3) == LUA_TNUMBER) {
+		// decode the tail of the string without a copy (string.sub)
+		lua_Integer offset = lua_tointeger(L, 3);
+		luaL_argcheck(L, offset >= 0 && offset <= (lua_Integer)sz, 3, "offset out of range");
+		buffer += offset;
+		sz -= offset;
+	}
 	if (!lua_istable(L, -1)) {
-		lua_newtable(L);
+		lua_createtable(L, 0, sproto_fieldn(st));
 	}
 	luaL_checkstack(L, ENCODE_DEEPLEVEL*3 + 8, NULL);
 	self.L = L;
@@ -491,20 +499,47 @@ ldumpproto(lua_State *L) {
 
 
 /*
-	string source	/  (lightuserdata , integer)
+	string source	/  (lightuserdata , integer)	/ string, string, ...
 	return string
  */
 static int
 lpack(lua_State *L) {
 	size_t sz=0;
-	const void * buffer = getbuffer(L, 1, &sz);
-	// the worst-case space overhead of packing is 2 bytes per 2 KiB of input (256 words = 2KiB).
-	size_t maxsz = (sz + 2047) / 2048 * 2 + sz + 2;
+	const void * buffer;
+	size_t maxsz;
 	void * output = lua_touserdata(L, lua_upvalueindex(1));
 	int bytes;
 	int osz = lua_tointeger(L, lua_upvalueindex(2));
-	if (osz < maxsz) {
-		output = expand_buffer(L, osz, maxsz);
+	int n = lua_gettop(L);
+	if (n > 1 && lua_type(L, 1) == LUA_TSTRING) {
+		// pack the concatenation of the strings (header .. content) :
+		// copy them after the output in the buffer instead of creating a temporary lua string
+		int i;
+		char * src;
+		for (i=1;i<=n;i++) {
+			size_t len;
+			luaL_checklstring(L, i, &len);
+			sz += len;
+		}
+		maxsz = (sz + 2047) / 2048 * 2 + sz + 2;
+		if (osz < maxsz + sz) {
+			output = expand_buffer(L, osz, maxsz + sz);
+		}
+		src = (char *)output + maxsz;
+		for (i=1;i<=n;i++) {
+			size_t len;
+			const char * str = lua_tolstring(L, i, &len);
+			memcpy(src, str, len);
+			src += len;
+		}
+		buffer = (char *)output + maxsz;
+	} else {
+		buffer = getbuffer(L, 1, &sz);
+		// the worst-case space overhead of packing is 2 bytes per 2 KiB of input (256 words = 2KiB).
+		maxsz = (sz + 2047) / 2048 * 2 + sz + 2;
+		if (osz < maxsz) {
+			output = expand_buffer(L, osz, maxsz);
+		}
 	}
 	bytes = sproto_pack(buffer, sz, output, maxsz);
 	if (bytes > maxsz) {
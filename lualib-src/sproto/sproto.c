@@ -630,6 +630,11 @@ sproto_name(struct sproto_type * st) {
 	return st->name;
 }
 
+int
+sproto_fieldn(const struct sproto_type * st) {
+	return st->n;
+}
+
 static struct field *
 findtag(const struct sproto_type *st, int tag) {
 	int begin, end;
@@ -1223,6 +1228,20 @@ sproto_decode(const struct sproto_type *st, const void * data, int size, sproto_
 
 // 0 pack
 
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SPROTO_SWAR
+
+// one bit per nonzero byte of the 8 bytes segment, bit i for src[i]
+static inline int
+nonzero_mask(const uint8_t *src) {
+	uint64_t v, t;
+	memcpy(&v, src, sizeof(v));
+	t = (((v & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL) | v) & 0x8080808080808080ULL;
+	return (int)(((t >> 7) * 0x0102040810204080ULL) >> 56);
+}
+
+#endif
+
 static int
 pack_seg(const uint8_t *src, uint8_t * buffer, int sz, int n) {
 	uint8_t header = 0;
@@ -1234,6 +1253,24 @@ pack_seg(const uint8_t *src, uint8_t * buffer, int sz, int n) {
 	if (sz < 0)
 		obuffer = NULL;
 
+#ifdef SPROTO_SWAR
+	if (sz >= 8) {
+		// enough space for the whole segment, test 8 bytes at once
+		int mask = nonzero_mask(src);
+		header = (uint8_t)mask;
+		if (mask == 0xff) {
+			memcpy(buffer, src, 8);
+			notzero = 8;
+		} else {
+			while (mask) {
+				*buffer = src[__builtin_ctz(mask)];
+				++buffer;
+				++notzero;
+				mask &= mask - 1;
+			}
+		}
+	} else
+#endif
 	for (i=0;i<8;i++) {
 		if (src[i] != 0) {
 			notzero++;
@@ -1359,6 +1396,24 @@ sproto_unpack(const void * srcv, int srcsz, void * bufferv, int bufsz) {
 			size += n;
 		} else {
 			int i;
+#ifdef SPROTO_SWAR
+			int notzero = __builtin_popcount(header);
+			if (bufsz >= 8 && srcsz >= notzero) {
+				// the whole segment fits, expand it without the bounds checks per byte
+				if (header == 0) {
+					memset(buffer, 0, 8);
+				} else {
+					for (i=0;i<8;i++) {
+						buffer[i] = ((header >> i) & 1) ? *src++ : 0;
+					}
+				}
+				srcsz -= notzero;
+				bufsz -= 8;
+				buffer += 8;
+				size += 8;
+				continue;
+			}
+#endif
 			for (i=0;i<8;i++) {
 				int nz = (header >> i) & 1;
 				if (nz) {
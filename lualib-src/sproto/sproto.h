@@ -33,6 +33,8 @@ struct sproto_type * sproto_protoquery(const struct sproto *, int proto, int wha
 int sproto_protoresponse(const struct sproto *, int proto);
 
 struct sproto_type * sproto_type(const struct sproto *, const char * type_name);
+// the number of fields, a size hint for the decoded table
+int sproto_fieldn(const struct sproto_type *);
 
 int sproto_pack(const void * src, int srcsz, void * buffer, int bufsz);
 int sproto_unpack(const void * src, int srcsz, void * buffer, int bufsz);
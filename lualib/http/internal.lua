@@ -101,7 +101,8 @@ function M.parseheader(lines, from, header)
 end
 
 function M.recvchunkedbody(readbytes, bodylimit, header, body)
-	local result = ""
+	-- collect the chunks and concat them at last, appending to a string copies the whole body for every chunk
+	local result = {}
 	local size = 0
 
 	while true do
@@ -118,10 +119,11 @@ function M.recvchunkedbody(readbytes, bodylimit, header, body)
 			return
 		end
 		if #body >= sz then
-			result = result .. body:sub(1,sz)
+			table.insert(result, body:sub(1,sz))
 			body = body:sub(sz+1)
 		else
-			result = result .. body .. readbytes(sz - #body)
+			table.insert(result, body)
+			table.insert(result, readbytes(sz - #body))
 			body = ""
 		end
 		body = readcrln(readbytes, body)
@@ -138,7 +140,7 @@ function M.recvchunkedbody(readbytes, bodylimit, header, body)
 
 	header = M.parseheader(tmpline,1,header)
 
-	return result, header
+	return table.concat(result), header
 end
 
 return M
@@ -53,7 +53,7 @@ function skynet.register_protocol(class)
 	proto[id] = class
 end
 
-local session_id_coroutine = {}
+-- the sessions waiting for response (session -> coroutine) are kept in c (lua-skynet.c), see c.waitsession
 local session_coroutine_id = {}
 local session_coroutine_address = {}
 local session_coroutine_tracetag = {}
@@ -75,8 +75,7 @@ local suspend
 local function dispatch_error_queue()
 	local session = table.remove(error_queue,1)
 	if session then
-		local co = session_id_coroutine[session]
-		session_id_coroutine[session] = nil
+		local co = c.popsession(session)
 		return suspend(co, coroutine_resume(co, false))
 	end
 end
@@ -105,12 +104,21 @@ end
 
 -- coroutine reuse
 
-local coroutine_pool = setmetatable({}, { __mode = "kv" })
+-- 协程池的大小 (配置 coroutine_pool，默认 1024，可以用 skynet.coroutine_pool 修改)
+-- 池满的时候结束的协程直接退出；放回池中的协程先收缩曾经增长过的栈
+local coroutine_pool = {}
+local coroutine_pool_size = tonumber((c.command("GETENV", "coroutine_pool"))) or 1024
+-- 计数 : 创建的协程，复用的次数，还没有退出的协程 (包括池中的)，见 skynet.stat
+local coroutine_created = 0
+local coroutine_reused = 0
+local coroutine_live = 0
 
 -- 使用函数f创建一个协程，并返回
 local function co_create(f)
 	local co = table.remove(coroutine_pool)
 	if co == nil then
+		coroutine_created = coroutine_created + 1
+		coroutine_live = coroutine_live + 1
 		co = coroutine_create(function(...)
 			f(...)
 
@@ -137,6 +145,13 @@ local function co_create(f)
 
 				-- recycle co into pool
 				f = nil
+				-- release the stack grown by f at once, even if the coroutine exits (it's garbage until the next gc cycle)
+				c.shrinkstack()
+				if #coroutine_pool >= coroutine_pool_size then
+					-- the pool is full, exit. suspend handles "SUSPEND" as usual (dispatch wakeup)
+					coroutine_live = coroutine_live - 1
+					return "SUSPEND"
+				end
 				coroutine_pool[#coroutine_pool+1] = co
 				-- recv new main function f
 				-- 参数SUSPEND作为coroutine_resume的返回值，然后这个返回值作为参数调用suspend
@@ -146,6 +161,7 @@ local function co_create(f)
 			end
 		end)
 	else
+		coroutine_reused = coroutine_reused + 1
 		-- pass the main function f to coroutine, and restore running thread
 		local running = running_thread
 		-- 唤醒复用的协程
@@ -160,10 +176,9 @@ local function dispatch_wakeup()
 	if token then
 		local session = sleep_session[token]
 		if session then
-			local co = session_id_coroutine[session]
+			local co = c.breaksession(session)
 			local tag = session_coroutine_tracetag[co]
 			if tag then c.trace(tag, "resume") end
-			session_id_coroutine[session] = "BREAK"
 			return suspend(co, coroutine_resume(co, false, "BREAK"))
 		end
 	end
@@ -172,6 +187,7 @@ end
 -- suspend is local function
 function suspend(co, result, command)
 	if not result then
+		coroutine_live = coroutine_live - 1	-- the coroutine is dead
 		local session = session_coroutine_id[co]
 		if session then -- coroutine may fork by others (session is nil)
 			local addr = session_coroutine_address[co]
@@ -210,15 +226,14 @@ function skynet.timeout(ti, func)
 	local session = c.intcommand("TIMEOUT",ti)
 	assert(session)
 	local co = co_create(func)
-	assert(session_id_coroutine[session] == nil)
-	session_id_coroutine[session] = co
+	c.waitsession(session, co)
 	return co	-- for debug
 end
 
 local function suspend_sleep(session, token)
 	local tag = session_coroutine_tracetag[running_thread]
 	if tag then c.trace(tag, "sleep", 2) end
-	session_id_coroutine[session] = running_thread
+	c.waitsession(session, running_thread)
 	assert(sleep_session[token] == nil, "token duplicative")
 	sleep_session[token] = session
 
@@ -250,7 +265,7 @@ function skynet.wait(token)
 	token = token or coroutine.running()
 	local ret, msg = suspend_sleep(session, token)
 	sleep_session[token] = nil
-	session_id_coroutine[session] = nil
+	c.popsession(session)
 end
 
 function skynet.self()
@@ -353,13 +368,15 @@ end
 
 skynet.pack = assert(c.pack)
 skynet.packstring = assert(c.packstring)
+skynet.packdict = assert(c.packdict)	-- the compact mode for repeated keys, unpack by skynet.unpack too
 skynet.unpack = assert(c.unpack)
+skynet.unpacklazy = assert(c.unpacklazy)	-- the tables are decoded on access, and forwarded without decoding
 skynet.tostring = assert(c.tostring)
 skynet.trash = assert(c.trash)
 
 local function yield_call(service, session)
 	watching_session[session] = service
-	session_id_coroutine[session] = running_thread
+	c.waitsession(session, running_thread)
 	-- 协程在这个地方等待，等待其他消息回复的时候，将其resume
 	-- 其中SUSPEND作为cresume时候的返回值，即函数suspend的参数
 	local succ, msg, sz = coroutine_yield "SUSPEND"
@@ -512,6 +529,15 @@ function skynet.dispatch(typename, func)
 	end
 end
 
+-- The requests of typename are unpacked by skynet.unpacklazy for func, the tables in them are decoded on access.
+-- It's for the services which route the requests by a few fields and forward the rest (skynet.send/call them as they are).
+-- The responses of skynet.call are still unpacked by the unpack of the protocol.
+function skynet.lazydispatch(typename, func)
+	local p = proto[typename]
+	p.dispatch_unpack = c.unpacklazy
+	return skynet.dispatch(typename, func)
+end
+
 local function unknown_request(session, address, msg, sz, prototype)
 	skynet.error(string.format("Unknown request (%s): %s", prototype, c.tostring(msg,sz)))
 	error(string.format("Unknown session : %d from %x", session, address))
@@ -552,20 +578,17 @@ local trace_source = {}
 
 -- snlua服务处理消息，最后真正调用到的脚本函数
 -- 根据不同的类型进行分发
-local function raw_dispatch_message(prototype, msg, sz, session, source)
+-- co : for the response, the coroutine waiting for the session (or "BREAK"), found and removed by the callback in c
+local function raw_dispatch_message(prototype, msg, sz, session, source, co)
 	-- skynet.PTYPE_RESPONSE = 1, read skynet.h
 	-- call其他服务的接口，其他服务回的消息类型就是PTYPE_RESPONSE，走的就是这个分支
 	if prototype == 1 then
 		-- 脚本层注册的timeout也是走这个分支
-		local co = session_id_coroutine[session]
-		if co == "BREAK" then
-			session_id_coroutine[session] = nil
-		elseif co == nil then
+		if co == nil then
 			unknown_response(session, source, msg, sz)
-		else
+		elseif co ~= "BREAK" then
 			local tag = session_coroutine_tracetag[co]
 			if tag then c.trace(tag, "resume") end
-			session_id_coroutine[session] = nil
 			-- 这里的true,msg和sz就是coroutine_yield返回的值
 			suspend(co, coroutine_resume(co, true, msg, sz))
 		end
@@ -607,7 +630,7 @@ local function raw_dispatch_message(prototype, msg, sz, session, source)
 				end
 			end
 			-- coroutine_resume 即执行处理消息对应的协程
-			suspend(co, coroutine_resume(co, session,source, p.unpack(msg,sz)))
+			suspend(co, coroutine_resume(co, session,source, (p.dispatch_unpack or p.unpack)(msg,sz)))
 		else
 			trace_source[source] = nil
 			if session ~= 0 then
@@ -645,6 +668,12 @@ function skynet.newservice(name, ...)
 	return skynet.call(".launcher", "lua" , "LAUNCH", "snlua", name, ...)
 end
 
+-- launch n services of the same name at once, they are initialized in parallel.
+-- return the list of the addresses (false for the failed ones)
+function skynet.newservices(n, name, ...)
+	return skynet.call(".launcher", "lua" , "LAUNCHN", n, "snlua", name, ...)
+end
+
 function skynet.uniqueservice(global, ...)
 	if global == true then
 		return assert(skynet.call(".service", "lua", "GLAUNCH", ...))
@@ -784,17 +813,33 @@ function skynet.mqlen()
 	return c.intcommand("STAT", "mqlen")
 end
 
+-- what : mqlen, cpu, message, gc ... (see cmd_stat in skynet_server.c)
+--	or coroutine_created, coroutine_reused, coroutine_live, coroutine_pool (the coroutines of this service)
 function skynet.stat(what)
+	if what == "coroutine_created" then
+		return coroutine_created
+	elseif what == "coroutine_reused" then
+		return coroutine_reused
+	elseif what == "coroutine_live" then
+		return coroutine_live
+	elseif what == "coroutine_pool" then
+		return #coroutine_pool
+	end
 	return c.intcommand("STAT", what)
 end
 
+-- set the size of the coroutine pool, the coroutines beyond the size are released
+function skynet.coroutine_pool(size)
+	coroutine_pool_size = size
+	for i = #coroutine_pool, size + 1, -1 do
+		coroutine_pool[i] = nil
+		coroutine_live = coroutine_live - 1
+	end
+end
+
 function skynet.task(ret)
 	if ret == nil then
-		local t = 0
-		for session,co in pairs(session_id_coroutine) do
-			t = t + 1
-		end
-		return t
+		return c.sessions()
 	end
 	if ret == "init" then
 		if init_thread then
@@ -805,18 +850,22 @@ function skynet.task(ret)
 	end
 	local tt = type(ret)
 	if tt == "table" then
+		local session_id_coroutine = {}
+		c.sessions(session_id_coroutine)
 		for session,co in pairs(session_id_coroutine) do
 			ret[session] = debug.traceback(co)
 		end
 		return
 	elseif tt == "number" then
-		local co = session_id_coroutine[ret]
+		local co = c.getsession(ret)
 		if co then
 			return debug.traceback(co)
 		else
 			return "No session"
 		end
 	elseif tt == "thread" then
+		local session_id_coroutine = {}
+		c.sessions(session_id_coroutine)
 		for session, co in pairs(session_id_coroutine) do
 			if co == ret then
 				return session
@@ -835,6 +884,15 @@ function skynet.memlimit(bytes)
 	skynet.memlimit = nil	-- set only once
 end
 
+-- policy : { pause = 200, stepmul = 200, idle = true, budget = 1 }
+-- pause/stepmul : see collectgarbage "setpause"/"setstepmul"
+-- idle : the collector never runs in the middle of a message. It steps after the messages when the memory reaches
+--	the threshold (memory after the last cycle * pause), and runs up to budget ms when the queue is empty.
+-- The time spent in the collector is skynet.stat "gc" (in seconds).
+function skynet.gcpolicy(policy)
+	c.gcpolicy(policy.pause, policy.stepmul, policy.idle, policy.budget)
+end
+
 -- Inject internal debug framework
 local debug = require "skynet.debug"
 debug.init(skynet, {
@@ -28,6 +28,7 @@ local function init(skynet, export)
 			stat.task = skynet.task()
 			stat.mqlen = skynet.stat "mqlen"
 			stat.cpu = skynet.stat "cpu"
+			stat.gc = skynet.stat "gc"
 			stat.message = skynet.stat "message"
 			skynet.ret(skynet.pack(stat))
 		end
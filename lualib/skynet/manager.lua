@@ -75,8 +75,17 @@ function skynet.forward_type(map, start_func)
 end
 
 function skynet.filter(f ,start_func)
-	c.callback(function(...)
-		dispatch_message(f(...))
+	c.callback(function(ptype, msg, sz, session, source, co)
+		-- co is the coroutine waiting for the response (see raw_dispatch_message), find it again if f changes the response
+		local ptype_f, msg_f, sz_f, session_f, source_f = f(ptype, msg, sz, session, source)
+		if ptype_f ~= ptype or session_f ~= session then
+			if co ~= nil then
+				-- put it back (a thread or "BREAK"), the original session is still waiting
+				c.waitsession(session, co)
+			end
+			co = ptype_f == skynet.PTYPE_RESPONSE and c.popsession(session_f) or nil
+		end
+		dispatch_message(ptype_f, msg_f, sz_f, session_f, source_f, co)
 	end)
 	skynet.timeout(0, function()
 		skynet.init_service(start_func)
@@ -0,0 +1,31 @@
+local skynet = require "skynet"
+local core = require "skynet.sharetable.core"
+
+-- The read-only tables shared by all the services : the table is frozen in service sharetabled,
+-- and each service reads it directly, without a copy in its own lua vm.
+-- It can't be modified or deleted, use sharedata if the data need update.
+
+local service
+
+skynet.init(function()
+	service = skynet.uniqueservice "sharetabled"
+end)
+
+local sharetable = {}
+local cache = {}
+
+-- v : a table, a lua source string, or "@filename" (the source/file returns the table or sets the globals)
+function sharetable.new(name, v, ...)
+	skynet.call(service, "lua", "new", name, v, ...)
+end
+
+function sharetable.query(name)
+	local t = cache[name]
+	if t == nil then
+		t = core.clone(skynet.call(service, "lua", "query", name))
+		cache[name] = t
+	end
+	return t
+end
+
+return sharetable
@@ -4,13 +4,12 @@ local skynet_core = require "skynet.core"
 local assert = assert
 
 local socket = {}	-- api
-local buffer_pool = {}	-- store all message buffer object
 local socket_pool = setmetatable( -- store all socket object
 	{},
 	{ __gc = function(p)
 		for id,v in pairs(p) do
 			driver.close(id)
-			-- don't need clear v.buffer, because buffer pool will be free at the end
+			-- don't need clear v.buffer, it's freed by its __gc
 			p[id] = nil
 		end
 	end
@@ -47,8 +46,13 @@ socket_message[1] = function(id, size, data)
 		driver.drop(data, size)
 		return
 	end
+	if s.proxy then
+		-- the package received before socket.proxy
+		driver.send(s.proxy, data, size)
+		return
+	end
 
-	local sz = driver.push(s.buffer, buffer_pool, data, size)
+	local sz = driver.push(s.buffer, data, size)
 	local rr = s.read_required
 	local rrt = type(rr)
 	if rrt == "number" then
@@ -60,13 +64,13 @@ socket_message[1] = function(id, size, data)
 	else
 		if s.buffer_limit and sz > s.buffer_limit then
 			skynet.error(string.format("socket buffer overflow: fd=%d size=%d", id , sz))
-			driver.clear(s.buffer,buffer_pool)
+			driver.clear(s.buffer)
 			driver.close(id)
 			return
 		end
 		if rrt == "string" then
 			-- read line
-			if driver.readline(s.buffer,nil,rr) then
+			if driver.readline(s.buffer, rr, true) then
 				s.read_required = nil
 				wakeup(s)
 			end
@@ -85,12 +89,21 @@ socket_message[2] = function(id, _ , addr)
 	wakeup(s)
 end
 
+-- the peer is closed by the socket thread too, and its own close message will come later
+local function close_proxy(s)
+	socket_pool[s.id] = nil
+end
+
 -- SKYNET_SOCKET_TYPE_CLOSE = 3
 socket_message[3] = function(id)
 	local s = socket_pool[id]
 	if s == nil then
 		return
 	end
+	if s.proxy then
+		close_proxy(s)
+		return
+	end
 	s.connected = false
 	wakeup(s)
 end
@@ -112,6 +125,11 @@ socket_message[5] = function(id, _, err)
 		skynet.error("socket: error on unknown", id, err)
 		return
 	end
+	if s.proxy then
+		skynet.error("socket: error on proxy", id, err)
+		close_proxy(s)
+		return
+	end
 	if s.connected then
 		skynet.error("socket: error on", id, err)
 	elseif s.connecting then
@@ -136,6 +154,25 @@ socket_message[6] = function(id, size, data, address)
 	s.callback(str, address)
 end
 
+-- SKYNET_SOCKET_TYPE_UDP_BATCH = 8
+local function dispatch_udp_batch(callback, data, size, ...)
+	driver.drop(data, size)
+	for i = 1, select("#", ...), 2 do
+		local str, address = select(i, ...)
+		callback(str, address)
+	end
+end
+
+socket_message[8] = function(id, size, data)
+	local s = socket_pool[id]
+	if s == nil or s.callback == nil then
+		skynet.error("socket: drop udp package from " .. id)
+		driver.drop(data, size)
+		return
+	end
+	dispatch_udp_batch(s.callback, data, size, driver.udp_unpack(data, size))
+end
+
 local function default_warning(id, size)
 	local s = socket_pool[id]
 	if not s then
@@ -163,6 +200,10 @@ skynet.register_protocol {
 }
 
 local function connect(id, func)
+	if id < 0 then
+		-- reserve id failed in C, see socket_server.c reserve_id
+		return nil, "reach skynet socket number limit"
+	end
 	local newbuffer
 	if func == nil then
 		newbuffer = driver.buffer()
@@ -190,8 +231,29 @@ local function connect(id, func)
 	end
 end
 
-function socket.open(addr, port)
-	local id = driver.connect(addr,port)
+-- tls : true, or { ca = "ca.pem" } to verify the certificate of the server, { cert = , key = } for client certificate
+local function tls_context(server, tls)
+	if type(tls) ~= "table" then
+		tls = {}
+	end
+	local ctx = driver.tls_context(server, tls.cert, tls.key, tls.ca)
+	if not ctx then
+		error "Create tls context failed"
+	end
+	return ctx
+end
+
+-- socket.open(addr, port, opts) , opts is { tls = ... } , port can be omitted when addr is "host:port"
+function socket.open(addr, port, opts)
+	if type(port) == "table" then
+		port, opts = nil, port
+	end
+	local id
+	if opts and opts.tls then
+		id = driver.connect(addr, port, tls_context(false, opts.tls))
+	else
+		id = driver.connect(addr,port)
+	end
 	return connect(id)
 end
 
@@ -213,7 +275,7 @@ end
 function socket.shutdown(id)
 	local s = socket_pool[id]
 	if s then
-		driver.clear(s.buffer,buffer_pool)
+		driver.clear(s.buffer)
 		-- the framework would send SKYNET_SOCKET_TYPE_CLOSE , need close(id) later
 		driver.shutdown(id)
 	end
@@ -244,7 +306,7 @@ function socket.close(id)
 		end
 		s.connected = false
 	end
-	driver.clear(s.buffer,buffer_pool)
+	driver.clear(s.buffer)
 	assert(s.lock == nil or next(s.lock) == nil)
 	socket_pool[id] = nil
 end
@@ -254,7 +316,7 @@ function socket.read(id, sz)
 	assert(s)
 	if sz == nil then
 		-- read some bytes
-		local ret = driver.readall(s.buffer, buffer_pool)
+		local ret = driver.readall(s.buffer)
 		if ret ~= "" then
 			return ret
 		end
@@ -265,7 +327,7 @@ function socket.read(id, sz)
 		assert(not s.read_required)
 		s.read_required = 0
 		suspend(s)
-		ret = driver.readall(s.buffer, buffer_pool)
+		ret = driver.readall(s.buffer)
 		if ret ~= "" then
 			return ret
 		else
@@ -273,23 +335,23 @@ function socket.read(id, sz)
 		end
 	end
 
-	local ret = driver.pop(s.buffer, buffer_pool, sz)
+	local ret = driver.pop(s.buffer, sz)
 	if ret then
 		return ret
 	end
 	if not s.connected then
-		return false, driver.readall(s.buffer, buffer_pool)
+		return false, driver.readall(s.buffer)
 	end
 
 	assert(not s.read_required)
 	s.read_required = sz
 	suspend(s) -- 等待数据
 	-- 下面表示有数据，则直接读取
-	ret = driver.pop(s.buffer, buffer_pool, sz)
+	ret = driver.pop(s.buffer, sz)
 	if ret then
 		return ret
 	else
-		return false, driver.readall(s.buffer, buffer_pool)
+		return false, driver.readall(s.buffer)
 	end
 end
 
@@ -297,34 +359,34 @@ function socket.readall(id)
 	local s = socket_pool[id]
 	assert(s)
 	if not s.connected then
-		local r = driver.readall(s.buffer, buffer_pool)
+		local r = driver.readall(s.buffer)
 		return r ~= "" and r
 	end
 	assert(not s.read_required)
 	s.read_required = true
 	suspend(s)
 	assert(s.connected == false)
-	return driver.readall(s.buffer, buffer_pool)
+	return driver.readall(s.buffer)
 end
 
 function socket.readline(id, sep)
 	sep = sep or "\n"
 	local s = socket_pool[id]
 	assert(s)
-	local ret = driver.readline(s.buffer, buffer_pool, sep)
+	local ret = driver.readline(s.buffer, sep)
 	if ret then
 		return ret
 	end
 	if not s.connected then
-		return false, driver.readall(s.buffer, buffer_pool)
+		return false, driver.readall(s.buffer)
 	end
 	assert(not s.read_required)
 	s.read_required = sep
 	suspend(s)
 	if s.connected then
-		return driver.readline(s.buffer, buffer_pool, sep)
+		return driver.readline(s.buffer, sep)
 	else
-		return false, driver.readall(s.buffer, buffer_pool)
+		return false, driver.readall(s.buffer)
 	end
 end
 
@@ -341,6 +403,8 @@ end
 
 socket.write = assert(driver.send)
 socket.lwrite = assert(driver.lsend)
+-- socket.sendfile(id, filename [, offset, size]) send a file without reading it into lua
+socket.sendfile = assert(driver.sendfile)
 socket.header = assert(driver.header)
 
 function socket.invalid(id)
@@ -354,12 +418,22 @@ function socket.disconnected(id)
 	end
 end
 
-function socket.listen(host, port, backlog)
+-- If reuseport is true, listen with SO_REUSEPORT, so several services can listen the same port,
+-- and the kernel spreads the new connections among them.
+-- backlog can be a table { backlog = , reuseport = , tls = { cert = "cert.pem", key = "key.pem", ca = } }
+function socket.listen(host, port, backlog, reuseport)
 	if port == nil then
 		host, port = string.match(host, "([^:]+):(.+)$")
 		port = tonumber(port)
 	end
-	return driver.listen(host, port, backlog)
+	if type(backlog) == "table" then
+		local opts = backlog
+		backlog, reuseport = opts.backlog, opts.reuseport
+		if opts.tls then
+			return driver.listen(host, port, backlog, reuseport, tls_context(true, opts.tls))
+		end
+	end
+	return driver.listen(host, port, backlog, reuseport)
 end
 
 function socket.lock(id)
@@ -395,13 +469,44 @@ end
 function socket.abandon(id)
 	local s = socket_pool[id]
 	if s then
-		driver.clear(s.buffer,buffer_pool)
+		driver.clear(s.buffer)
 		s.connected = false
 		wakeup(s)
 		socket_pool[id] = nil
 	end
 end
 
+-- forward the data between two sockets in socket thread, the service will not receive the data of them any more.
+-- id should be a new accepted socket (don't call socket.start), peer should be a connected socket.
+-- When one of them is closed, the other will be closed too.
+function socket.proxy(id, peer)
+	local p = assert(socket_pool[peer])
+	assert(p.connected and not p.proxy)
+	local s = socket_pool[id]
+	if s then
+		assert(s.connected and not s.proxy)
+	else
+		s = {
+			id = id,
+			connected = true,
+			protocol = "TCP",
+		}
+		socket_pool[id] = s
+	end
+	s.proxy = peer
+	p.proxy = id
+	driver.proxy(id, peer)
+	-- flush the data already received
+	for _, v in ipairs { s, p } do
+		if v.buffer then
+			local data = driver.readall(v.buffer)
+			if data ~= "" then
+				driver.send(v.proxy, data)
+			end
+		end
+	end
+end
+
 function socket.limit(id, limit)
 	local s = assert(socket_pool[id])
 	s.buffer_limit = limit
@@ -441,6 +546,8 @@ end
 socket.sendto = assert(driver.udp_send)
 socket.udp_address = assert(driver.udp_address)
 socket.netstat = assert(driver.info)
+socket.sendstat = assert(driver.sendstat)
+socket.histogram = assert(driver.histogram)
 
 function socket.warning(id, callback)
 	local obj = socket_pool[id]
@@ -448,4 +555,12 @@ function socket.warning(id, callback)
 	obj.on_warning = callback
 end
 
+-- socket.limit(id, hwm, policy, rate)
+-- hwm : high-water mark of the send buffer (bytes), policy when the buffer is over it :
+--	"drop" (default) : drop the low priority data (socket.lwrite)
+--	"close" : close the socket
+--	"pause" : callback of socket.warning gets the size, and gets 0 when the buffer is empty
+-- rate : max bytes per second, nil or 0 means no limit
+socket.limit = assert(driver.limit)
+
 return socket
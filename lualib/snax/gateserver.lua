@@ -8,7 +8,17 @@ local socket	-- listen socket
 local queue		-- message queue
 local maxclient	-- max client
 local client_number = 0
-local CMD = setmetatable({}, { __gc = function() netpack.clear(queue) end })
+-- the packages popped from queue by netpack.popn : fd, msg, sz, fd, msg, sz ...
+-- It's shared by all the dispatch coroutines, so the packages are dispatched in order even if handler.message blocks.
+local batch = {}
+local batch_n = 0	-- the number of values in batch
+local batch_i = 1	-- the index of the next fd in batch
+local CMD = setmetatable({}, { __gc = function()
+	netpack.clear(queue)
+	for i = batch_i, batch_n, 3 do
+		skynet.trash(batch[i+1], batch[i+2])
+	end
+end })
 local nodelay = false
 
 local connection = {}
@@ -38,7 +48,13 @@ function gateserver.start(handler)
 		maxclient = conf.maxclient or 1024
 		nodelay = conf.nodelay
 		skynet.error(string.format("Listen on %s:%d", address, port))
-		socket = socketdriver.listen(address, port)
+		-- conf.reuseport : launch several gates with the same address/port to share the incoming connections
+		-- conf.tls : { cert = "cert.pem", key = "key.pem" }, the connections are encrypted by the socket thread
+		local tls
+		if conf.tls then
+			tls = assert(socketdriver.tls_context(true, conf.tls.cert, conf.tls.key, conf.tls.ca), "Create tls context failed")
+		end
+		socket = socketdriver.listen(address, port, conf.backlog, conf.reuseport, tls)
 		socketdriver.start(socket)
 		if handler.open then
 			return handler.open(source, conf)
@@ -62,15 +78,29 @@ function gateserver.start(handler)
 
 	MSG.data = dispatch_msg
 
+	local function pop()
+		if batch_i > batch_n then
+			-- pop a batch of packages in one call
+			batch_n = netpack.popn(queue, batch) * 3
+			batch_i = 1
+			if batch_n == 0 then
+				return
+			end
+		end
+		local i = batch_i
+		batch_i = i + 3
+		return batch[i], batch[i+1], batch[i+2]
+	end
+
 	local function dispatch_queue()
-		local fd, msg, sz = netpack.pop(queue)
+		local fd, msg, sz = pop()
 		if fd then
 			-- may dispatch even the handler.message blocked
 			-- If the handler.message never block, the queue should be empty, so only fork once and then exit.
 			skynet.fork(dispatch_queue)
 			dispatch_msg(fd, msg, sz)
 
-			for fd, msg, sz in netpack.pop, queue do
+			for fd, msg, sz in pop do
 				dispatch_msg(fd, msg, sz)
 			end
 		end
@@ -86,6 +116,8 @@ function gateserver.start(handler)
 		if nodelay then
 			socketdriver.nodelay(fd)
 		end
+		-- split packages in socket thread, so netpack always gets whole packages
+		socketdriver.framing(fd, 2)
 		connection[fd] = true
 		client_number = client_number + 1
 		-- 调用的是service/gate.lua中的connect接口
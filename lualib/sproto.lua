@@ -187,7 +187,7 @@ local function gen_response(self, response, session)
 		local header = core.encode(self.__package, header_tmp)
 		if response then
 			local content = core.encode(response, args)
-			return core.pack(header .. content)
+			return core.pack(header, content)
 		else
 			return core.pack(header)
 		end
@@ -200,13 +200,13 @@ function host:dispatch(...)
 	header_tmp.session = nil
 	header_tmp.ud = nil
 	local header, size = core.decode(self.__package, bin, header_tmp)
-	local content = bin:sub(size + 1)
+	-- the content is decoded from offset size of bin, without a copy
 	if header.type then
 		-- request
 		local proto = queryproto(self.__proto, header.type)
 		local result
 		if proto.request then
-			result = core.decode(proto.request, content)
+			result = core.decode(proto.request, bin, size)
 		end
 		if header_tmp.session then
 			return "REQUEST", proto.name, result, gen_response(self, proto.response, header_tmp.session), header.ud
@@ -221,7 +221,7 @@ function host:dispatch(...)
 		if response == true then
 			return "RESPONSE", session, nil, header.ud
 		else
-			local result = core.decode(response, content)
+			local result = core.decode(response, bin, size)
 			return "RESPONSE", session, result, header.ud
 		end
 	end
@@ -241,7 +241,7 @@ function host:attach(sp)
 
 		if proto.request then
 			local content = core.encode(proto.request, args)
-			return core.pack(header ..  content)
+			return core.pack(header, content)
 		else
 			return core.pack(header)
 		end
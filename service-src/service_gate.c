@@ -11,12 +11,15 @@
 #include <stdarg.h>
 
 #define BACKLOG 128
+#define MAX_SHARD 64
 
 struct connection {
 	int id;	// skynet_socket id
 	uint32_t agent;
 	uint32_t client;
 	char remote_name[32];
+	int framing;	// the socket thread splits the packages
+	int vector;	// forward the socket buffer (whole packages with headers) to the agent as is
 	struct databuffer buffer;
 };
 
@@ -32,6 +35,10 @@ struct gate {
 	struct connection *conn;
 	// todo: save message pool ptr for release
 	struct messagepool mp;
+	// The listening gate launches shard_n-1 shard gates. A connection is owned by shard[hash(id) % shard_n],
+	// shard 0 is the listening gate itself. Each shard has its own connection table, so they never share state.
+	int shard_n;
+	uint32_t shard[MAX_SHARD];
 };
 
 struct gate *
@@ -55,6 +62,11 @@ gate_release(struct gate *g) {
 	if (g->listen_id >= 0) {
 		skynet_socket_close(ctx, g->listen_id);
 	}
+	for (i=1;i<g->shard_n;i++) {
+		char addr[16];
+		snprintf(addr, sizeof(addr), ":%x", g->shard[i]);
+		skynet_command(ctx, "KILL", addr);
+	}
 	messagepool_free(&g->mp);
 	hashid_clear(&g->hash);
 	skynet_free(g->conn);
@@ -75,6 +87,47 @@ _parm(char *msg, int sz, int command_sz) {
 	msg[i-command_sz] = '\0';
 }
 
+// returns the shard gate which owns the socket id, or 0 when it's owned by this gate
+static inline uint32_t
+_shard(struct gate *g, int id) {
+	if (g->shard_n <= 1)
+		return 0;
+	// socket ids are allocated in slot order, mix the bits to spread them evenly
+	uint32_t h = (uint32_t)id * 2654435761u;
+	return g->shard[(h >> 16) % g->shard_n];
+}
+
+// forward the command about socket id to the shard gate which owns it
+static int
+_shard_command(struct gate *g, int id, const void * msg, int sz) {
+	uint32_t shard = _shard(g, id);
+	if (shard == 0)
+		return 0;
+	skynet_send(g->ctx, 0, shard, PTYPE_TEXT, 0, (void *)msg, sz);
+	return 1;
+}
+
+static void
+_report(struct gate * g, const char * data, ...);
+
+static void
+_accept(struct gate *g, int id, const char * name, int sz) {
+	struct skynet_context * ctx = g->ctx;
+	if (hashid_full(&g->hash)) {
+		skynet_socket_close(ctx, id);
+		return;
+	}
+	struct connection *c = &g->conn[hashid_insert(&g->hash, id)];
+	if (sz >= sizeof(c->remote_name)) {
+		sz = sizeof(c->remote_name) - 1;
+	}
+	c->id = id;
+	memcpy(c->remote_name, name, sz);
+	c->remote_name[sz] = '\0';
+	_report(g, "%d open %d %s:0",c->id, c->id, c->remote_name);
+	skynet_error(ctx, "socket open: %x", c->id);
+}
+
 static void
 _forward_agent(struct gate * g, int fd, uint32_t agentaddr, uint32_t clientaddr) {
 	int id = hashid_lookup(&g->hash, fd);
@@ -103,6 +156,8 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 	if (memcmp(command,"kick",i)==0) {
 		_parm(tmp, sz, i);
 		int uid = strtol(command , NULL, 10);
+		if (_shard_command(g, uid, msg, sz))
+			return;
 		int id = hashid_lookup(&g->hash, uid);
 		if (id>=0) {
 			skynet_socket_close(ctx, uid);
@@ -117,6 +172,8 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 			return;
 		}
 		int id = strtol(idstr , NULL, 10);
+		if (_shard_command(g, id, msg, sz))
+			return;
 		char * agent = strsep(&client, " ");
 		if (client == NULL) {
 			return;
@@ -127,6 +184,10 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 		return;
 	}
 	if (memcmp(command,"broker",i)==0) {
+		int j;
+		for (j=1;j<g->shard_n;j++) {
+			skynet_send(ctx, 0, g->shard[j], PTYPE_TEXT, 0, (void *)msg, sz);
+		}
 		_parm(tmp, sz, i);
 		g->broker = skynet_queryname(ctx, command);
 		return;
@@ -134,12 +195,63 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 	if (memcmp(command,"start",i) == 0) {
 		_parm(tmp, sz, i);
 		int uid = strtol(command , NULL, 10);
+		if (_shard_command(g, uid, msg, sz))
+			return;
 		int id = hashid_lookup(&g->hash, uid);
 		if (id>=0) {
+			// the socket thread splits the packages, so the gate needn't reassemble them
+			g->conn[id].framing = 1;
+			skynet_socket_framing(ctx, uid, g->header_size, 0x1000000 - 1);
 			skynet_socket_start(ctx, uid);
 		}
 		return;
 	}
+	if (memcmp(command,"vector",i) == 0) {
+		// the agent (or the broker) of the connection accepts the vector message : several whole packages with headers
+		_parm(tmp, sz, i);
+		int uid = strtol(command , NULL, 10);
+		if (_shard_command(g, uid, msg, sz))
+			return;
+		int id = hashid_lookup(&g->hash, uid);
+		if (id>=0) {
+			g->conn[id].vector = 1;
+		}
+		return;
+	}
+	if (memcmp(command,"direct",i) == 0) {
+		// Hand over a connection (not started yet) to the agent bound to it. The gate forgets it and reports "id direct",
+		// then the agent calls socket start itself, and the socket thread sends the whole packages (with headers) to it directly.
+		_parm(tmp, sz, i);
+		int uid = strtol(command , NULL, 10);
+		if (_shard_command(g, uid, msg, sz))
+			return;
+		int id = hashid_lookup(&g->hash, uid);
+		if (id>=0) {
+			struct connection *c = &g->conn[id];
+			if (c->framing) {
+				skynet_error(ctx, "[gate] Can't hand over the started connection %d", uid);
+				return;
+			}
+			hashid_remove(&g->hash, uid);
+			memset(c, 0, sizeof(*c));
+			c->id = -1;
+			skynet_socket_framing(ctx, uid, g->header_size, 0x1000000 - 1);
+			// the framing request is sent before the report, so it's handled before the agent starts the socket
+			_report(g, "%d direct", uid);
+		}
+		return;
+	}
+	if (memcmp(command,"accept",i) == 0) {
+		// the listening gate assigns a new connection to this shard : accept id addr
+		_parm(tmp, sz, i);
+		char * name = tmp;
+		char * idstr = strsep(&name, " ");
+		int uid = strtol(idstr, NULL, 10);
+		if (name == NULL)
+			name = "";
+		_accept(g, uid, name, strlen(name));
+		return;
+	}
 	if (memcmp(command, "close", i) == 0) {
 		if (g->listen_id >= 0) {
 			skynet_socket_close(ctx, g->listen_id);
@@ -165,8 +277,18 @@ _report(struct gate * g, const char * data, ...) {
 	skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT,  0, tmp, n);
 }
 
+// read the package from c->buffer, or from data when it's not NULL
+static inline void
+_read_package(struct gate *g, struct connection * c, const uint8_t * data, void * buffer, int size) {
+	if (data) {
+		memcpy(buffer, data, size);
+	} else {
+		databuffer_read(&c->buffer,&g->mp,buffer, size);
+	}
+}
+
 static void
-_forward(struct gate *g, struct connection * c, int size) {
+_forward(struct gate *g, struct connection * c, const uint8_t * data, int size) {
 	struct skynet_context * ctx = g->ctx;
 	int fd = c->id;
 	if (fd <= 0) {
@@ -175,22 +297,56 @@ _forward(struct gate *g, struct connection * c, int size) {
 	}
 	if (g->broker) {
 		void * temp = skynet_malloc(size);
-		databuffer_read(&c->buffer,&g->mp,temp, size);
+		_read_package(g, c, data, temp, size);
 		skynet_send(ctx, 0, g->broker, g->client_tag | PTYPE_TAG_DONTCOPY, fd, temp, size);
 		return;
 	}
 	if (c->agent) {
 		void * temp = skynet_malloc(size);
-		databuffer_read(&c->buffer,&g->mp,temp, size);
+		_read_package(g, c, data, temp, size);
 		skynet_send(ctx, c->client, c->agent, g->client_tag | PTYPE_TAG_DONTCOPY, fd , temp, size);
 	} else if (g->watchdog) {
 		char * tmp = skynet_malloc(size + 32);
 		int n = snprintf(tmp,32,"%d data ",c->id);
-		databuffer_read(&c->buffer,&g->mp,tmp+n,size);
+		_read_package(g, c, data, tmp+n, size);
 		skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT | PTYPE_TAG_DONTCOPY, fd, tmp, size + n);
 	}
 }
 
+// The socket is in framing mode (see skynet_socket_framing), so data is always whole packages.
+// The buffer is owned by the gate, it's handed over to the agent when possible instead of copying the packages.
+static void
+dispatch_packages(struct gate *g, struct connection *c, uint8_t * data, int sz) {
+	int hs = g->header_size;
+	uint32_t dest = g->broker ? g->broker : c->agent;
+	if (dest && c->id > 0) {
+		uint32_t source = g->broker ? 0 : c->client;
+		if (c->vector) {
+			// all the packages of one read in one message, unpack them by netpack.unpackv
+			skynet_send(g->ctx, source, dest, g->client_tag | PTYPE_TAG_DONTCOPY, c->id, data, sz);
+			return;
+		}
+		int size = hs == 2 ? (data[0] << 8 | data[1]) : (data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3]);
+		if (hs + size == sz) {
+			// only one package, drop the header in place rather than allocating a new buffer
+			memmove(data, data + hs, size);
+			skynet_send(g->ctx, source, dest, g->client_tag | PTYPE_TAG_DONTCOPY, c->id, data, size);
+			return;
+		}
+	}
+	uint8_t * buffer = data;
+	while (sz >= hs) {
+		int size = hs == 2 ? (data[0] << 8 | data[1]) : (data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3]);
+		data += hs;
+		sz -= hs;
+		assert(size <= sz);
+		_forward(g, c, data, size);
+		data += size;
+		sz -= size;
+	}
+	skynet_free(buffer);
+}
+
 static void
 dispatch_message(struct gate *g, struct connection *c, int id, void * data, int sz) {
 	databuffer_push(&c->buffer,&g->mp, data, sz);
@@ -206,7 +362,7 @@ dispatch_message(struct gate *g, struct connection *c, int id, void * data, int
 				skynet_error(ctx, "Recv socket message > 16M");
 				return;
 			} else {
-				_forward(g, c, size);
+				_forward(g, c, NULL, size);
 				databuffer_reset(&c->buffer);
 			}
 		}
@@ -221,7 +377,11 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 		int id = hashid_lookup(&g->hash, message->id);
 		if (id>=0) {
 			struct connection *c = &g->conn[id];
-			dispatch_message(g, c, message->id, message->buffer, message->ud);
+			if (c->framing) {
+				dispatch_packages(g, c, (uint8_t *)message->buffer, message->ud);
+			} else {
+				dispatch_message(g, c, message->id, message->buffer, message->ud);
+			}
 		} else {
 			skynet_error(ctx, "Drop unknown connection %d message", message->id);
 			skynet_socket_close(ctx, message->id);
@@ -253,23 +413,22 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 		}
 		break;
 	}
-	case SKYNET_SOCKET_TYPE_ACCEPT:
+	case SKYNET_SOCKET_TYPE_ACCEPT: {
 		// report accept, then it will be get a SKYNET_SOCKET_TYPE_CONNECT message
 		assert(g->listen_id == message->id);
-		if (hashid_full(&g->hash)) {
-			skynet_socket_close(ctx, message->ud);
+		uint32_t shard = _shard(g, message->ud);
+		if (shard) {
+			char tmp[64];
+			int n = snprintf(tmp, sizeof(tmp), "accept %d ", message->ud);
+			if (sz > (int)sizeof(tmp) - n)
+				sz = sizeof(tmp) - n;
+			memcpy(tmp + n, message+1, sz);
+			skynet_send(ctx, 0, shard, PTYPE_TEXT, 0, tmp, n + sz);
 		} else {
-			struct connection *c = &g->conn[hashid_insert(&g->hash, message->ud)];
-			if (sz >= sizeof(c->remote_name)) {
-				sz = sizeof(c->remote_name) - 1;
-			}
-			c->id = message->ud;
-			memcpy(c->remote_name, message+1, sz);
-			c->remote_name[sz] = '\0';
-			_report(g, "%d open %d %s:0",c->id, c->id, c->remote_name);
-			skynet_error(ctx, "socket open: %x", c->id);
+			_accept(g, message->ud, (const char *)(message+1), sz);
 		}
 		break;
+	}
 	case SKYNET_SOCKET_TYPE_WARNING:
 		skynet_error(ctx, "fd (%d) send buffer (%d)K", message->id, message->ud);
 		break;
@@ -292,8 +451,8 @@ _cb(struct skynet_context * ctx, void * ud, int type, int session, uint32_t sour
 		const uint8_t * idbuf = msg + sz - 4;
 		uint32_t uid = idbuf[0] | idbuf[1] << 8 | idbuf[2] << 16 | idbuf[3] << 24;
 		int id = hashid_lookup(&g->hash, uid);
-		if (id>=0) {
-			// don't send id (last 4 bytes)
+		if (id>=0 || _shard(g, uid)) {
+			// don't send id (last 4 bytes), the socket of other shards can be written directly too
 			skynet_socket_send(ctx, uid, (void*)msg, sz-4);
 			// return 1 means don't free msg
 			return 1;
@@ -339,6 +498,36 @@ start_listen(struct gate *g, char * listen_addr) {
 	return 0;
 }
 
+static int
+start_shard(struct gate *g, char header, int client_tag, int max, int shard_n) {
+	struct skynet_context * ctx = g->ctx;
+	if (shard_n > MAX_SHARD) {
+		shard_n = MAX_SHARD;
+	}
+	char watchdog[16];
+	if (g->watchdog) {
+		snprintf(watchdog, sizeof(watchdog), ":%x", g->watchdog);
+	} else {
+		strcpy(watchdog, "!");
+	}
+	char parm[128];
+	// binding "!" means no listening, the shard gets its connections from this gate
+	snprintf(parm, sizeof(parm), "gate %c %s ! %d %d", header, watchdog, client_tag, max);
+	g->shard[0] = 0;
+	g->shard_n = 1;
+	int i;
+	for (i=1;i<shard_n;i++) {
+		const char * addr = skynet_command(ctx, "LAUNCH", parm);
+		if (addr == NULL) {
+			skynet_error(ctx, "Launch gate shard failed");
+			return 1;
+		}
+		g->shard[i] = strtoul(addr+1, NULL, 16);
+		g->shard_n = i + 1;
+	}
+	return 0;
+}
+
 int
 gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	if (parm == NULL)
@@ -348,8 +537,9 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	char watchdog[sz];
 	char binding[sz];
 	int client_tag = 0;
+	int shard_n = 1;
 	char header;
-	int n = sscanf(parm, "%c %s %s %d %d", &header, watchdog, binding, &client_tag, &max);
+	int n = sscanf(parm, "%c %s %s %d %d %d", &header, watchdog, binding, &client_tag, &max, &shard_n);
 	if (n<4) {
 		skynet_error(ctx, "Invalid gate parm %s",parm);
 		return 1;
@@ -392,5 +582,13 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 
 	skynet_callback(ctx,g,_cb);
 
+	if (strcmp(binding, "!") == 0) {
+		// a shard gate
+		return 0;
+	}
+	if (shard_n > 1 && start_shard(g, header, client_tag, max, shard_n)) {
+		return 1;
+	}
+
 	return start_listen(g,binding);
 }
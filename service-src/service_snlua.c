@@ -1,4 +1,5 @@
 #include "skynet.h"
+#include "spinlock.h"
 
 #include <lua.h>
 #include <lualib.h>
@@ -8,18 +9,60 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
+
+#if defined(__APPLE__)
+#include <sys/time.h>
+#endif
 
 // 一个 snlua 服务分配的内存数报警的初始阈值，每当触发一次报警，相应阈值*2
 #define MEMORY_WARNING_REPORT (1024 * 1024 * 32)
 
+// 可选的 lua 虚拟机小对象分配器 (配置 snlua_arena = 1 启用)
+// 小于等于 ARENA_MAXSIZE 的内存按 ARENA_ALIGN 分档，从 ARENA_PAGE 大小的页中切分，释放的块按档串成链表。
+// 一个服务的虚拟机同时只在一个线程中运行，所以不需要锁。页在服务退出时一起释放。
+#define ARENA_ALIGN 16
+#define ARENA_MAXSIZE 256
+#define ARENA_CLASS (ARENA_MAXSIZE / ARENA_ALIGN)
+#define ARENA_PAGE (16 * 1024)
+
+struct arena_page {
+	struct arena_page * next;
+};
+
+struct arena {
+	void * freelist[ARENA_CLASS];
+	char * ptr;	// 当前页还没有切分的部分
+	char * end;
+	struct arena_page * page;
+	size_t pages;
+	size_t live;	// 正在使用的小对象的字节数 (按档的大小)
+};
+
 struct snlua {
 	lua_State * L; // 每一个snlua服务，对应一个独立的 lua_State
 	struct skynet_context * ctx;
 	size_t mem; // 当前累积分配的内存数
 	size_t mem_report; // 分配内存数报警的值
 	size_t mem_limit; // 最多分配的内存数，默认为0，没有限制的
+	int warm; // 从预热池中取出的虚拟机，已经打开了标准库并且 require 了 skynet
+	struct snlua * next;
+	struct arena * arena; // NULL : 不使用 arena 分配器
+};
+
+static int ARENA_ENABLE = -1;	// -1 : 还没有读取配置 snlua_arena
+
+// 预热的 snlua 虚拟机池，池的大小为配置 snlua_pool (默认为0，不启用)
+// launcher 服务空闲的时候预热虚拟机放入池中，snlua_create 优先从池中取
+struct snlua_pool {
+	struct spinlock lock;
+	int size;	// -1 : 还没有读取配置
+	int n;
+	struct snlua * head;
 };
 
+static struct snlua_pool POOL = { .size = -1 };
+
 // LUA_CACHELIB may defined in patched lua for shared proto
 // 当前宏是有定义的，在3rd/lua/lualib.h
 #ifdef LUA_CACHELIB
@@ -75,12 +118,11 @@ optstring(struct skynet_context *ctx, const char *key, const char * str) {
 	return ret;
 }
 
-// 处理snlua服务第一条消息的相应逻辑，即用来初始化snlua服务
-// 这里args就是比如bootstrap、launcher等字符串
-static int
-init_cb(struct snlua *l, struct skynet_context *ctx, const char * args, size_t sz) {
-	lua_State *L = l->L;
-	l->ctx = ctx;
+static int luaopen_snlua(lua_State *L);
+
+// 打开标准库，设置 loader.lua 需要的全局变量，服务初始化和预热虚拟机都调用
+static void
+open_state(lua_State *L, struct skynet_context *ctx) {
 	lua_gc(L, LUA_GCSTOP, 0);
 	lua_pushboolean(L, 1);  /* signal for libraries to ignore env. vars. */
 	lua_setfield(L, LUA_REGISTRYINDEX, "LUA_NOENV");
@@ -93,6 +135,12 @@ init_cb(struct snlua *l, struct skynet_context *ctx, const char * args, size_t s
 	luaL_requiref(L, "skynet.codecache", codecache , 0);
 	lua_pop(L,1);
 
+	// require "skynet.snlua" (launcher 服务预热虚拟机池)
+	luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+	lua_pushcfunction(L, luaopen_snlua);
+	lua_setfield(L, -2, "skynet.snlua");
+	lua_pop(L, 1);
+
 	// 通过配置文件，设置lua 虚拟机相应的全局变量
 	const char *path = optstring(ctx, "lua_path","./lualib/?.lua;./lualib/?/init.lua");
 	lua_pushstring(L, path);
@@ -106,6 +154,41 @@ init_cb(struct snlua *l, struct skynet_context *ctx, const char * args, size_t s
 	const char *preload = skynet_command(ctx, "GETENV", "preload");
 	lua_pushstring(L, preload);
 	lua_setglobal(L, "LUA_PRELOAD");
+}
+
+// 预热的虚拟机中 skynet.core 的函数绑定的是预热它的服务 (upvalue 1)，改为绑定新服务
+static void
+bind_context(lua_State *L, struct skynet_context *ctx) {
+	lua_pushlightuserdata(L, ctx);
+	lua_setfield(L, LUA_REGISTRYINDEX, "skynet_context");
+	lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+	lua_getfield(L, -1, "skynet.core");
+	lua_pushnil(L);
+	while (lua_next(L, -2) != 0) {
+		if (lua_iscfunction(L, -1) && lua_getupvalue(L, -1, 1) != NULL) {
+			int bound = lua_islightuserdata(L, -1);
+			lua_pop(L, 1);
+			if (bound) {
+				lua_pushlightuserdata(L, ctx);
+				lua_setupvalue(L, -2, 1);
+			}
+		}
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 2);
+}
+
+// 处理snlua服务第一条消息的相应逻辑，即用来初始化snlua服务
+// 这里args就是比如bootstrap、launcher等字符串
+static int
+init_cb(struct snlua *l, struct skynet_context *ctx, const char * args, size_t sz) {
+	lua_State *L = l->L;
+	l->ctx = ctx;
+	if (l->warm) {
+		bind_context(L, ctx);
+	} else {
+		open_state(L, ctx);
+	}
 
 	lua_pushcfunction(L, traceback);
 	assert(lua_gettop(L) == 1);
@@ -180,6 +263,89 @@ snlua_init(struct snlua *l, struct skynet_context *ctx, const char * args) {
 	return 0;
 }
 
+#define ARENA_CLASSID(sz) (((sz) - 1) / ARENA_ALIGN)
+
+static void *
+arena_alloc(struct arena *a, size_t sz) {
+	int c = ARENA_CLASSID(sz);
+	size_t csz = (c + 1) * ARENA_ALIGN;
+	void * p = a->freelist[c];
+	if (p) {
+		a->freelist[c] = *(void **)p;
+	} else {
+		if (a->ptr + csz > a->end) {
+			struct arena_page * page = skynet_malloc(ARENA_PAGE);
+			page->next = a->page;
+			a->page = page;
+			++a->pages;
+			a->ptr = (char *)page + ARENA_ALIGN;
+			a->end = (char *)page + ARENA_PAGE;
+		}
+		p = a->ptr;
+		a->ptr += csz;
+	}
+	a->live += csz;
+	return p;
+}
+
+static void
+arena_free(struct arena *a, void *p, size_t sz) {
+	int c = ARENA_CLASSID(sz);
+	*(void **)p = a->freelist[c];
+	a->freelist[c] = p;
+	a->live -= (c + 1) * ARENA_ALIGN;
+}
+
+static void *
+arena_realloc(struct arena *a, void *ptr, size_t osize, size_t nsize) {
+	if (ptr == NULL)
+		osize = 0;	// osize is the type of the new object
+	int osmall = osize > 0 && osize <= ARENA_MAXSIZE;
+	int nsmall = nsize > 0 && nsize <= ARENA_MAXSIZE;
+	if (nsize == 0) {
+		if (osmall) {
+			arena_free(a, ptr, osize);
+			return NULL;
+		}
+		return skynet_lalloc(ptr, osize, 0);
+	}
+	if (osmall && nsmall && ARENA_CLASSID(osize) == ARENA_CLASSID(nsize))
+		return ptr;
+	if (!osmall && !nsmall)
+		return skynet_lalloc(ptr, osize, nsize);
+	void * nptr = nsmall ? arena_alloc(a, nsize) : skynet_lalloc(NULL, 0, nsize);
+	if (nptr && ptr) {
+		memcpy(nptr, ptr, osize < nsize ? osize : nsize);
+		if (osmall) {
+			arena_free(a, ptr, osize);
+		} else {
+			skynet_lalloc(ptr, osize, 0);
+		}
+	}
+	return nptr;
+}
+
+static struct arena *
+arena_new(void) {
+	struct arena * a = skynet_malloc(sizeof(*a));
+	memset(a, 0, sizeof(*a));
+	return a;
+}
+
+static void
+arena_release(struct arena *a) {
+	// 有对象被 lua_sharetable 共享了 (虚拟机关闭后仍然存在)，就不能释放这些页
+	if (a->live == 0) {
+		struct arena_page * page = a->page;
+		while (page) {
+			struct arena_page * next = page->next;
+			skynet_free(page);
+			page = next;
+		}
+	}
+	skynet_free(a);
+}
+
 // lua 虚拟机中，分配内存回调的接口，即接管 lua 虚拟机的内存分配
 // 参数 ptr 是原来指向的内存，osize 原来指向的内存大小，nsize 表示想分配的内存大小
 static void *
@@ -199,25 +365,131 @@ lalloc(void * ud, void *ptr, size_t osize, size_t nsize) {
 		l->mem_report *= 2;
 		skynet_error(l->ctx, "Memory warning %.2f M", (float)l->mem / (1024 * 1024));
 	}
+	if (l->arena)
+		return arena_realloc(l->arena, ptr, osize, nsize);
 	return skynet_lalloc(ptr, osize, nsize);
 }
 
-struct snlua *
-snlua_create(void) {
+// 给收集器计时的时钟 (nsec)，服务的 gc 耗时通过 STAT gc 查询
+static lua_Integer
+gc_clock(void) {
+#if !defined(__APPLE__) || defined(AVAILABLE_MAC_OS_X_VERSION_10_12_AND_LATER)
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (lua_Integer)1000000000 * ti.tv_sec + ti.tv_nsec;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (lua_Integer)1000000000 * tv.tv_sec + tv.tv_usec * 1000;
+#endif
+}
+
+static struct snlua *
+snlua_new(void) {
 	struct snlua * l = skynet_malloc(sizeof(*l));
 	memset(l,0,sizeof(*l));
 	l->mem_report = MEMORY_WARNING_REPORT;
 	l->mem_limit = 0;
+	if (ARENA_ENABLE < 0) {
+		const char * arena = skynet_command(NULL, "GETENV", "snlua_arena");
+		ARENA_ENABLE = arena ? strtol(arena, NULL, 10) : 0;
+	}
+	if (ARENA_ENABLE) {
+		l->arena = arena_new();
+	}
 	l->L = lua_newstate(lalloc, l);
+	lua_setgcclock(l->L, gc_clock);
 	return l;
 }
 
+// 在 launcher 服务的线程中调用 (skynet_context_new)
+struct snlua *
+snlua_create(void) {
+	SPIN_LOCK(&POOL)
+	struct snlua * l = POOL.head;
+	if (l) {
+		POOL.head = l->next;
+		--POOL.n;
+	}
+	SPIN_UNLOCK(&POOL)
+	if (l) {
+		l->next = NULL;
+		return l;
+	}
+	return snlua_new();
+}
+
 void
 snlua_release(struct snlua *l) {
 	lua_close(l->L);
+	if (l->arena) {
+		arena_release(l->arena);
+	}
 	skynet_free(l);
 }
 
+// 预热一个虚拟机 : 打开标准库，并且 require "skynet"
+static struct snlua *
+prewarm(struct skynet_context *ctx) {
+	struct snlua * l = snlua_new();
+	lua_State *L = l->L;
+	open_state(L, ctx);
+	lua_getglobal(L, "package");
+	lua_getglobal(L, "LUA_PATH");
+	lua_setfield(L, -2, "path");
+	lua_getglobal(L, "LUA_CPATH");
+	lua_setfield(L, -2, "cpath");
+	lua_pop(L, 1);
+	lua_getglobal(L, "require");
+	lua_pushliteral(L, "skynet");
+	if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+		skynet_error(ctx, "Prewarm snlua error : %s", lua_tostring(L, -1));
+		snlua_release(l);
+		return NULL;
+	}
+	l->warm = 1;
+	return l;
+}
+
+/*
+	integer n (the number of vm to prewarm)
+	return integer (the number of vm in pool), integer (pool size)
+ */
+static int
+lprewarm(lua_State *L) {
+	int n = luaL_optinteger(L, 1, 1);
+	lua_getfield(L, LUA_REGISTRYINDEX, "skynet_context");
+	struct skynet_context *ctx = lua_touserdata(L, -1);
+	if (POOL.size < 0) {
+		const char * size = skynet_command(ctx, "GETENV", "snlua_pool");
+		POOL.size = size ? strtol(size, NULL, 10) : 0;
+	}
+	int i;
+	for (i=0;i<n && POOL.n < POOL.size;i++) {
+		struct snlua *l = prewarm(ctx);
+		if (l == NULL)
+			break;
+		SPIN_LOCK(&POOL)
+		l->next = POOL.head;
+		POOL.head = l;
+		++POOL.n;
+		SPIN_UNLOCK(&POOL)
+	}
+	lua_pushinteger(L, POOL.n);
+	lua_pushinteger(L, POOL.size);
+	return 2;
+}
+
+static int
+luaopen_snlua(lua_State *L) {
+	luaL_Reg l[] = {
+		{ "prewarm", lprewarm },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L,l);
+	return 1;
+}
+
 void
 snlua_signal(struct snlua *l, int signal) {
 	skynet_error(l->ctx, "recv a signal %d", signal);
@@ -228,5 +500,8 @@ snlua_signal(struct snlua *l, int signal) {
 #endif
 	} else if (signal == 1) {
 		skynet_error(l->ctx, "Current Memory %.3fK", (float)l->mem / 1024);
+		if (l->arena) {
+			skynet_error(l->ctx, "Arena %.3fK in %d pages", (float)l->arena->live / 1024, (int)l->arena->pages);
+		}
 	}
 }
@@ -159,7 +159,7 @@ function COMMAND.help()
 		ping = "ping address",
 		call = "call address ...",
 		trace = "trace address [proto] [on|off]",
-		netstat = "netstat : show netstat",
+		netstat = "netstat [field [n]] : show netstat, sort by field (read/write/wbuffer/wbmax/eagain ...) and show the top n ; netstat histogram",
 	}
 end
 
@@ -411,12 +411,54 @@ local function convert_stat(info)
 	info.read = bytes(info.read)
 	info.write = bytes(info.write)
 	info.wbuffer = bytes(info.wbuffer)
+	info.wbmax = bytes(info.wbmax)
 	info.rtime = time(info.rtime)
 	info.wtime = time(info.wtime)
 end
 
-function COMMAND.netstat()
+local function histogram(hist, label)
+	local result = {}
+	for i, n in ipairs(hist) do
+		if n > 0 then
+			local limit = i == #hist and "inf" or label(1 << i)
+			table.insert(result, string.format("<%s:%d", limit, n))
+		end
+	end
+	return table.concat(result, "\t")
+end
+
+local function usec(t)
+	if t < 1000 then
+		return t .. "us"
+	elseif t < 1000000 then
+		return string.format("%.3gms", t / 1000)
+	end
+	return string.format("%.3gs", t / 1000000)
+end
+
+function COMMAND.netstat(field, n)
+	if field == "histogram" then
+		local hist = socket.histogram()
+		return {
+			rsize = histogram(hist.rsize, bytes),
+			wlatency = histogram(hist.wlatency, usec),
+		}
+	end
 	local stat = socket.netstat()
+	if field then
+		-- sort by the field (descending), the key of the result is the rank
+		table.sort(stat, function(a, b)
+			return (tonumber(a[field]) or 0) > (tonumber(b[field]) or 0)
+		end)
+		n = math.min(tonumber(n) or #stat, #stat)
+		local top = {}
+		local fmt = "%0" .. #tostring(n) .. "d"
+		for i = 1, n do
+			convert_stat(stat[i])
+			top[string.format(fmt, i)] = stat[i]
+		end
+		return top
+	end
 	for _, info in ipairs(stat) do
 		convert_stat(info)
 	end
@@ -1,6 +1,7 @@
 -- 该服务可以看做是用来管理所有其他的lua服务，其他lua服务的创建和删除都是告知launcher服务
 local skynet = require "skynet"
 local core = require "skynet.core"
+local snlua = require "skynet.snlua"
 require "skynet.manager"	-- import manager apis
 local string = string
 
@@ -100,6 +101,38 @@ function command.LAUNCH(_, service, ...)
 	return NORET
 end
 
+-- 一次启动 n 个同样的服务，它们在各自的工作线程中并行初始化，全部完成后返回地址列表 (失败的为 false)
+function command.LAUNCHN(_, n, service, ...)
+	local param = table.concat({...}, " ")
+	local session = skynet.context()
+	local response = skynet.response()
+	local list = {}
+	local wait = n
+	for i = 1, n do
+		local inst = skynet.launch(service, param)
+		list[i] = false
+		if inst then
+			services[inst] = service .. " " .. param
+			instance[inst] = function(ok, address)
+				if ok and address then
+					list[i] = address
+				end
+				wait = wait - 1
+				if wait == 0 then
+					response(true, list)
+				end
+			end
+			launch_session[inst] = session
+		else
+			wait = wait - 1
+		end
+	end
+	if wait == 0 then
+		response(true, list)
+	end
+	return NORET
+end
+
 function command.LOGLAUNCH(_, service, ...)
 	local inst = launch_service(service, ...)
 	if inst then
@@ -172,4 +205,22 @@ skynet.dispatch("lua", function(session, address, cmd , ...)
 	end
 end)
 
-skynet.start(function() end)
+-- 空闲的时候 (没有等待处理的消息) 预热 snlua 虚拟机池，见 service-src/service_snlua.c
+-- 创建虚拟机的开销和不用池的时候一样，所以集中启动 (包括 LAUNCHN) 的时候不补充，池的大小 (snlua_pool) 要覆盖一次集中启动的数量
+local function prewarm()
+	while true do
+		local n, size = snlua.prewarm(skynet.mqlen() == 0 and 1 or 0)
+		if size == 0 then
+			return
+		end
+		if n < size and skynet.mqlen() == 0 then
+			skynet.yield()
+		else
+			skynet.sleep(10)
+		end
+	end
+end
+
+skynet.start(function()
+	skynet.fork(prewarm)
+end)
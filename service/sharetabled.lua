@@ -0,0 +1,47 @@
+local skynet = require "skynet"
+local core = require "skynet.sharetable.core"
+local cache = require "skynet.codecache"
+cache.mode "OFF"	-- turn off codecache, because CMD.new may load data file
+
+-- name -> the shared table (lightuserdata), the tables are frozen in this service and never freed
+local pool = {}
+
+local CMD = {}
+
+local env_mt = { __index = _ENV }
+
+function CMD.new(name, t, ...)
+	assert(pool[name] == nil, name)
+	local dt = type(t)
+	local value
+	if dt == "table" then
+		value = t
+	elseif dt == "string" then
+		value = setmetatable({}, env_mt)
+		local f
+		if t:sub(1,1) == "@" then
+			f = assert(loadfile(t:sub(2),"bt",value))
+		else
+			f = assert(load(t, "=" .. name, "bt", value))
+		end
+		local _, ret = assert(skynet.pcall(f, ...))
+		setmetatable(value, nil)
+		if type(ret) == "table" then
+			value = ret
+		end
+	else
+		error ("Unknown data type " .. dt)
+	end
+	pool[name] = core.freeze(value)
+end
+
+function CMD.query(name)
+	return assert(pool[name], name)
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function (session, source ,cmd, ...)
+		local f = assert(CMD[cmd])
+		skynet.ret(skynet.pack(f(...)))
+	end)
+end)
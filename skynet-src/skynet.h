@@ -36,6 +36,7 @@ int skynet_isremote(struct skynet_context *, uint32_t handle, int * harbor);
 
 typedef int (*skynet_cb)(struct skynet_context * context, void *ud, int type, int session, uint32_t source , const void * msg, size_t sz);
 void skynet_callback(struct skynet_context * context, void *ud, skynet_cb cb);
+void skynet_gcstat(struct skynet_context * context, uint64_t ti);	// set the gc time (in nanosec) of the service
 
 uint32_t skynet_current_handle(void);
 uint64_t skynet_now(void);
@@ -165,6 +165,7 @@ main(int argc, char *argv[]) {
 	config.logger = optstring("logger", NULL);
 	config.logservice = optstring("logservice", "logger");
 	config.profile = optboolean("profile", 1);
+	config.maxsocket = optint("maxsocket", 65536);
 
 	lua_close(L);
 
@@ -49,6 +49,7 @@ struct skynet_context {
 	FILE * logfile;
 	uint64_t cpu_cost;	// in microsec
 	uint64_t cpu_start;	// in microsec
+	uint64_t gc_cost;	// in nanosec, 由 lua 服务更新 (skynet_gcstat)
 	char result[32];
 	uint32_t handle;
 	int session_id;
@@ -157,6 +158,7 @@ skynet_context_new(const char * name, const char *param) {
 
 	ctx->cpu_cost = 0;
 	ctx->cpu_start = 0;
+	ctx->gc_cost = 0;
 	ctx->message_count = 0;
 	ctx->profile = G_NODE.profile;
 	// Should set to 0 first to avoid skynet_handle_retireall get an uninitialized handle
@@ -615,6 +617,9 @@ cmd_stat(struct skynet_context * context, const char * param) {
 		} else {
 			strcpy(context->result, "0");
 		}
+	} else if (strcmp(param, "gc") == 0) {
+		double t = (double)context->gc_cost / 1000000000.0;	// nanosec
+		sprintf(context->result, "%lf", t);
 	} else if (strcmp(param, "message") == 0) {
 		sprintf(context->result, "%d", context->message_count);
 	} else {
@@ -842,6 +847,12 @@ skynet_callback(struct skynet_context * context, void *ud, skynet_cb cb) {
 	context->cb_ud = ud;
 }
 
+// 服务的 gc 累积耗时 (nanosec)，lua 服务在每个消息处理完之后更新，通过 STAT gc 查询
+void
+skynet_gcstat(struct skynet_context * context, uint64_t ti) {
+	context->gc_cost = ti;
+}
+
 void
 skynet_context_send(struct skynet_context * ctx, void * msg, size_t sz, uint32_t source, int type, int session) {
 	struct skynet_message smsg;
@@ -15,9 +15,10 @@
 static struct socket_server * SOCKET_SERVER = NULL;
 
 // 服务器启动时候主线程调用，初始化管理 socket 相关的结构体
+// max_socket 为配置项 maxsocket ，最多可以同时打开的套接字数量
 void 
-skynet_socket_init() {
-	SOCKET_SERVER = socket_server_create(skynet_now());
+skynet_socket_init(int max_socket) {
+	SOCKET_SERVER = socket_server_create(skynet_now(), max_socket);
 }
 
 // timer线程退出的时候调用，用来唤醒 sokcet线程
@@ -118,6 +119,9 @@ skynet_socket_poll() {
 	case SOCKET_WARNING:
 		forward_message(SKYNET_SOCKET_TYPE_WARNING, false, &result);
 		break;
+	case SOCKET_UDP_BATCH:
+		forward_message(SKYNET_SOCKET_TYPE_UDP_BATCH, false, &result);
+		break;
 	default:
 		skynet_error(NULL, "Unknown socket message type %d.",type);
 		return -1;
@@ -140,18 +144,52 @@ skynet_socket_send_lowpriority(struct skynet_context *ctx, int id, void *buffer,
 	return socket_server_send_lowpriority(SOCKET_SERVER, id, buffer, sz);
 }
 
+int
+skynet_socket_sendfile(struct skynet_context *ctx, int id, int fd, int64_t offset, int size) {
+	return socket_server_sendfile(SOCKET_SERVER, id, fd, offset, size);
+}
+
+void
+skynet_socket_proxy(struct skynet_context *ctx, int id, int peer) {
+	uint32_t source = skynet_context_handle(ctx);
+	socket_server_proxy(SOCKET_SERVER, source, id, peer);
+}
+
 int 
 skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog) {
 	uint32_t source = skynet_context_handle(ctx);
 	return socket_server_listen(SOCKET_SERVER, source, host, port, backlog);
 }
 
+int
+skynet_socket_listen_reuseport(struct skynet_context *ctx, const char *host, int port, int backlog) {
+	uint32_t source = skynet_context_handle(ctx);
+	return socket_server_listen_reuseport(SOCKET_SERVER, source, host, port, backlog);
+}
+
 int 
 skynet_socket_connect(struct skynet_context *ctx, const char *host, int port) {
 	uint32_t source = skynet_context_handle(ctx);
 	return socket_server_connect(SOCKET_SERVER, source, host, port);
 }
 
+int
+skynet_socket_tls_context(int server, const char *cert, const char *key, const char *ca) {
+	return socket_server_tls_context(SOCKET_SERVER, server, cert, key, ca);
+}
+
+int
+skynet_socket_listen_tls(struct skynet_context *ctx, const char *host, int port, int backlog, int reuseport, int tls) {
+	uint32_t source = skynet_context_handle(ctx);
+	return socket_server_listen_tls(SOCKET_SERVER, source, host, port, backlog, reuseport, tls);
+}
+
+int
+skynet_socket_connect_tls(struct skynet_context *ctx, const char *host, int port, int tls) {
+	uint32_t source = skynet_context_handle(ctx);
+	return socket_server_connect_tls(SOCKET_SERVER, source, host, port, tls);
+}
+
 int 
 skynet_socket_bind(struct skynet_context *ctx, int fd) {
 	uint32_t source = skynet_context_handle(ctx);
@@ -181,6 +219,28 @@ skynet_socket_nodelay(struct skynet_context *ctx, int id) {
 	socket_server_nodelay(SOCKET_SERVER, id);
 }
 
+void
+skynet_socket_sendstat(struct socket_sendstat *stat) {
+	socket_server_sendstat(SOCKET_SERVER, stat);
+}
+
+void
+skynet_socket_histogram(struct socket_histogram *hist) {
+	socket_server_histogram(SOCKET_SERVER, hist);
+}
+
+// 设置发送缓存的高水位策略 (SOCKET_HWM_*) 和限速
+void
+skynet_socket_limit(struct skynet_context *ctx, int id, int64_t hwm, int policy, int rate) {
+	socket_server_limit(SOCKET_SERVER, id, hwm, policy, rate);
+}
+
+// 设置分帧模式，之后只上报完整的包(包括包头)，一个消息中可以有多个包
+void
+skynet_socket_framing(struct skynet_context *ctx, int id, int header, int max) {
+	socket_server_framing(SOCKET_SERVER, id, header, max);
+}
+
 int 
 skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port) {
 	uint32_t source = skynet_context_handle(ctx);
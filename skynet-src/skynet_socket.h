@@ -12,6 +12,8 @@ struct skynet_context;
 #define SKYNET_SOCKET_TYPE_ERROR 5
 #define SKYNET_SOCKET_TYPE_UDP 6
 #define SKYNET_SOCKET_TYPE_WARNING 7
+// several udp packages in one message, see forward_message_udp in socket_server.c for the format
+#define SKYNET_SOCKET_TYPE_UDP_BATCH 8
 
 struct skynet_socket_message {
 	int type;
@@ -20,7 +22,7 @@ struct skynet_socket_message {
 	char * buffer;
 };
 
-void skynet_socket_init();
+void skynet_socket_init(int max_socket);
 void skynet_socket_exit();
 void skynet_socket_free();
 int skynet_socket_poll();
@@ -28,13 +30,21 @@ void skynet_socket_updatetime();
 
 int skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz);
 int skynet_socket_send_lowpriority(struct skynet_context *ctx, int id, void *buffer, int sz);
+int skynet_socket_sendfile(struct skynet_context *ctx, int id, int fd, int64_t offset, int size);
+void skynet_socket_proxy(struct skynet_context *ctx, int id, int peer);
 int skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog);
+int skynet_socket_listen_reuseport(struct skynet_context *ctx, const char *host, int port, int backlog);
 int skynet_socket_connect(struct skynet_context *ctx, const char *host, int port);
+int skynet_socket_tls_context(int server, const char *cert, const char *key, const char *ca);
+int skynet_socket_listen_tls(struct skynet_context *ctx, const char *host, int port, int backlog, int reuseport, int tls);
+int skynet_socket_connect_tls(struct skynet_context *ctx, const char *host, int port, int tls);
 int skynet_socket_bind(struct skynet_context *ctx, int fd);
 void skynet_socket_close(struct skynet_context *ctx, int id);
 void skynet_socket_shutdown(struct skynet_context *ctx, int id);
 void skynet_socket_start(struct skynet_context *ctx, int id);
 void skynet_socket_nodelay(struct skynet_context *ctx, int id);
+void skynet_socket_framing(struct skynet_context *ctx, int id, int header, int max);
+void skynet_socket_limit(struct skynet_context *ctx, int id, int64_t hwm, int policy, int rate);
 
 int skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port);
 int skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr, int port);
@@ -42,5 +52,7 @@ int skynet_socket_udp_send(struct skynet_context *ctx, int id, const char * addr
 const char * skynet_socket_udp_address(struct skynet_socket_message *, int *addrsz);
 
 struct socket_info * skynet_socket_info();
+void skynet_socket_sendstat(struct socket_sendstat *stat);
+void skynet_socket_histogram(struct socket_histogram *hist);
 
 #endif
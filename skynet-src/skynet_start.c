@@ -293,7 +293,7 @@ skynet_start(struct skynet_config * config) {
 	skynet_timer_init();
 
 	// 初始化管理socket的结构体，包括epool的fd
-	skynet_socket_init();
+	skynet_socket_init(config->maxsocket);
 
 	// 设置 profile  开关
 	skynet_profile_enable(config->profile);
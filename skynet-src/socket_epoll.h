@@ -46,19 +46,21 @@ sp_del(int efd, int sock) {
 	epoll_ctl(efd, EPOLL_CTL_DEL, sock , NULL);
 }
 
+// 修改sock监听的事件，read_enable/write_enable 为是否监听可读/可写
 static void 
-sp_write(int efd, int sock, void *ud, bool enable) {
+sp_enable(int efd, int sock, void *ud, bool read_enable, bool write_enable) {
 	struct epoll_event ev;
-	ev.events = EPOLLIN | (enable ? EPOLLOUT : 0);
+	ev.events = (read_enable ? EPOLLIN : 0) | (write_enable ? EPOLLOUT : 0);
 	ev.data.ptr = ud; // 设置回调数据，在socket线程就是套接字对应的结构体
 	epoll_ctl(efd, EPOLL_CTL_MOD, sock, &ev);
 }
 
 static int 
-sp_wait(int efd, struct event *e, int max) {
+sp_wait(int efd, struct event *e, int max, int timeout) {
 	struct epoll_event ev[max];
 	// 系统调用epoll_wait将阻塞等待数据读取，直到有数据读取，可读取的事件放到数组ev中
-	int n = epoll_wait(efd , ev, max, -1);
+	// timeout 为毫秒，-1 表示一直等待
+	int n = epoll_wait(efd , ev, max, timeout);
 	int i;
 	for (i=0;i<n;i++) {
 		e[i].s = ev[i].data.ptr;
@@ -18,10 +18,34 @@ struct socket_info {
 	uint64_t rtime;
 	uint64_t wtime;
 	int64_t wbuffer;
+	int tls;	// 0 : no tls, 1 : handshake, 2 : established, 3 : established with a resumed session
+	uint64_t rpacket;	// reads which get data (datagrams for udp)
+	uint64_t wpacket;	// buffers written completely
+	uint64_t rcall;	// read syscalls
+	uint64_t wcall;	// write syscalls
+	uint64_t eagain;	// EAGAIN of reads and writes
+	int wqueue;	// buffers in the send queue
+	int64_t wbmax;	// max size of the send buffer
 	char name[128];
 	struct socket_info *next;
 };
 
+// statistics of socket_server_send
+struct socket_sendstat {
+	uint64_t direct;	// written by the worker thread completely
+	uint64_t partial;	// written by the worker thread partly, the rest is left to the socket thread
+	uint64_t queued;	// queued after the rest of direct writes by the worker thread, without a request
+	uint64_t request;	// sent to the socket thread by a request
+};
+
+#define SOCKET_HISTOGRAM 24
+
+// global histograms of the socket thread, bucket i counts the values in [2^i, 2^(i+1)), the last one counts the larger
+struct socket_histogram {
+	uint64_t rsize[SOCKET_HISTOGRAM];	// bytes of each read
+	uint64_t wlatency[SOCKET_HISTOGRAM];	// microseconds from a buffer queued to written completely
+};
+
 struct socket_info * socket_info_create(struct socket_info *last);
 void socket_info_release(struct socket_info *);
 
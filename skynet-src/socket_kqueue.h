@@ -56,18 +56,25 @@ sp_add(int kfd, int sock, void *ud) {
 }
 
 static void 
-sp_write(int kfd, int sock, void *ud, bool enable) {
+sp_enable(int kfd, int sock, void *ud, bool read_enable, bool write_enable) {
 	struct kevent ke;
-	EV_SET(&ke, sock, EVFILT_WRITE, enable ? EV_ENABLE : EV_DISABLE, 0, 0, ud);
+	EV_SET(&ke, sock, EVFILT_READ, read_enable ? EV_ENABLE : EV_DISABLE, 0, 0, ud);
+	if (kevent(kfd, &ke, 1, NULL, 0, NULL) == -1 || ke.flags & EV_ERROR) {
+		// todo: check error
+	}
+	EV_SET(&ke, sock, EVFILT_WRITE, write_enable ? EV_ENABLE : EV_DISABLE, 0, 0, ud);
 	if (kevent(kfd, &ke, 1, NULL, 0, NULL) == -1 || ke.flags & EV_ERROR) {
 		// todo: check error
 	}
 }
 
 static int 
-sp_wait(int kfd, struct event *e, int max) {
+sp_wait(int kfd, struct event *e, int max, int timeout) {
 	struct kevent ev[max];
-	int n = kevent(kfd, NULL, 0, ev, max, NULL);
+	struct timespec ts;
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000;
+	int n = kevent(kfd, NULL, 0, ev, max, timeout < 0 ? NULL : &ts);
 
 	int i;
 	for (i=0;i<n;i++) {
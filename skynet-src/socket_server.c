@@ -1,3 +1,8 @@
+#ifdef __linux__
+// for sendmmsg / recvmmsg
+#define _GNU_SOURCE
+#endif
+
 #include "skynet.h"
 
 #include "socket_server.h"
@@ -7,6 +12,8 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 #include <netinet/tcp.h>
 #include <unistd.h>
 #include <errno.h>
@@ -16,10 +23,23 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#ifdef SKYNET_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
 
 #define MAX_INFO 128
-// MAX_SOCKET will be 2^MAX_SOCKET_P
-#define MAX_SOCKET_P 16
+// The max number of sockets is 2^slot_p, and slot_p is in [MIN_SOCKET_P, MAX_SOCKET_P]
+#define DEFAULT_SOCKET_P 16
+#define MIN_SOCKET_P 8
+#define MAX_SOCKET_P 24
+// slot 按段分配，每段最多 2^SEGMENT_P 个套接字，段分配后不会移动，所以套接字结构体的指针一直有效
+#define SEGMENT_P 12
 #define MAX_EVENT 64
 #define MIN_READ_BUFFER 64
 #define SOCKET_TYPE_INVALID 0
@@ -32,13 +52,21 @@
 #define SOCKET_TYPE_PACCEPT 7
 #define SOCKET_TYPE_BIND 8
 
-#define MAX_SOCKET (1<<MAX_SOCKET_P) // 当前是2^16，即65536
+// tls_state of socket
+#define TLS_NONE 0
+#define TLS_HANDSHAKE 1
+#define TLS_ESTABLISHED 2
+#define TLS_RESUMED 3	// established with a resumed session
+
+#define MAX_TLS_CONTEXT 16
+#define TLS_SESSION_CACHE 64
 
 #define PRIORITY_HIGH 0
 #define PRIORITY_LOW 1
 
-#define HASH_ID(id) (((unsigned)id) % MAX_SOCKET)
-#define ID_TAG16(id) ((id>>MAX_SOCKET_P) & 0xffff) // 取id中第三和第四个字节的数据
+// id 的低 slot_p 位为套接字在slot中的下标，高位为这个位置被重复使用的次数
+#define HASH_ID(ss, id) (((unsigned)id) & (ss)->slot_mask)
+#define ID_TAG16(ss, id) ((id>>(ss)->slot_p) & 0xffff) // 取id中下标之上的16位数据
 
 #define PROTOCOL_TCP 0
 #define PROTOCOL_UDP 1
@@ -49,6 +77,13 @@
 
 #define MAX_UDP_PACKAGE 65535
 
+// send_list_tcp 一次writev调用最多合并的write_buffer数量
+#define MAX_SEND_IOVEC 64
+// forward_message_udp 一次recvmmsg调用最多读取的udp包数量
+#define MAX_UDP_BATCH 16
+// 等待socket线程处理完所有请求后，再一起用sendmmsg发送的udp套接字最大数量
+#define MAX_UDP_PENDING 64
+
 // EAGAIN and EWOULDBLOCK may be not the same value.
 #if (EAGAIN != EWOULDBLOCK)
 #define AGAIN_WOULDBLOCK EAGAIN : case EWOULDBLOCK
@@ -66,9 +101,18 @@ struct write_buffer {
 	// userobject为ture ,表示send_object结构体中free_func字段是应用程接管的，
 	// 而是通用的skynet_free函数
 	bool userobject;
+	// file为true，表示buffer指向的是结构体sendfile_object，要发送的是文件中的一段数据
+	// 这时候 ptr - buffer 表示已经发送出去的字节数
+	bool file;
+	uint64_t time; // 加入发送队列的时间(微秒)，用来统计写延迟
 	uint8_t udp_address[UDP_ADDRESS_SIZE];
 };
 
+struct sendfile_object {
+	int fd;
+	int64_t offset;
+};
+
 // 宏offsetof返回成员udp_address在结构体write_buffer的偏移量
 #define SIZEOF_TCPBUFFER (offsetof(struct write_buffer, udp_address[0]))
 #define SIZEOF_UDPBUFFER (sizeof(struct write_buffer))
@@ -83,6 +127,12 @@ struct socket_stat {
 	uint64_t wtime; // 最近往网络写数据的时间
 	uint64_t read;
 	uint64_t write; // 统计往网络写入的字节总数
+	uint64_t rpacket; // 读到数据的次数，udp为包数
+	uint64_t wpacket; // 完整发送出去的数据块数
+	uint64_t rcall; // 读网络的系统调用次数
+	uint64_t wcall; // 写网络的系统调用次数
+	uint64_t eagain; // 读写遇到 EAGAIN 的次数
+	int64_t wb_max; // wb_size 的最大值
 };
 
 struct socket {
@@ -90,41 +140,112 @@ struct socket {
 	struct wb_list high; // 用于保存高优先级数据的 write_buffer list
 	struct wb_list low; // 用于保存低优先级数据的 write_buffer list
 	int64_t wb_size; // 保存所有要发送的数据字节数，包括high和low字段所有的数据
+	int wb_n; // high和low中的节点数，即发送队列的长度
+	volatile int64_t dw_size; // dw链表中的字节数，worker线程追加的时候原子增加，socket线程并入high的时候清零
+	volatile int dw_n; // dw链表中的节点数
 	struct socket_stat stat;
 	volatile uint32_t sending; // 这个字段的第三个字节和第四个字节值与id一样，低的两个字节初始值为0
 	int fd;
-	int id; // 通过HASH_ID(id)，可以获得在数组slot中的下标
+	int id; // 通过HASH_ID(ss, id)，可以获得在slot中的下标
 	uint8_t protocol; // 使用的协议，值为PROTOCOL_TCP等类型
 	uint8_t type; // socket 当前状态类型，初始值为SOCKET_TYPE_INVALID，epoll事件触发时，会根据type来选择处理事件的逻辑
 	uint16_t udpconnecting;
+	bool udppending; // 为true表示已经加入socket_server的udp_pending数组，等待批量发送
 	int64_t warn_size; // 累计等待要发送的数据量，报警的数值
 	union {
 		int size; // 保存下次从网络上读数据最大的大小
 		uint8_t udp_address[UDP_ADDRESS_SIZE];
 	} p;
+	int next_free; // 在空闲链表中时，下一个空闲套接字的下标，-1表示没有
+	bool active; // 在活动链表中，new_fd 加入，free_socket 移除
+	int active_prev; // 活动链表(双向)的前后节点的下标，socket_server_info 只遍历这个链表
+	int active_next;
+	int proxy; // 代理模式下对端套接字的id，从本套接字读取的数据，直接在socket线程中转发给对端，否则为-1
+	bool reading; // 是否监听可读事件，代理模式下对端的发送缓存太多时暂停读
+	bool writing; // 是否监听可写事件
+	int frame_header; // 分帧模式下包头的字节数(2或4，大端)，为0表示不分帧，直接上报读到的数据
+	int frame_max; // 分帧模式下包体的最大长度，超过的时候关闭套接字
+	char * frame_buffer; // 分帧模式下还不完整的包的数据
+	int frame_size; // frame_buffer 中数据的长度
+	int frame_cap; // frame_buffer 的容量
+	int64_t hwm; // 发送缓存的高水位，wb_size超过后按照hwm_policy处理，0表示不限制
+	int hwm_policy; // SOCKET_HWM_DROP / SOCKET_HWM_CLOSE / SOCKET_HWM_PAUSE
+	bool hwm_paused; // 为true表示已经通知服务暂停发送，发送缓存清空的时候再通知恢复
+	bool throttled; // 为true表示因为限速暂停了可写事件，在socket_server的throttle数组中
+	volatile bool ratelimit; // 为true表示限速，在worker线程设置，这样不会再从worker线程直接发送数据
+	volatile bool highwater; // 为true表示设置了高水位，在worker线程设置，数据不能绕过socket线程直接追加到dw链表
+	int rate; // 令牌桶限速，每秒最多发送的字节数，0表示不限速
+	int64_t tokens; // 令牌桶中现在可以发送的字节数
+	uint64_t token_time; // 上次往令牌桶补充令牌的时间
+	int tls; // 监听套接字使用的 tls context 下标，-1表示不使用tls
+	uint8_t tls_state; // TLS_NONE 表示不使用tls，其它值只在socket线程中修改
+#ifdef SKYNET_TLS
+	SSL * ssl;
+#endif
 	struct spinlock dw_lock;
-	int dw_offset; // 保存在工作线程中已经写完成的数据
- 	// 用于保存工作线程没发送完剩余的数据，
-	// 指向的内容，除了要发送的数据外，最前面还包括其他信息，长度为dw_offset
-	const void * dw_buffer;
-	size_t dw_size; // dw_buffer 总的大小
+	// 工作线程直接写网络时没发送完剩余的数据，以及之后工作线程要发送的数据，在dw_lock的保护下由工作线程追加
+	// socket线程只在套接字可写(即之前遇到了EAGAIN)的时候，在send_buffer中把它移到high list的最前面
+	struct wb_list dw;
 };
 
+// 等待发送的数据量，包括worker线程追加到dw链表，还没有并入发送队列的数据
+static inline int64_t
+send_size(struct socket *s) {
+	return s->wb_size + s->dw_size;
+}
+
 struct socket_server {
 	volatile uint64_t time; // 保存skynet启动以来，经过的厘秒数
 	int recvctrl_fd; // 用于接收命令行数据的 fd，即管道的读端
 	int sendctrl_fd; // 用于发送命令行数据的 fd，即管道的写端
 	int checkctrl; // 用于表示是否检查处理命令行相关数据，初始值为1
 	poll_fd event_fd; // epoll 对应的 fd
-	int alloc_id; // 初始值为0，一直递增的，用来给新的套接字在slot数组中找一个空的位置
+	int slot_p; // 最多可以有 2^slot_p 个套接字
+	unsigned slot_mask; // 2^slot_p - 1
+	int segment_p; // 每段 2^segment_p 个套接字
+	int slot_n; // 已经分配的套接字结构体数量，即已经分配的段数 * 段大小
+	struct spinlock free_lock; // 保护空闲链表和段的分配
+	int free_head; // 空闲套接字链表(先进先出)，保存的是下标，-1表示空
+	int free_tail;
+	int active_head; // 活动套接字链表，也由 free_lock 保护，-1表示空
+	int active_n;
 	int event_n; // 初始值为0,标记本次epoll事件的数量
 	int event_index; // 初始化为0，下一个未处理的epoll事件索引
 	struct socket_object_interface soi; // 用来接管send_object的生成，即接口send_object_init中使用
 	struct event ev[MAX_EVENT]; // 保存当前可读写的事件信息，即保存epoll_wait的结果
-	struct socket slot[MAX_SOCKET]; // 保存所有套接字
+	struct socket ** slot; // 保存所有套接字的段，还没分配的段为NULL
+	struct socket invalid; // 下标所在的段还没分配时，get_socket返回这个无效的套接字
 	// 用来暂时保存一些数据，比如在connect和accept的时候，保存对方的ip地址和端口信息
 	char buffer[MAX_INFO]; 
 	uint8_t udpbuffer[MAX_UDP_PACKAGE];
+	uint8_t *udpbatch; // recvmmsg 使用的缓存，MAX_UDP_BATCH 个 MAX_UDP_PACKAGE 大小，第一次使用时候分配
+	int udp_pending_n;
+	int udp_pending[MAX_UDP_PENDING]; // 有udp包等待发送的套接字id
+	struct socket_sendstat sendstat; // 工作线程发送数据的统计，原子操作更新
+	struct socket_histogram hist; // 读数据大小和写延迟的分布，只在socket线程中更新
+	struct spinlock tls_lock; // 保护 tls context 的创建
+	int tls_n;
+#ifdef SKYNET_TLS
+	struct tls_context {
+		int server;
+		char * cert;
+		char * key;
+		char * ca;
+		SSL_CTX * ctx;
+	} tls_ctx[MAX_TLS_CONTEXT];
+	// 客户端的 session 缓存，按照 context:host:port 散列，只在socket线程中使用，用来在重连的时候恢复会话，省掉完整的握手
+	// 不同的 context 校验证书的方式不同，session 不能混用
+	struct tls_session {
+		int tls;
+		char host[64];
+		int port;
+		unsigned version;
+		SSL_SESSION * session;
+	} tls_session[TLS_SESSION_CACHE];
+#endif
+	int throttle_n;
+	int throttle_cap;
+	int *throttle; // 因为限速暂停发送的套接字id，每次epoll_wait之前检查能否恢复发送
 	fd_set rfds;
 };
 
@@ -132,6 +253,7 @@ struct socket_server {
 struct request_open {
 	int id;
 	int port;
+	int tls;
 	uintptr_t opaque;
 	char host[1];
 };
@@ -161,6 +283,7 @@ struct request_close {
 struct request_listen {
 	int id;
 	int fd;
+	int tls;
 	uintptr_t opaque; // 通常是服务的handle
 	char host[1];
 };
@@ -176,12 +299,38 @@ struct request_start {
 	uintptr_t opaque;
 };
 
+struct request_sendfile {
+	int id;
+	int fd;
+	int size;
+	int64_t offset;
+};
+
+struct request_proxy {
+	int id;
+	int peer;
+	uintptr_t opaque;
+};
+
 struct request_setopt {
 	int id;
 	int what;
 	int value;
 };
 
+struct request_framing {
+	int id;
+	int header;
+	int max;
+};
+
+struct request_limit {
+	int id;
+	int policy;
+	int rate;
+	int64_t hwm;
+};
+
 struct request_udp {
 	int id;
 	int fd;
@@ -205,6 +354,8 @@ struct request_udp {
 	U Create UDP socket
 	C set udp address
 	Q query info
+	F Send file
+	R Proxy two sockets
  */
 
 struct request_package {
@@ -219,8 +370,12 @@ struct request_package {
 		struct request_bind bind;
 		struct request_start start;
 		struct request_setopt setopt;
+		struct request_framing framing;
+		struct request_limit limit;
 		struct request_udp udp;
 		struct request_setudp set_udp;
+		struct request_sendfile sendfile;
+		struct request_proxy proxy;
 	} u;
 	uint8_t dummy[256];
 };
@@ -300,7 +455,11 @@ send_object_init(struct socket_server *ss, struct send_object *so, void *object,
 
 static inline void
 write_buffer_free(struct socket_server *ss, struct write_buffer *wb) {
-	if (wb->userobject) {
+	if (wb->file) {
+		struct sendfile_object *sf = wb->buffer;
+		close(sf->fd);
+		FREE(sf);
+	} else if (wb->userobject) {
 		ss->soi.free(wb->buffer);
 	} else {
 		FREE(wb->buffer);
@@ -314,34 +473,14 @@ socket_keepalive(int fd) {
 	setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (void *)&keepalive , sizeof(keepalive));  
 }
 
-// 从管理所有的套接字结构体socket的slot找一个空的位置，并且返回相应的id
-// 通过id，可以获得空结构体在slot中的位置
-static int
-reserve_id(struct socket_server *ss) {
-	int i;
-	for (i=0;i<MAX_SOCKET;i++) {
-		int id = ATOM_INC(&(ss->alloc_id));
-		if (id < 0) {
-			id = ATOM_AND(&(ss->alloc_id), 0x7fffffff);
-		}
-		struct socket *s = &ss->slot[HASH_ID(id)];
-		if (s->type == SOCKET_TYPE_INVALID) {
-			// 找一个空位置
-			if (ATOM_CAS(&s->type, SOCKET_TYPE_INVALID, SOCKET_TYPE_RESERVE)) {
-				s->id = id;
-				s->protocol = PROTOCOL_UNKNOWN;
-				// socket_server_udp_connect may inc s->udpconncting directly (from other thread, before new_fd), 
-				// so reset it to 0 here rather than in new_fd.
-				s->udpconnecting = 0;
-				s->fd = -1;
-				return id;
-			} else {
-				// retry
-				--i;
-			}
-		}
+static inline struct socket *
+get_socket(struct socket_server *ss, int id) {
+	unsigned index = HASH_ID(ss, id);
+	struct socket * seg = ss->slot[index >> ss->segment_p];
+	if (seg == NULL) {
+		return &ss->invalid;
 	}
-	return -1;
+	return &seg[index & ((1 << ss->segment_p) - 1)];
 }
 
 static inline void
@@ -350,10 +489,100 @@ clear_wb_list(struct wb_list *list) {
 	list->tail = NULL;
 }
 
+// 在free_lock的保护下调用，分配新的一段套接字结构体，并且加入空闲链表
+// 已经达到最大数量的时候返回0
+static int
+expand_slot(struct socket_server *ss) {
+	int size = 1 << ss->segment_p;
+	if (ss->slot_n + size > (1 << ss->slot_p))
+		return 0;
+	struct socket * seg = MALLOC(size * sizeof(struct socket));
+	memset(seg, 0, size * sizeof(struct socket));
+	int i;
+	for (i=0;i<size;i++) {
+		struct socket *s = &seg[i];
+		int index = ss->slot_n + i;
+		s->type = SOCKET_TYPE_INVALID;
+		// 第一次分配的id为 index + 2^slot_p ，见 reserve_id
+		s->id = index;
+		s->protocol = PROTOCOL_UNKNOWN;
+		s->next_free = (i == size - 1) ? -1 : index + 1;
+		clear_wb_list(&s->high);
+		clear_wb_list(&s->low);
+		clear_wb_list(&s->dw);
+		spinlock_init(&s->dw_lock);
+	}
+	// other threads may read ss->slot without lock, so publish the segment after it initialized
+	__sync_synchronize();
+	ss->slot[ss->slot_n >> ss->segment_p] = seg;
+	assert(ss->free_head < 0);
+	ss->free_head = ss->slot_n;
+	ss->free_tail = ss->slot_n + size - 1;
+	ss->slot_n += size;
+	return 1;
+}
+
+// 从空闲链表中取一个套接字结构体，并且返回相应的id，空闲链表为空的时候，分配新的一段
+// 同一个位置每次被重新使用，id 都会增加 2^slot_p，所以通过id，可以获得结构体在slot中的位置
+static int
+reserve_id(struct socket_server *ss) {
+	spinlock_lock(&ss->free_lock);
+	if (ss->free_head < 0 && !expand_slot(ss)) {
+		spinlock_unlock(&ss->free_lock);
+		return -1;
+	}
+	struct socket *s = get_socket(ss, ss->free_head);
+	ss->free_head = s->next_free;
+	if (ss->free_head < 0) {
+		ss->free_tail = -1;
+	}
+	spinlock_unlock(&ss->free_lock);
+
+	assert(s->type == SOCKET_TYPE_INVALID);
+	int id = (s->id + (1 << ss->slot_p)) & 0x7fffffff;
+	s->type = SOCKET_TYPE_RESERVE;
+	s->id = id;
+	s->protocol = PROTOCOL_UNKNOWN;
+	// socket_server_udp_connect may inc s->udpconncting directly (from other thread, before new_fd), 
+	// so reset it to 0 here rather than in new_fd.
+	s->udpconnecting = 0;
+	s->fd = -1;
+	return id;
+}
+
+// 把套接字设置为 SOCKET_TYPE_INVALID ，并且放回空闲链表的尾部
+// 放在尾部是为了尽量晚的重新使用，其它线程拿着旧id的时候，更不容易碰到新的套接字
+static void
+free_socket(struct socket_server *ss, struct socket *s) {
+	s->type = SOCKET_TYPE_INVALID;
+	int index = HASH_ID(ss, s->id);
+	s->next_free = -1;
+	spinlock_lock(&ss->free_lock);
+	if (s->active) {
+		s->active = false;
+		if (s->active_prev < 0) {
+			ss->active_head = s->active_next;
+		} else {
+			get_socket(ss, s->active_prev)->active_next = s->active_next;
+		}
+		if (s->active_next >= 0) {
+			get_socket(ss, s->active_next)->active_prev = s->active_prev;
+		}
+		--ss->active_n;
+	}
+	if (ss->free_tail < 0) {
+		ss->free_head = ss->free_tail = index;
+	} else {
+		get_socket(ss, ss->free_tail)->next_free = index;
+		ss->free_tail = index;
+	}
+	spinlock_unlock(&ss->free_lock);
+}
+
 // 在主线程中调用，服务器启动时候调用，创建管理 socket 相关的结构体 socket_server
+// max_socket 向上取整为2的幂，<=0 时使用默认值 2^DEFAULT_SOCKET_P
 struct socket_server * 
-socket_server_create(uint64_t time) {
-	int i;
+socket_server_create(uint64_t time, int max_socket) {
 	int fd[2];
 	// 调用系统接口 epoll_create，创建一个 epoll 实例，接口返回一个文件描述符，
 	// 返回的 fd 用于后续系统接口调用
@@ -390,15 +619,44 @@ socket_server_create(uint64_t time) {
 	ss->sendctrl_fd = fd[1];
 	ss->checkctrl = 1;
 
-	// 处理化字段slot，用来管理各个套接字的数组
-	for (i=0;i<MAX_SOCKET;i++) {
-		struct socket *s = &ss->slot[i];
-		s->type = SOCKET_TYPE_INVALID;
-		clear_wb_list(&s->high);
-		clear_wb_list(&s->low);
-		spinlock_init(&s->dw_lock);
+	// 初始化字段slot，套接字结构体在reserve_id中按需一段一段的分配
+	int p = MIN_SOCKET_P;
+	if (max_socket <= 0) {
+		p = DEFAULT_SOCKET_P;
+	} else {
+		while (p < MAX_SOCKET_P && (1 << p) < max_socket) {
+			++p;
+		}
 	}
-	ss->alloc_id = 0;
+	ss->slot_p = p;
+	ss->slot_mask = (1u << p) - 1;
+	ss->segment_p = p < SEGMENT_P ? p : SEGMENT_P;
+	ss->slot_n = 0;
+	int nseg = 1 << (p - ss->segment_p);
+	ss->slot = MALLOC(nseg * sizeof(struct socket *));
+	memset(ss->slot, 0, nseg * sizeof(struct socket *));
+	spinlock_init(&ss->free_lock);
+	ss->free_head = -1;
+	ss->free_tail = -1;
+	ss->active_head = -1;
+	ss->active_n = 0;
+	memset(&ss->invalid, 0, sizeof(ss->invalid));
+	ss->invalid.type = SOCKET_TYPE_INVALID;
+	ss->invalid.id = -1;
+	ss->invalid.protocol = PROTOCOL_UNKNOWN;
+	spinlock_init(&ss->invalid.dw_lock);
+	ss->udpbatch = NULL;
+	ss->udp_pending_n = 0;
+	ss->throttle_n = 0;
+	ss->throttle_cap = 0;
+	ss->throttle = NULL;
+	memset(&ss->sendstat, 0, sizeof(ss->sendstat));
+	memset(&ss->hist, 0, sizeof(ss->hist));
+	spinlock_init(&ss->tls_lock);
+	ss->tls_n = 0;
+#ifdef SKYNET_TLS
+	memset(ss->tls_session, 0, sizeof(ss->tls_session));
+#endif
 	ss->event_n = 0;
 	ss->event_index = 0;
 	memset(&ss->soi, 0, sizeof(ss->soi));
@@ -435,6 +693,84 @@ free_buffer(struct socket_server *ss, const void * buffer, int sz) {
 	so.free_func((void *)buffer);
 }
 
+// @socket线程，监听/不监听套接字的可写事件，保持可读事件不变
+static inline void
+enable_write(struct socket_server *ss, struct socket *s, bool enable) {
+	s->writing = enable;
+	sp_enable(ss->event_fd, s->fd, s, s->reading, enable);
+}
+
+// @socket线程，监听/不监听套接字的可读事件，保持可写事件不变
+static inline void
+enable_read(struct socket_server *ss, struct socket *s, bool enable) {
+	if (s->reading != enable) {
+		s->reading = enable;
+		sp_enable(ss->event_fd, s->fd, s, enable, s->writing);
+	}
+}
+
+// 代理模式下对端的发送缓存达到 proxy_limit 的一半时暂停读本端，降到四分之一以下再恢复，
+// 这样本端读得再快，对端的发送缓存也不会超过 proxy_limit 。没有设置高水位的时候按 WARNING_SIZE 计算
+static inline int64_t
+proxy_limit(struct socket *p) {
+	return p->hwm > 0 ? p->hwm : WARNING_SIZE;
+}
+
+// 代理模式下 s 的对端，对端已经失效的时候返回 NULL
+static struct socket *
+proxy_peer(struct socket_server *ss, struct socket *s) {
+	if (s->proxy < 0)
+		return NULL;
+	struct socket *p = get_socket(ss, s->proxy);
+	if (p->id != s->proxy || p->proxy != s->id || p->type != SOCKET_TYPE_CONNECTED)
+		return NULL;
+	return p;
+}
+
+// @socket线程，代理模式下一次最多读多少，读到的数据放到对端以后，对端的发送缓存不超过 proxy_limit 的一半
+static int
+proxy_readsize(struct socket_server *ss, struct socket *s, int sz) {
+	struct socket *p = proxy_peer(ss, s);
+	if (p) {
+		int64_t room = proxy_limit(p) / 2 - send_size(p);
+		if (room < sz) {
+			sz = room > MIN_READ_BUFFER ? (int)room : MIN_READ_BUFFER;
+		}
+	}
+	return sz;
+}
+
+// @socket线程，s 读到的数据放到对端的发送队列以后调用
+static inline void
+proxy_pause(struct socket_server *ss, struct socket *s) {
+	struct socket *p = proxy_peer(ss, s);
+	if (p && send_size(p) >= proxy_limit(p) / 2) {
+		enable_read(ss, s, false);
+	}
+}
+
+// @socket线程，p 发送了缓存中的数据以后调用，恢复读对端
+static inline void
+proxy_resume(struct socket_server *ss, struct socket *p) {
+	struct socket *s = proxy_peer(ss, p);
+	if (s && !s->reading && send_size(p) < proxy_limit(p) / 4) {
+		enable_read(ss, s, true);
+	}
+}
+
+// @socket线程，代理模式下一方关闭的时候对端也关闭：对端发送缓存中的数据发送完以后关闭 (SOCKET_TYPE_HALFCLOSE)，
+// 再给服务报告 SOCKET_CLOSE 。发送缓存为空的时候，可写事件马上就会到来，在 send_buffer 中关闭
+static void
+close_proxy(struct socket_server *ss, struct socket *s) {
+	struct socket *p = proxy_peer(ss, s);
+	s->proxy = -1;
+	if (p == NULL)
+		return;
+	p->proxy = -1;
+	p->type = SOCKET_TYPE_HALFCLOSE;
+	enable_write(ss, p, true);
+}
+
 // @socket线程，清空套接字结构体对应的相关信息，并且把套接字从epoll中删除监听
 // 设置套接字类型为 SOCKET_TYPE_INVALID
 static void
@@ -447,22 +783,36 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 		return;
 	}
 	assert(s->type != SOCKET_TYPE_RESERVE);
+	if (s->proxy >= 0) {
+		close_proxy(ss, s);
+	}
 	free_wb_list(ss,&s->high);
 	free_wb_list(ss,&s->low);
 	if (s->type != SOCKET_TYPE_PACCEPT && s->type != SOCKET_TYPE_PLISTEN) {
 		sp_del(ss->event_fd, s->fd);
 	}
 	socket_lock(l);
+#ifdef SKYNET_TLS
+	if (s->ssl) {
+		if (s->tls_state != TLS_HANDSHAKE) {
+			// 只发送一次 close_notify，不等待对方回应
+			SSL_shutdown(s->ssl);
+		}
+		SSL_free(s->ssl);
+		s->ssl = NULL;
+	}
+#endif
 	if (s->type != SOCKET_TYPE_BIND) {
 		if (close(s->fd) < 0) {
 			perror("close socket:");
 		}
 	}
-	s->type = SOCKET_TYPE_INVALID;
-	if (s->dw_buffer) {
-		free_buffer(ss, s->dw_buffer, s->dw_size);
-		s->dw_buffer = NULL;
-	}
+	free_wb_list(ss,&s->dw);
+	s->dw_size = 0;
+	s->dw_n = 0;
+	FREE(s->frame_buffer);
+	s->frame_buffer = NULL;
+	free_socket(ss, s);
 	socket_unlock(l);
 }
 
@@ -472,8 +822,8 @@ void
 socket_server_release(struct socket_server *ss) {
 	int i;
 	struct socket_message dummy;
-	for (i=0;i<MAX_SOCKET;i++) {
-		struct socket *s = &ss->slot[i];
+	for (i=0;i<ss->slot_n;i++) {
+		struct socket *s = get_socket(ss, i);
 		struct socket_lock l;
 		socket_lock_init(s, &l);
 		if (s->type != SOCKET_TYPE_RESERVE) {
@@ -481,9 +831,31 @@ socket_server_release(struct socket_server *ss) {
 		}
 		spinlock_destroy(&s->dw_lock);
 	}
+	for (i=0;i<ss->slot_n;i+=(1 << ss->segment_p)) {
+		FREE(ss->slot[i >> ss->segment_p]);
+	}
+	FREE(ss->slot);
+#ifdef SKYNET_TLS
+	for (i=0;i<ss->tls_n;i++) {
+		struct tls_context *tc = &ss->tls_ctx[i];
+		SSL_CTX_free(tc->ctx);
+		FREE(tc->cert);
+		FREE(tc->key);
+		FREE(tc->ca);
+	}
+	for (i=0;i<TLS_SESSION_CACHE;i++) {
+		if (ss->tls_session[i].session)
+			SSL_SESSION_free(ss->tls_session[i].session);
+	}
+#endif
+	spinlock_destroy(&ss->tls_lock);
+	spinlock_destroy(&ss->free_lock);
+	spinlock_destroy(&ss->invalid.dw_lock);
 	close(ss->sendctrl_fd);
 	close(ss->recvctrl_fd);
 	sp_release(ss->event_fd);
+	FREE(ss->udpbatch);
+	FREE(ss->throttle);
 	FREE(ss);
 }
 
@@ -497,42 +869,275 @@ check_wb_list(struct wb_list *s) {
 // 根据参数add的值，确定是否把套接字加入到epoll监听读事件中
 static struct socket *
 new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque, bool add) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	assert(s->type == SOCKET_TYPE_RESERVE);
 
 	if (add) {
 		if (sp_add(ss->event_fd, fd, s)) {
-			s->type = SOCKET_TYPE_INVALID;
+			// the caller should free the socket
 			return NULL;
 		}
 	}
 
 	s->id = id;
 	s->fd = fd;
-	s->sending = ID_TAG16(id) << 16 | 0;
+	spinlock_lock(&ss->free_lock);
+	int index = HASH_ID(ss, id);
+	s->active = true;
+	s->active_prev = -1;
+	s->active_next = ss->active_head;
+	if (ss->active_head >= 0) {
+		get_socket(ss, ss->active_head)->active_prev = index;
+	}
+	ss->active_head = index;
+	++ss->active_n;
+	spinlock_unlock(&ss->free_lock);
+	s->sending = ID_TAG16(ss, id) << 16 | 0;
 	s->protocol = protocol;
 	s->p.size = MIN_READ_BUFFER;
 	s->opaque = opaque;
 	s->wb_size = 0;
+	s->wb_n = 0;
+	s->dw_size = 0;
+	s->dw_n = 0;
 	s->warn_size = 0;
 	check_wb_list(&s->high);
 	check_wb_list(&s->low);
-	s->dw_buffer = NULL;
-	s->dw_size = 0;
+	check_wb_list(&s->dw);
+	s->proxy = -1;
+	s->reading = true;
+	s->writing = false;
+	s->udppending = false;
+	s->frame_header = 0;
+	s->frame_max = 0;
+	s->frame_buffer = NULL;
+	s->frame_size = 0;
+	s->frame_cap = 0;
+	s->hwm = 0;
+	s->hwm_policy = SOCKET_HWM_DROP;
+	s->hwm_paused = false;
+	s->throttled = false;
+	s->ratelimit = false;
+	s->highwater = false;
+	s->rate = 0;
+	s->tokens = 0;
+	s->token_time = 0;
+	s->tls = -1;
+	s->tls_state = TLS_NONE;
+#ifdef SKYNET_TLS
+	s->ssl = NULL;
+#endif
 	memset(&s->stat, 0, sizeof(s->stat));
 	return s;
 }
 
+static inline uint64_t
+now_usec(void) {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (uint64_t)ti.tv_sec * 1000000 + ti.tv_nsec / 1000;
+}
+
+// 直方图的第 i 格统计 [2^i, 2^(i+1)) 的值，0 也算在第 0 格，超出的算在最后一格
 static inline void
-stat_read(struct socket_server *ss, struct socket *s, int n) {
+hist_add(uint64_t hist[SOCKET_HISTOGRAM], uint64_t v) {
+	int i = v > 1 ? 63 - __builtin_clzll(v) : 0;
+	if (i >= SOCKET_HISTOGRAM)
+		i = SOCKET_HISTOGRAM - 1;
+	++hist[i];
+}
+
+// 读到一个数据包，recvmmsg 一次调用读到多个包的时候，每个包调用一次
+static inline void
+stat_rpacket(struct socket_server *ss, struct socket *s, int n) {
 	s->stat.read += n;
 	s->stat.rtime = ss->time;
+	++s->stat.rpacket;
+	hist_add(ss->hist.rsize, n);
+}
+
+static inline void
+stat_read(struct socket_server *ss, struct socket *s, int n) {
+	stat_rpacket(ss, s, n);
+	++s->stat.rcall;
+}
+
+static inline void
+stat_accept(struct socket_server *ss, struct socket *s) {
+	s->stat.read++;
+	s->stat.rtime = ss->time;
 }
 
 static inline void
 stat_write(struct socket_server *ss, struct socket *s, int n) {
 	s->stat.write += n;
 	s->stat.wtime = ss->time;
+	++s->stat.wcall;
+}
+
+// 读写系统调用遇到了 EAGAIN
+static inline void
+stat_rblock(struct socket *s) {
+	++s->stat.rcall;
+	++s->stat.eagain;
+}
+
+static inline void
+stat_wblock(struct socket *s) {
+	++s->stat.wcall;
+	++s->stat.eagain;
+}
+
+// @socket线程，数据加入发送队列
+static inline void
+stat_queue(struct socket *s, struct write_buffer *buf) {
+	s->wb_size += buf->sz;
+	++s->wb_n;
+	if (s->wb_size > s->stat.wb_max)
+		s->stat.wb_max = s->wb_size;
+}
+
+// @socket线程，发送队列中的节点完整发送出去了，统计从加入队列到发送完成的延迟
+static inline void
+stat_sent(struct socket_server *ss, struct socket *s, struct write_buffer *buf) {
+	--s->wb_n;
+	++s->stat.wpacket;
+	hist_add(ss->hist.wlatency, now_usec() - buf->time);
+}
+
+#ifdef SKYNET_TLS
+
+static const char *
+tls_error(void) {
+	const char * err = ERR_reason_error_string(ERR_peek_last_error());
+	return err ? err : "tls error";
+}
+
+static int
+is_ipaddr(const char *host) {
+	struct in6_addr addr;
+	return inet_pton(AF_INET, host, &addr) == 1 || inet_pton(AF_INET6, host, &addr) == 1;
+}
+
+// 客户端 session 缓存的槽位，SSL 的 app data 中保存 (version * TLS_SESSION_CACHE + slot + 1)
+// 槽位被别的 host:port 占用以后 version 会变化，旧连接后来收到的 session 不会放错地方
+static int
+tls_new_session(SSL *ssl, SSL_SESSION *session) {
+	struct socket_server *ss = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+	uintptr_t key = (uintptr_t)SSL_get_app_data(ssl);
+	if (key == 0)
+		return 0;
+	--key;
+	struct tls_session *ts = &ss->tls_session[key % TLS_SESSION_CACHE];
+	if (ts->version != (unsigned)(key / TLS_SESSION_CACHE))
+		return 0;
+	if (ts->session)
+		SSL_SESSION_free(ts->session);
+	ts->session = session;
+	return 1;
+}
+
+static void
+tls_session_slot(struct socket_server *ss, SSL *ssl, int tls, const char *host, int port) {
+	size_t len = strlen(host);
+	if (len >= sizeof(ss->tls_session[0].host))
+		return;
+	uint32_t h = (uint32_t)(tls << 16 ^ port);
+	size_t i;
+	for (i=0;i<len;i++) {
+		h = h * 31 + (uint8_t)host[i];
+	}
+	int slot = h % TLS_SESSION_CACHE;
+	struct tls_session *ts = &ss->tls_session[slot];
+	if (ts->tls != tls || ts->port != port || strcmp(ts->host, host) != 0) {
+		if (ts->session) {
+			SSL_SESSION_free(ts->session);
+			ts->session = NULL;
+		}
+		memcpy(ts->host, host, len + 1);
+		ts->tls = tls;
+		ts->port = port;
+		ts->version = (ts->version + 1) & 0xffffff;
+	} else if (ts->session) {
+		SSL_set_session(ssl, ts->session);
+	}
+	SSL_set_app_data(ssl, (void *)(uintptr_t)(ts->version * TLS_SESSION_CACHE + slot + 1));
+}
+
+// @socket线程，给套接字创建 SSL 对象，host 为 NULL 表示服务端(accept)，否则是客户端(connect)
+static int
+tls_attach(struct socket_server *ss, struct socket *s, int tls, const char *host, int port) {
+	struct tls_context *tc = &ss->tls_ctx[tls];
+	SSL *ssl = SSL_new(tc->ctx);
+	if (ssl == NULL)
+		return -1;
+	SSL_set_fd(ssl, s->fd);
+	if (host == NULL) {
+		SSL_set_accept_state(ssl);
+	} else {
+		SSL_set_connect_state(ssl);
+		if (is_ipaddr(host)) {
+			if (tc->ca) {
+				X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host);
+			}
+		} else {
+			SSL_set_tlsext_host_name(ssl, host);
+			if (tc->ca) {
+				SSL_set1_host(ssl, host);
+			}
+		}
+		tls_session_slot(ss, ssl, tls, host, port);
+	}
+	s->ssl = ssl;
+	s->tls_state = TLS_HANDSHAKE;
+	return 0;
+}
+
+// 和 read 一样返回，握手中或者数据不够一个完整的 tls 记录时，errno 为 AGAIN_WOULDBLOCK
+static int
+tls_read(struct socket *s, char *buffer, int sz) {
+	ERR_clear_error();
+	int n = SSL_read(s->ssl, buffer, sz);
+	if (n > 0)
+		return n;
+	switch (SSL_get_error(s->ssl, n)) {
+	case SSL_ERROR_ZERO_RETURN:
+		return 0;
+	case SSL_ERROR_WANT_READ:
+	case SSL_ERROR_WANT_WRITE:
+		errno = AGAIN_WOULDBLOCK;
+		return -1;
+	case SSL_ERROR_SYSCALL:
+		if (errno == 0)
+			return 0;
+		return -1;
+	default:
+		errno = EPROTO;
+		return -1;
+	}
+}
+
+#endif
+
+// tls 记录中还有已经解密但没有读出的数据，这时候套接字上不一定还有可读事件
+static inline int
+tls_pending(struct socket *s) {
+#ifdef SKYNET_TLS
+	return s->ssl && SSL_pending(s->ssl) > 0;
+#else
+	return 0;
+#endif
+}
+
+// tls 是否是 socket_server_tls_context 返回的 context，server 表示要求是服务端的 context
+static inline int
+tls_valid(struct socket_server *ss, int tls, int server) {
+#ifdef SKYNET_TLS
+	return tls >= 0 && tls < ss->tls_n && ss->tls_ctx[tls].server == server;
+#else
+	(void)ss; (void)tls; (void)server;
+	return 0;
+#endif
 }
 
 // return -1 when connecting
@@ -592,8 +1197,20 @@ open_socket(struct socket_server *ss, struct request_open * request, struct sock
 		result->data = "reach skynet socket number limit";
 		goto _failed;
 	}
+#ifdef SKYNET_TLS
+	if (request->tls >= 0 && tls_attach(ss, ns, request->tls, request->host, request->port)) {
+		sp_del(ss->event_fd, sock);
+		close(sock);
+		result->data = (void *)tls_error();
+		goto _failed;
+	}
+#endif
 
-	if(status == 0) {
+	if (status == 0 && ns->tls_state != TLS_NONE) {
+		// tls 握手完成以后才报告 SOCKET_OPEN，见 socket_server_poll
+		ns->type = SOCKET_TYPE_CONNECTED;
+		enable_write(ss, ns, true);
+	} else if(status == 0) {
 		// 请求连接成功了
 		ns->type = SOCKET_TYPE_CONNECTED;
 		struct sockaddr * addr = ai_ptr->ai_addr;
@@ -607,53 +1224,258 @@ open_socket(struct socket_server *ss, struct request_open * request, struct sock
 	} else {
 		// 还没有连接成功，正在请求，监听套接字的写事件
 		ns->type = SOCKET_TYPE_CONNECTING;
-		sp_write(ss->event_fd, ns->fd, ns, true);
+		enable_write(ss, ns, true);
 	}
 
 	freeaddrinfo( ai_list );
 	return -1;
 _failed:
 	freeaddrinfo( ai_list );
-	ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+	free_socket(ss, get_socket(ss, id));
 	return SOCKET_ERR;
 }
 
+// @socket线程，令牌桶限速，返回现在最多还可以发送的字节数
+// 令牌按照 ss->time (厘秒) 补充，最多积攒 1/10 秒的量
+static int64_t
+send_quota(struct socket_server *ss, struct socket *s) {
+	if (s->rate == 0)
+		return INT64_MAX;
+	uint64_t now = ss->time;
+	if (now != s->token_time) {
+		int64_t burst = s->rate / 10 + 1;
+		s->tokens += (int64_t)(now - s->token_time) * s->rate / 100;
+		if (s->tokens > burst)
+			s->tokens = burst;
+		s->token_time = now;
+	}
+	return s->tokens;
+}
+
+// @socket线程，令牌用完了，暂停监听可写事件，等补充了令牌以后在check_throttle中恢复
+static void
+throttle_socket(struct socket_server *ss, struct socket *s) {
+	enable_write(ss, s, false);
+	if (s->throttled)
+		return;
+	s->throttled = true;
+	if (ss->throttle_n >= ss->throttle_cap) {
+		ss->throttle_cap = ss->throttle_cap == 0 ? 16 : ss->throttle_cap * 2;
+		ss->throttle = skynet_realloc(ss->throttle, ss->throttle_cap * sizeof(int));
+	}
+	ss->throttle[ss->throttle_n++] = s->id;
+}
+
+// @socket线程，在epoll_wait之前调用，有了令牌的套接字重新监听可写事件
+static void
+check_throttle(struct socket_server *ss) {
+	int i = 0;
+	while (i < ss->throttle_n) {
+		int id = ss->throttle[i];
+		struct socket *s = get_socket(ss, id);
+		if (s->id == id && s->type != SOCKET_TYPE_INVALID && s->throttled) {
+			if (send_quota(ss, s) <= 0) {
+				++i;
+				continue;
+			}
+			s->throttled = false;
+			enable_write(ss, s, true);
+		}
+		ss->throttle[i] = ss->throttle[--ss->throttle_n];
+	}
+}
+
+// @socket线程，发送list头节点中文件的数据，linux下用sendfile，数据不用经过用户空间
+// 返回0表示这个节点发送完了，-1表示套接字暂时不可写，或者返回SOCKET_CLOSE
+static int
+send_file_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
+	struct write_buffer * tmp = list->head;
+	struct sendfile_object *sf = tmp->buffer;
+	while (tmp->sz > 0) {
+		int64_t quota = send_quota(ss, s);
+		if (quota <= 0) {
+			throttle_socket(ss, s);
+			return -1;
+		}
+		size_t len = (int64_t)tmp->sz < quota ? tmp->sz : (size_t)quota;
+		off_t offset = (off_t)(sf->offset + (tmp->ptr - (char *)tmp->buffer));
+#ifdef __linux__
+		ssize_t sz = sendfile(s->fd, sf->fd, &offset, len);
+#else
+		int rsz = len < MAX_UDP_PACKAGE ? len : MAX_UDP_PACKAGE;
+		ssize_t sz = pread(sf->fd, ss->udpbuffer, rsz, offset);
+		if (sz > 0) {
+			sz = write(s->fd, ss->udpbuffer, sz);
+		}
+#endif
+		if (sz < 0) {
+			switch(errno) {
+			case EINTR:
+				continue;
+			case AGAIN_WOULDBLOCK:
+				stat_wblock(s);
+				return -1;
+			}
+			force_close(ss,s,l,result);
+			return SOCKET_CLOSE;
+		}
+		if (sz == 0) {
+			// the file is shorter than the request, the stream can't be completed
+			fprintf(stderr, "socket-server : sendfile (%d) reach end of file.\n", s->id);
+			force_close(ss,s,l,result);
+			return SOCKET_CLOSE;
+		}
+		stat_write(ss,s,(int)sz);
+		s->wb_size -= sz;
+		s->tokens -= sz;
+		tmp->ptr += sz;
+		tmp->sz -= sz;
+	}
+	list->head = tmp->next;
+	stat_sent(ss,s,tmp);
+	write_buffer_free(ss,tmp);
+	return 0;
+}
+
 // @socket线程，往网络写数据，把list中所有的数据发送成功为止，除非网络套接字暂时不可写了
+// 每次把list中最多MAX_SEND_IOVEC个节点组成iovec，调用一次writev发送出去，减少系统调用的次数
 static int
 send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
 	while (list->head) {
+		if (list->head->file) {
+			int r = send_file_tcp(ss, s, list, l, result);
+			if (r != 0)
+				return r;
+			continue;
+		}
+		int64_t quota = send_quota(ss, s);
+		if (quota <= 0) {
+			throttle_socket(ss, s);
+			return -1;
+		}
+		struct iovec iov[MAX_SEND_IOVEC];
 		struct write_buffer * tmp = list->head;
+		int n = 0;
+		size_t total = 0;
+		while (tmp && n < MAX_SEND_IOVEC && !tmp->file) {
+			iov[n].iov_base = tmp->ptr;
+			iov[n].iov_len = tmp->sz;
+			if ((int64_t)(total + tmp->sz) >= quota) {
+				// 限速，这次最多只发送 quota 字节
+				iov[n].iov_len = (size_t)(quota - total);
+				total = (size_t)quota;
+				++n;
+				break;
+			}
+			total += tmp->sz;
+			++n;
+			tmp = tmp->next;
+		}
+		ssize_t sz;
 		for (;;) {
-			ssize_t sz = write(s->fd, tmp->ptr, tmp->sz);
+			sz = writev(s->fd, iov, n);
 			if (sz < 0) {
 				switch(errno) {
 				case EINTR:
 					continue;
 				case AGAIN_WOULDBLOCK:
+					stat_wblock(s);
 					return -1;
 				}
 				force_close(ss,s,l,result);
 				return SOCKET_CLOSE;
 			}
-			stat_write(ss,s,(int)sz);
-			s->wb_size -= sz;
-			if (sz != tmp->sz) {
-				// 只发送部分出去，等待下一次发送吧
-				tmp->ptr += sz;
-				tmp->sz -= sz;
+			break;
+		}
+		stat_write(ss,s,(int)sz);
+		s->wb_size -= sz;
+		s->tokens -= sz;
+		// 释放已经完整发送出去的节点，最后一个只发送部分的节点，调整ptr和sz，等待下一次发送
+		size_t left = (size_t)sz;
+		while (list->head && !list->head->file && left >= (size_t)list->head->sz) {
+			tmp = list->head;
+			left -= tmp->sz;
+			list->head = tmp->next;
+			stat_sent(ss,s,tmp);
+			write_buffer_free(ss,tmp);
+		}
+		if (left > 0) {
+			// 最后一个节点只发送了一部分(可能是因为限速)
+			list->head->ptr += left;
+			list->head->sz -= left;
+		}
+		if ((size_t)sz != total) {
+			// 只发送部分出去，等待下一次发送吧
+			assert(list->head);
+			return -1;
+		}
+	}
+	list->tail = NULL;
+
+	return -1;
+}
+
+#ifdef SKYNET_TLS
+
+// @socket线程，用 SSL_write 发送list中的数据，每次一个节点，文件节点先读到 udpbuffer 中再加密发送
+// SSL_write 返回 WANT_* 以后必须用同样的数据重试，节点在发送成功之前不会改变
+static int
+send_list_tls(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
+	if (s->tls_state == TLS_HANDSHAKE)
+		return -1;
+	while (list->head) {
+		struct write_buffer * tmp = list->head;
+		int64_t quota = send_quota(ss, s);
+		if (quota <= 0) {
+			throttle_socket(ss, s);
+			return -1;
+		}
+		const void * ptr = tmp->ptr;
+		int len = tmp->sz < quota ? tmp->sz : (int)quota;
+		if (tmp->file) {
+			struct sendfile_object *sf = tmp->buffer;
+			off_t offset = (off_t)(sf->offset + (tmp->ptr - (char *)tmp->buffer));
+			if (len > MAX_UDP_PACKAGE)
+				len = MAX_UDP_PACKAGE;
+			ssize_t rsz = pread(sf->fd, ss->udpbuffer, len, offset);
+			if (rsz <= 0) {
+				fprintf(stderr, "socket-server : sendfile (%d) reach end of file.\n", s->id);
+				force_close(ss,s,l,result);
+				return SOCKET_CLOSE;
+			}
+			ptr = ss->udpbuffer;
+			len = (int)rsz;
+		}
+		ERR_clear_error();
+		int sz = SSL_write(s->ssl, ptr, len);
+		if (sz <= 0) {
+			switch (SSL_get_error(s->ssl, sz)) {
+			case SSL_ERROR_WANT_READ:
+			case SSL_ERROR_WANT_WRITE:
+				stat_wblock(s);
 				return -1;
 			}
-			break;
+			force_close(ss,s,l,result);
+			return SOCKET_CLOSE;
+		}
+		stat_write(ss,s,sz);
+		s->wb_size -= sz;
+		s->tokens -= sz;
+		tmp->ptr += sz;
+		tmp->sz -= sz;
+		if (tmp->sz == 0) {
+			list->head = tmp->next;
+			stat_sent(ss,s,tmp);
+			write_buffer_free(ss,tmp);
 		}
-		// 继续发送下一个节点和释放前一个发送buff数据内存和节点内存
-		list->head = tmp->next;
-		write_buffer_free(ss,tmp);
 	}
 	list->tail = NULL;
 
 	return -1;
 }
 
+#endif
+
 static socklen_t
 udp_socket_address(struct socket *s, const uint8_t udp_address[UDP_ADDRESS_SIZE], union sockaddr_all *sa) {
 	int type = (uint8_t)udp_address[0];
@@ -681,12 +1503,82 @@ udp_socket_address(struct socket *s, const uint8_t udp_address[UDP_ADDRESS_SIZE]
 static void
 drop_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct write_buffer *tmp) {
 	s->wb_size -= tmp->sz;
+	--s->wb_n;
 	list->head = tmp->next;
 	if (list->head == NULL)
 		list->tail = NULL;
 	write_buffer_free(ss,tmp);
 }
 
+#ifdef __linux__
+
+// @socket线程，用sendmmsg一次系统调用发送list中多个udp包，每次最多MAX_SEND_IOVEC个
+static int
+send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
+	while (list->head) {
+		struct mmsghdr msg[MAX_SEND_IOVEC];
+		struct iovec iov[MAX_SEND_IOVEC];
+		union sockaddr_all sa[MAX_SEND_IOVEC];
+		struct write_buffer * tmp = list->head;
+		int n = 0;
+		while (tmp && n < MAX_SEND_IOVEC) {
+			socklen_t sasz = udp_socket_address(s, tmp->udp_address, &sa[n]);
+			if (sasz == 0) {
+				if (n > 0) {
+					// send the packages before it first
+					break;
+				}
+				fprintf(stderr, "socket-server : udp (%d) type mismatch.\n", s->id);
+				drop_udp(ss, s, list, tmp);
+				return -1;
+			}
+			iov[n].iov_base = tmp->ptr;
+			iov[n].iov_len = tmp->sz;
+			memset(&msg[n], 0, sizeof(msg[n]));
+			msg[n].msg_hdr.msg_name = &sa[n].s;
+			msg[n].msg_hdr.msg_namelen = sasz;
+			msg[n].msg_hdr.msg_iov = &iov[n];
+			msg[n].msg_hdr.msg_iovlen = 1;
+			++n;
+			tmp = tmp->next;
+		}
+		int m = sendmmsg(s->fd, msg, n, 0);
+		if (m < 0) {
+			switch(errno) {
+			case AGAIN_WOULDBLOCK:
+				stat_wblock(s);
+				return -1;
+			case EINTR:
+				return -1;
+			}
+			fprintf(stderr, "socket-server : udp (%d) sendto error %s.\n",s->id, strerror(errno));
+			drop_udp(ss, s, list, list->head);
+			return -1;
+		}
+		int i;
+		size_t sz = 0;
+		for (i=0;i<m;i++) {
+			tmp = list->head;
+			sz += tmp->sz;
+			s->wb_size -= tmp->sz;
+			list->head = tmp->next;
+			stat_sent(ss,s,tmp);
+			write_buffer_free(ss,tmp);
+		}
+		// 一次系统调用只算一次 wcall ，包数在 stat_sent 里统计
+		stat_write(ss,s,(int)sz);
+		if (m < n) {
+			// 剩余的包等待下一次可写的时候再发送
+			return -1;
+		}
+	}
+	list->tail = NULL;
+
+	return -1;
+}
+
+#else
+
 static int
 send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
 	while (list->head) {
@@ -701,8 +1593,10 @@ send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 		int err = sendto(s->fd, tmp->ptr, tmp->sz, 0, &sa.s, sasz);
 		if (err < 0) {
 			switch(errno) {
-			case EINTR:
 			case AGAIN_WOULDBLOCK:
+				stat_wblock(s);
+				return -1;
+			case EINTR:
 				return -1;
 			}
 			fprintf(stderr, "socket-server : udp (%d) sendto error %s.\n",s->id, strerror(errno));
@@ -712,6 +1606,7 @@ send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 		stat_write(ss,s,tmp->sz);
 		s->wb_size -= tmp->sz;
 		list->head = tmp->next;
+		stat_sent(ss,s,tmp);
 		write_buffer_free(ss,tmp);
 	}
 	list->tail = NULL;
@@ -719,9 +1614,15 @@ send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 	return -1;
 }
 
+#endif
+
 static int
 send_list(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
 	if (s->protocol == PROTOCOL_TCP) {
+#ifdef SKYNET_TLS
+		if (s->ssl)
+			return send_list_tls(ss, s, list, l, result);
+#endif
 		return send_list_tcp(ss, s, list, l, result);
 	} else {
 		return send_list_udp(ss, s, list, result);
@@ -799,15 +1700,17 @@ send_buffer_(struct socket_server *ss, struct socket *s, struct socket_lock *l,
 		// step 4
 		// 如果 low 和 high中的数据都发送完成了，则不监听fd是否可写了
 		assert(send_buffer_empty(s) && s->wb_size == 0);
-		sp_write(ss->event_fd, s->fd, s, false);			
+		enable_write(ss, s, false);			
 
 		// close_socket 的时候，可能数据分多次才发送完成，因此这个地方需要处理，执行force_close
 		if (s->type == SOCKET_TYPE_HALFCLOSE) {
 				force_close(ss, s, l, result);
 				return SOCKET_CLOSE;
 		}
-		if(s->warn_size > 0){
+		// 发送缓存清空了，通知服务可以恢复发送 (SOCKET_HWM_PAUSE)
+		if(s->warn_size > 0 || s->hwm_paused){
 				s->warn_size = 0;
+				s->hwm_paused = false;
 				result->opaque = s->opaque;
 				result->id = s->id;
 				result->ud = 0;
@@ -825,27 +1728,28 @@ send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 	if (!socket_trylock(l))
 		return -1;	// blocked by direct write, send later.
 
-	// 把字段dw_buffer中的数据加入write buff的链表high中
-	if (s->dw_buffer) {
-		// add direct write buffer before high.head
-		struct write_buffer * buf = MALLOC(SIZEOF_TCPBUFFER);
-		struct send_object so;
-		buf->userobject = send_object_init(ss, &so, (void *)s->dw_buffer, s->dw_size);
-		buf->ptr = (char*)so.buffer+s->dw_offset;
-		buf->sz = so.sz - s->dw_offset;
-		buf->buffer = (void *)s->dw_buffer;
-		s->wb_size+=buf->sz;
+	// 把工作线程留下的dw链表中的数据加入write buff的链表high的最前面
+	if (s->dw.head) {
+		// add direct write buffers before high.head
+		struct write_buffer * buf = s->dw.head;
+		while (buf) {
+			stat_queue(s, buf);
+			buf = buf->next;
+		}
+		s->dw.tail->next = s->high.head;
 		if (s->high.head == NULL) {
-			s->high.head = s->high.tail = buf;
-			buf->next = NULL;
-		} else {
-			buf->next = s->high.head;
-			s->high.head = buf;
+			s->high.tail = s->dw.tail;
 		}
-		s->dw_buffer = NULL;
+		s->high.head = s->dw.head;
+		clear_wb_list(&s->dw);
+		s->dw_size = 0;
+		s->dw_n = 0;
 	}
 	int r = send_buffer_(ss,s,l,result);
 	socket_unlock(l);
+	if (s->proxy >= 0) {
+		proxy_resume(ss, s);
+	}
 
 	return r;
 }
@@ -856,9 +1760,11 @@ append_sendbuffer_(struct socket_server *ss, struct wb_list *s, struct request_s
 	struct write_buffer * buf = MALLOC(size);
 	struct send_object so;
 	buf->userobject = send_object_init(ss, &so, request->buffer, request->sz);
+	buf->file = false;
 	buf->ptr = (char*)so.buffer;
 	buf->sz = so.sz;
 	buf->buffer = request->buffer;
+	buf->time = now_usec();
 	buf->next = NULL;
 	if (s->head == NULL) {
 		s->head = s->tail = buf;
@@ -876,22 +1782,60 @@ append_sendbuffer_udp(struct socket_server *ss, struct socket *s, int priority,
 	struct wb_list *wl = (priority == PRIORITY_HIGH) ? &s->high : &s->low;
 	struct write_buffer *buf = append_sendbuffer_(ss, wl, request, SIZEOF_UDPBUFFER);
 	memcpy(buf->udp_address, udp_address, UDP_ADDRESS_SIZE);
-	s->wb_size += buf->sz;
+	stat_queue(s, buf);
 }
 
 // @socket线程 把数据加入high list中
 static inline void
 append_sendbuffer(struct socket_server *ss, struct socket *s, struct request_send * request) {
 	struct write_buffer *buf = append_sendbuffer_(ss, &s->high, request, SIZEOF_TCPBUFFER);
-	s->wb_size += buf->sz;
+	stat_queue(s, buf);
 }
 
 static inline void
 append_sendbuffer_low(struct socket_server *ss,struct socket *s, struct request_send * request) {
 	struct write_buffer *buf = append_sendbuffer_(ss, &s->low, request, SIZEOF_TCPBUFFER);
-	s->wb_size += buf->sz;
+	stat_queue(s, buf);
+}
+
+
+#ifdef __linux__
+
+// @socket线程，把udp_pending数组中所有套接字的发送队列，用sendmmsg发送出去
+// 没有发送完的，监听可写事件，等待下次发送
+static void
+flush_udp_pending(struct socket_server *ss) {
+	int i;
+	for (i=0;i<ss->udp_pending_n;i++) {
+		int id = ss->udp_pending[i];
+		struct socket *s = get_socket(ss, id);
+		if (s->id != id || s->type != SOCKET_TYPE_CONNECTED || !s->udppending)
+			continue;
+		s->udppending = false;
+		struct socket_message dummy;
+		send_list_udp(ss, s, &s->high, &dummy);
+		if (s->high.head == NULL) {
+			send_list_udp(ss, s, &s->low, &dummy);
+		}
+		if (!send_buffer_empty(s)) {
+			enable_write(ss, s, true);
+		}
+	}
+	ss->udp_pending_n = 0;
 }
 
+static void
+add_udp_pending(struct socket_server *ss, struct socket *s) {
+	if (s->udppending)
+		return;
+	if (ss->udp_pending_n >= MAX_UDP_PENDING) {
+		flush_udp_pending(ss);
+	}
+	s->udppending = true;
+	ss->udp_pending[ss->udp_pending_n++] = s->id;
+}
+
+#endif
 
 /*
 	When send a package , we can assign the priority : PRIORITY_HIGH or PRIORITY_LOW
@@ -904,7 +1848,7 @@ append_sendbuffer_low(struct socket_server *ss,struct socket *s, struct request_
 static int
 send_socket(struct socket_server *ss, struct request_send * request, struct socket_message *result, int priority, const uint8_t *udp_address) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	struct send_object so;
 	send_object_init(ss, &so, request->buffer, request->sz);
 	if (s->type == SOCKET_TYPE_INVALID || s->id != id 
@@ -918,6 +1862,21 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 		so.free_func(request->buffer);
 		return -1;
 	}
+	if (s->hwm > 0 && !send_buffer_empty(s) && send_size(s) + so.sz > s->hwm) {
+		// 超过高水位
+		if (s->hwm_policy == SOCKET_HWM_DROP && priority == PRIORITY_LOW) {
+			so.free_func(request->buffer);
+			return -1;
+		}
+		if (s->hwm_policy == SOCKET_HWM_CLOSE) {
+			so.free_func(request->buffer);
+			struct socket_lock l;
+			socket_lock_init(s, &l);
+			force_close(ss, s, &l, result);
+			result->data = "send buffer overflow";
+			return SOCKET_ERR;
+		}
+	}
 	if (send_buffer_empty(s) && s->type == SOCKET_TYPE_CONNECTED) {
 		if (s->protocol == PROTOCOL_TCP) {
 			append_sendbuffer(ss, s, request);	// add to high priority list, even priority == PRIORITY_LOW
@@ -934,18 +1893,26 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 				so.free_func(request->buffer);
 				return -1;
 			}
+#ifdef __linux__
+			// 先放到发送队列，等socket线程处理完所有的请求后，在flush_udp_pending中用sendmmsg一起发送
+			append_sendbuffer_udp(ss,s,priority,request,udp_address);
+			add_udp_pending(ss, s);
+			return -1;
+#else
 			// 直接发送，如果没有发送成功，则放到buff中去发送
 			int n = sendto(s->fd, so.buffer, so.sz, 0, &sa.s, sasz);
 			if (n != so.sz) {
 				append_sendbuffer_udp(ss,s,priority,request,udp_address);
 			} else {
 				stat_write(ss,s,n);
+				++s->stat.wpacket;
 				so.free_func(request->buffer);
 				return -1;
 			}
+#endif
 		}
 		// 有数据要写，把fd加入到epoll可写监听事件中
-		sp_write(ss->event_fd, s->fd, s, true);
+		enable_write(ss, s, true);
 	} else {
 		if (s->protocol == PROTOCOL_TCP) {
 			if (priority == PRIORITY_LOW) {
@@ -960,19 +1927,111 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 			append_sendbuffer_udp(ss,s,priority,request,udp_address);
 		}
 
-		// 不为空，表示fd的写事件正在被监听中，则不需要调用sp_write
+		// 不为空，表示fd的写事件正在被监听中，则不需要调用enable_write
 	}
-	if (s->wb_size >= WARNING_SIZE && s->wb_size >= s->warn_size) {
+	if (s->hwm > 0 && s->hwm_policy == SOCKET_HWM_PAUSE && !s->hwm_paused && send_size(s) >= s->hwm) {
+		// 通知服务暂停发送，发送缓存清空的时候会再收到 ud 为 0 的 SOCKET_WARNING
+		s->hwm_paused = true;
+		result->opaque = s->opaque;
+		result->id = s->id;
+		result->ud = (send_size(s) + 1023) / 1024;
+		result->data = NULL;
+		return SOCKET_WARNING;
+	}
+	if (send_size(s) >= WARNING_SIZE && send_size(s) >= s->warn_size) {
 		s->warn_size = s->warn_size == 0 ? WARNING_SIZE *2 : s->warn_size*2;
 		result->opaque = s->opaque;
 		result->id = s->id;
-		result->ud = s->wb_size%1024 == 0 ? s->wb_size/1024 : s->wb_size/1024 + 1;
+		result->ud = (send_size(s) + 1023) / 1024;
 		result->data = NULL;
 		return SOCKET_WARNING;
 	}
 	return -1;
 }
 
+// @socket 线程，响应处理来自worker线程的请求 'F'
+// 把文件的一段数据加入high list，等待套接字可写的时候用sendfile发送，fd由socket线程负责关闭
+static int
+sendfile_socket(struct socket_server *ss, struct request_sendfile * request, struct socket_message *result) {
+	int id = request->id;
+	struct socket * s = get_socket(ss, id);
+	if (s->type == SOCKET_TYPE_INVALID || s->id != id
+		|| s->type == SOCKET_TYPE_HALFCLOSE
+		|| s->type == SOCKET_TYPE_PACCEPT
+		|| s->type == SOCKET_TYPE_PLISTEN
+		|| s->type == SOCKET_TYPE_LISTEN
+		|| s->protocol != PROTOCOL_TCP) {
+		close(request->fd);
+		return -1;
+	}
+	struct sendfile_object * sf = MALLOC(sizeof(*sf));
+	sf->fd = request->fd;
+	sf->offset = request->offset;
+	struct write_buffer * buf = MALLOC(SIZEOF_TCPBUFFER);
+	buf->buffer = sf;
+	buf->ptr = (char *)sf;
+	buf->sz = request->size;
+	buf->userobject = false;
+	buf->file = true;
+	buf->time = now_usec();
+	buf->next = NULL;
+	bool empty = send_buffer_empty(s);
+	struct wb_list *list = &s->high;
+	if (list->head == NULL) {
+		list->head = list->tail = buf;
+	} else {
+		list->tail->next = buf;
+		list->tail = buf;
+	}
+	if (empty && s->type == SOCKET_TYPE_CONNECTED) {
+		enable_write(ss, s, true);
+	}
+	stat_queue(s, buf);
+	return -1;
+}
+
+// @socket 线程，响应处理来自worker线程的请求 'R'
+// 两个套接字互为代理，从一方读到的数据直接在socket线程中放到另一方的发送队列，不再转发给服务
+// id 可以是还没有start的新连接(SOCKET_TYPE_PACCEPT)，这时候同时开始读数据，不会有数据先发给服务
+static int
+proxy_socket(struct socket_server *ss, struct request_proxy * request, struct socket_message *result) {
+	struct socket * s = get_socket(ss, request->id);
+	struct socket * p = get_socket(ss, request->peer);
+	result->opaque = request->opaque;
+	result->id = request->id;
+	result->ud = 0;
+	result->data = NULL;
+	if (s->id != request->id || (s->type != SOCKET_TYPE_CONNECTED && s->type != SOCKET_TYPE_PACCEPT)
+		|| s->protocol != PROTOCOL_TCP
+		|| p->id != request->peer || p->type != SOCKET_TYPE_CONNECTED || p->protocol != PROTOCOL_TCP
+		|| s == p) {
+		result->data = "invalid proxy socket";
+		return SOCKET_ERR;
+	}
+	if (s->type == SOCKET_TYPE_PACCEPT) {
+		if (sp_add(ss->event_fd, s->fd, s)) {
+			struct socket_lock l;
+			socket_lock_init(s, &l);
+			force_close(ss, s, &l, result);
+			result->data = strerror(errno);
+			return SOCKET_ERR;
+		}
+		s->type = SOCKET_TYPE_CONNECTED;
+		s->opaque = request->opaque;
+	}
+	// worker线程在持有锁的时候检查 proxy (can_direct_write)，这以后不会再直接写这两个套接字，也不会修改它们监听的事件
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	socket_lock(&l);
+	s->proxy = request->peer;
+	socket_unlock(&l);
+	socket_lock_init(p, &l);
+	socket_lock(&l);
+	p->proxy = request->id;
+	socket_unlock(&l);
+	return -1;
+}
+
 // @socket线程，处理worker线程的请求 'L'
 // 主要工作是调用接口new_fd初始化套接字对应的结构体socket信息，这里不会把套接字加入到epoll监听事件中
 // 套接字状态从 SOCKET_TYPE_RESERVE --> SOCKET_TYPE_PLISTEN
@@ -985,6 +2044,7 @@ listen_socket(struct socket_server *ss, struct request_listen * request, struct
 		goto _failed;
 	}
 	s->type = SOCKET_TYPE_PLISTEN;
+	s->tls = request->tls;
 	return -1;
 _failed:
 	close(listen_fd);
@@ -992,7 +2052,7 @@ _failed:
 	result->id = id;
 	result->ud = 0;
 	result->data = "reach skynet socket number limit";
-	ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+	free_socket(ss, get_socket(ss, id));
 
 	return SOCKET_ERR;
 }
@@ -1001,7 +2061,7 @@ _failed:
 static inline int
 nomore_sending_data(struct socket *s) {
 	// (s->sending & 0xffff) == 0 表示socket线程没有在发送数据，并且没有请求在发送
-	return send_buffer_empty(s) && s->dw_buffer == NULL && (s->sending & 0xffff) == 0;
+	return send_buffer_empty(s) && s->dw.head == NULL && (s->sending & 0xffff) == 0;
 }
 
 // @socket线程，响应处理来自worker线程的请求 'K'
@@ -1010,7 +2070,7 @@ nomore_sending_data(struct socket *s) {
 static int
 close_socket(struct socket_server *ss, struct request_close *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (s->type == SOCKET_TYPE_INVALID || s->id != id) {
 		result->id = id;
 		result->opaque = request->opaque;
@@ -1048,6 +2108,7 @@ bind_socket(struct socket_server *ss, struct request_bind *request, struct socke
 	result->ud = 0;
 	struct socket *s = new_fd(ss, id, request->fd, PROTOCOL_TCP, request->opaque, true);
 	if (s == NULL) {
+		free_socket(ss, get_socket(ss, id));
 		result->data = "reach skynet socket number limit";
 		return SOCKET_ERR;
 	}
@@ -1068,7 +2129,7 @@ start_socket(struct socket_server *ss, struct request_start *request, struct soc
 	result->opaque = request->opaque;
 	result->ud = 0;
 	result->data = NULL;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = get_socket(ss, id);
 	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
 		result->data = "invalid socket";
 		return SOCKET_ERR;
@@ -1094,21 +2155,76 @@ start_socket(struct socket_server *ss, struct request_start *request, struct soc
 		result->data = "transfer";
 		return SOCKET_OPEN;
 	}
-	// if s->type == SOCKET_TYPE_HALFCLOSE , SOCKET_CLOSE message will send later
-	return -1;
+	// if s->type == SOCKET_TYPE_HALFCLOSE , SOCKET_CLOSE message will send later
+	return -1;
+}
+
+// @socket线程，响应处理来自worker线程的请求 'T' 
+// 设置套接字选项
+static void
+setopt_socket(struct socket_server *ss, struct request_setopt *request) {
+	int id = request->id;
+	struct socket *s = get_socket(ss, id);
+	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
+		return;
+	}
+	int v = request->value;
+	setsockopt(s->fd, IPPROTO_TCP, request->what, &v, sizeof(v));
+}
+
+// @socket线程，响应处理来自worker线程的请求 'H'
+// 设置套接字的分帧模式，之后从套接字读到的数据，只有凑成完整的包才上报
+// 取消分帧模式的时候，如果还有不完整的包，作为 SOCKET_DATA 上报
+static int
+framing_socket(struct socket_server *ss, struct request_framing *request, struct socket_message *result) {
+	int id = request->id;
+	struct socket *s = get_socket(ss, id);
+	if (s->type == SOCKET_TYPE_INVALID || s->id !=id || s->protocol != PROTOCOL_TCP) {
+		return -1;
+	}
+	if (request->header == 2 || request->header == 4) {
+		s->frame_header = request->header;
+		s->frame_max = request->max > 0 ? request->max : INT_MAX;
+		return -1;
+	}
+	s->frame_header = 0;
+	s->frame_max = 0;
+	if (s->frame_size == 0) {
+		return -1;
+	}
+	result->opaque = s->opaque;
+	result->id = id;
+	result->ud = s->frame_size;
+	result->data = s->frame_buffer;
+	s->frame_buffer = NULL;
+	s->frame_size = 0;
+	s->frame_cap = 0;
+	return SOCKET_DATA;
 }
 
-// @socket线程，响应处理来自worker线程的请求 'T' 
-// 设置套接字选项
+// @socket线程，响应处理来自worker线程的请求 'M'
+// 设置发送缓存的高水位策略和限速
 static void
-setopt_socket(struct socket_server *ss, struct request_setopt *request) {
+limit_socket(struct socket_server *ss, struct request_limit *request) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = get_socket(ss, id);
 	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
 		return;
 	}
-	int v = request->value;
-	setsockopt(s->fd, IPPROTO_TCP, request->what, &v, sizeof(v));
+	s->hwm = request->hwm > 0 ? request->hwm : 0;
+	s->hwm_policy = request->policy;
+	s->ratelimit = request->rate > 0;
+	s->highwater = s->hwm > 0;
+	if (request->rate > 0) {
+		if (s->rate == 0) {
+			s->tokens = request->rate / 10 + 1;
+			s->token_time = ss->time;
+		}
+		s->rate = request->rate;
+	} else {
+		// 如果正在限速中，check_throttle 中会恢复可写事件
+		s->rate = 0;
+	}
 }
 
 // @socket 线程 从管道里面读取所有的命令行数据
@@ -1161,7 +2277,7 @@ add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 	struct socket *ns = new_fd(ss, id, udp->fd, protocol, udp->opaque, true);
 	if (ns == NULL) {
 		close(udp->fd);
-		ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+		free_socket(ss, get_socket(ss, id));
 		return;
 	}
 	ns->type = SOCKET_TYPE_CONNECTED;
@@ -1172,7 +2288,7 @@ add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 static int
 set_udp_address(struct socket_server *ss, struct request_setudp *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = get_socket(ss, id);
 	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
 		return -1;
 	}
@@ -1197,12 +2313,12 @@ set_udp_address(struct socket_server *ss, struct request_setudp *request, struct
 
 // @worker线程，每请求socket线程发送数据，调用接口一次
 static inline void
-inc_sending_ref(struct socket *s, int id) {
+inc_sending_ref(struct socket_server *ss, struct socket *s, int id) {
 	if (s->protocol != PROTOCOL_TCP)
 		return;
 	for (;;) {
 		uint32_t sending = s->sending;
-		if ((sending >> 16) == ID_TAG16(id)) {
+		if ((sending >> 16) == ID_TAG16(ss, id)) {
 			if ((sending & 0xffff) == 0xffff) {
 				// s->sending may overflow (rarely), so busy waiting here for socket thread dec it. see issue #794
 				continue;
@@ -1222,7 +2338,7 @@ inc_sending_ref(struct socket *s, int id) {
 // @socket线程，每处理一次，调用接口一次
 static inline void
 dec_sending_ref(struct socket_server *ss, int id) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	// Notice: udp may inc sending while type == SOCKET_TYPE_RESERVE
 	if (s->id == id && s->protocol == PROTOCOL_TCP) {
 		assert((s->sending & 0xffff) != 0);
@@ -1278,9 +2394,22 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	}
 	case 'C':
 		return set_udp_address(ss, (struct request_setudp *)buffer, result);
+	case 'F': {
+		struct request_sendfile * request = (struct request_sendfile *) buffer;
+		int ret = sendfile_socket(ss, request, result);
+		dec_sending_ref(ss, request->id);
+		return ret;
+	}
+	case 'R':
+		return proxy_socket(ss, (struct request_proxy *)buffer, result);
 	case 'T':
 		setopt_socket(ss, (struct request_setopt *)buffer);
 		return -1;
+	case 'H':
+		return framing_socket(ss, (struct request_framing *)buffer, result);
+	case 'M':
+		limit_socket(ss, (struct request_limit *)buffer);
+		return -1;
 	case 'U':
 		add_udp_socket(ss, (struct request_udp *)buffer);
 		return -1;
@@ -1294,18 +2423,100 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 
 // @socket线程 从套接字中读取数据，并把读取的数据放到result，然后给worker线程使用
 // return -1 (ignore) when error
+static inline int
+frame_size(const uint8_t *header, int header_size) {
+	if (header_size == 2) {
+		return header[0] << 8 | header[1];
+	}
+	return (int)((uint32_t)header[0] << 24 | header[1] << 16 | header[2] << 8 | header[3]);
+}
+
+// @socket线程，分帧模式下处理读到的数据
+// 上一次剩下的不完整的包和这次读到的数据拼在一起，把开头所有完整的包(包括包头)作为一个 SOCKET_DATA 上报，
+// 剩下不完整的部分保存在 frame_buffer 中。没有完整的包时返回-1
+static int
+frame_message(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result, char * buffer, int n) {
+	int hs = s->frame_header;
+	if (s->frame_size > 0) {
+		int sz = s->frame_size + n;
+		if (sz > s->frame_cap) {
+			int cap = s->frame_cap * 2;
+			if (cap < sz)
+				cap = sz;
+			if (s->frame_size >= hs) {
+				// 已经知道这个包的长度，一次分配足够的空间
+				int need = hs + frame_size((const uint8_t *)s->frame_buffer, hs);
+				if (cap < need)
+					cap = need;
+			}
+			s->frame_buffer = skynet_realloc(s->frame_buffer, cap);
+			s->frame_cap = cap;
+		}
+		memcpy(s->frame_buffer + s->frame_size, buffer, n);
+		FREE(buffer);
+		buffer = s->frame_buffer;
+		n = sz;
+		s->frame_buffer = NULL;
+		s->frame_size = 0;
+		s->frame_cap = 0;
+	}
+	int offset = 0;
+	while (offset + hs <= n) {
+		int size = frame_size((const uint8_t *)buffer + offset, hs);
+		if (size < 0 || size > s->frame_max) {
+			FREE(buffer);
+			force_close(ss, s, l, result);
+			result->data = "socket package too large";
+			return SOCKET_ERR;
+		}
+		if (n - offset - hs < size)
+			break;
+		offset += hs + size;
+	}
+	if (offset < n) {
+		// 保存剩下的不完整的包
+		if (offset == 0) {
+			s->frame_buffer = buffer;
+			s->frame_cap = n;
+			s->frame_size = n;
+			return -1;
+		}
+		s->frame_size = n - offset;
+		s->frame_cap = s->frame_size;
+		s->frame_buffer = MALLOC(s->frame_cap);
+		memcpy(s->frame_buffer, buffer + offset, s->frame_size);
+	}
+	result->opaque = s->opaque;
+	result->id = s->id;
+	result->ud = offset;
+	result->data = buffer;
+	return SOCKET_DATA;
+}
+
 static int
 forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
 	int sz = s->p.size;
+	if (s->proxy >= 0) {
+		sz = proxy_readsize(ss, s, sz);
+	}
 	char * buffer = MALLOC(sz);
-	int n = (int)read(s->fd, buffer, sz);
+	int n;
+#ifdef SKYNET_TLS
+	if (s->ssl) {
+		n = tls_read(s, buffer, sz);
+	} else
+#endif
+	n = (int)read(s->fd, buffer, sz);
 	if (n<0) {
 		FREE(buffer);
 		switch(errno) {
 		case EINTR:
 			break;
 		case AGAIN_WOULDBLOCK:
-			fprintf(stderr, "socket-server: EAGAIN capture.\n");
+			stat_rblock(s);
+			// tls 套接字可读，但是还没有收到完整的记录，是正常的
+			if (s->tls_state == TLS_NONE)
+				fprintf(stderr, "socket-server: EAGAIN capture.\n");
 			break;
 		default:
 			// close when error
@@ -1331,12 +2542,27 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lo
 	stat_read(ss,s,n);
 
 	// 动态调整每次从网络上最多读取的数据大小
-	if (n == sz) {
+	if (n == s->p.size) {
 		s->p.size *= 2;
 	} else if (sz > MIN_READ_BUFFER && n*2 < sz) {
 		s->p.size /= 2;
 	}
 
+	if (s->proxy >= 0) {
+		// 代理模式，数据直接放到对端的发送队列
+		struct request_send request;
+		request.id = s->proxy;
+		request.sz = n;
+		request.buffer = buffer;
+		int type = send_socket(ss, &request, result, PRIORITY_HIGH, NULL);
+		proxy_pause(ss, s);
+		return type;
+	}
+
+	if (s->frame_header) {
+		return frame_message(ss, s, l, result, buffer, n);
+	}
+
 	result->opaque = s->opaque;
 	result->id = s->id;
 	result->ud = n;
@@ -1362,15 +2588,114 @@ gen_udp_address(int protocol, union sockaddr_all *sa, uint8_t * udp_address) {
 	return addrsz;
 }
 
+#ifdef __linux__
+
+// @socket线程，用recvmmsg一次读取多个udp包，只有一个包的时候，返回 SOCKET_UDP ，格式与以前一样
+// 多个包的时候，合并成一个消息返回 SOCKET_UDP_BATCH ，每个包的格式为 [2字节包大小][1字节地址长度][地址][包数据]
+// 一次读满MAX_UDP_BATCH个包的时候，*again 设置为1，表示套接字可能还有数据可读
+static int
+forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result, int *again) {
+	struct mmsghdr msg[MAX_UDP_BATCH];
+	struct iovec iov[MAX_UDP_BATCH];
+	union sockaddr_all sa[MAX_UDP_BATCH];
+	*again = 0;
+	if (ss->udpbatch == NULL) {
+		ss->udpbatch = MALLOC(MAX_UDP_BATCH * MAX_UDP_PACKAGE);
+	}
+	int i;
+	for (i=0;i<MAX_UDP_BATCH;i++) {
+		iov[i].iov_base = ss->udpbatch + i * MAX_UDP_PACKAGE;
+		iov[i].iov_len = MAX_UDP_PACKAGE;
+		memset(&msg[i], 0, sizeof(msg[i]));
+		msg[i].msg_hdr.msg_name = &sa[i];
+		msg[i].msg_hdr.msg_namelen = sizeof(sa[i]);
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+	}
+	int m = recvmmsg(s->fd, msg, MAX_UDP_BATCH, 0, NULL);
+	if (m<0) {
+		switch(errno) {
+		case AGAIN_WOULDBLOCK:
+			stat_rblock(s);
+			break;
+		case EINTR:
+			break;
+		default:
+			// close when error
+			force_close(ss, s, l, result);
+			result->data = strerror(errno);
+			return SOCKET_ERR;
+		}
+		return -1;
+	}
+	*again = (m == MAX_UDP_BATCH);
+	++s->stat.rcall;
+
+	// 计算合法包的数量和合并后的大小，协议不一致的包直接丢弃
+	int count = 0;
+	int last = 0;
+	size_t total = 0;
+	for (i=0;i<m;i++) {
+		int n = msg[i].msg_len;
+		stat_rpacket(ss,s,n);
+		int protocol = (msg[i].msg_hdr.msg_namelen == sizeof(sa[i].v4)) ? PROTOCOL_UDP : PROTOCOL_UDPv6;
+		if (protocol != s->protocol) {
+			msg[i].msg_len = (unsigned)-1;
+			continue;
+		}
+		++count;
+		last = i;
+		total += 2 + 1 + UDP_ADDRESS_SIZE + n;
+	}
+	if (count == 0) {
+		return -1;
+	}
+
+	uint8_t * data;
+	result->opaque = s->opaque;
+	result->id = s->id;
+	if (count == 1) {
+		int n = msg[last].msg_len;
+		data = MALLOC(n + UDP_ADDRESS_SIZE);
+		gen_udp_address(s->protocol, &sa[last], data + n);
+		memcpy(data, iov[last].iov_base, n);
+		result->ud = n;
+		result->data = (char *)data;
+		return SOCKET_UDP;
+	}
+
+	data = MALLOC(total);
+	uint8_t * ptr = data;
+	for (i=0;i<m;i++) {
+		if (msg[i].msg_len == (unsigned)-1)
+			continue;
+		uint16_t n = (uint16_t)msg[i].msg_len;
+		memcpy(ptr, &n, sizeof(n));
+		int addrsz = gen_udp_address(s->protocol, &sa[i], ptr + 3);
+		ptr[2] = (uint8_t)addrsz;
+		ptr += 3 + addrsz;
+		memcpy(ptr, iov[i].iov_base, n);
+		ptr += n;
+	}
+	result->ud = (int)(ptr - data);
+	result->data = (char *)data;
+	return SOCKET_UDP_BATCH;
+}
+
+#else
+
 static int
-forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
+forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result, int *again) {
+	*again = 0;
 	union sockaddr_all sa;
 	socklen_t slen = sizeof(sa);
 	int n = recvfrom(s->fd, ss->udpbuffer,MAX_UDP_PACKAGE,0,&sa.s,&slen);
 	if (n<0) {
 		switch(errno) {
-		case EINTR:
 		case AGAIN_WOULDBLOCK:
+			stat_rblock(s);
+			break;
+		case EINTR:
 			break;
 		default:
 			// close when error
@@ -1381,6 +2706,7 @@ forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lo
 		return -1;
 	}
 	stat_read(ss,s,n);
+	*again = 1;
 
 	uint8_t * data;
 	if (slen == sizeof(sa.v4)) {
@@ -1404,10 +2730,29 @@ forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lo
 	return SOCKET_UDP;
 }
 
+#endif
+
 // @socket线程 当前请求连接的连接成功时候，调用这个接口，其工作是把套接字状态
 // SOCKET_TYPE_CONNECTING --> SOCKET_TYPE_CONNECTED
 // 此时设置套接字结构体相关的信息，比如对方的ip地址
-// 构造result，用来通知worker线程connet成功了
+// 构造result，用来通知worker线程connet成功了，data 为对端的地址
+static int
+report_open(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	result->opaque = s->opaque;
+	result->id = s->id;
+	result->ud = 0;
+	result->data = NULL;
+	union sockaddr_all u;
+	socklen_t slen = sizeof(u);
+	if (getpeername(s->fd, &u.s, &slen) == 0) {
+		void * sin_addr = (u.s.sa_family == AF_INET) ? (void*)&u.v4.sin_addr : (void *)&u.v6.sin6_addr;
+		if (inet_ntop(u.s.sa_family, sin_addr, ss->buffer, sizeof(ss->buffer))) {
+			result->data = ss->buffer;
+		}
+	}
+	return SOCKET_OPEN;
+}
+
 static int
 report_connect(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
 	int error;
@@ -1422,23 +2767,14 @@ report_connect(struct socket_server *ss, struct socket *s, struct socket_lock *l
 		return SOCKET_ERR;
 	} else {
 		s->type = SOCKET_TYPE_CONNECTED;
-		result->opaque = s->opaque;
-		result->id = s->id;
-		result->ud = 0;
+		if (s->tls_state != TLS_NONE) {
+			// 继续监听可写事件，开始 tls 握手，握手完成以后再报告 SOCKET_OPEN
+			return -1;
+		}
 		if (nomore_sending_data(s)) {
-			sp_write(ss->event_fd, s->fd, s, false);
-		}
-		union sockaddr_all u;
-		socklen_t slen = sizeof(u);
-		if (getpeername(s->fd, &u.s, &slen) == 0) {
-			void * sin_addr = (u.s.sa_family == AF_INET) ? (void*)&u.v4.sin_addr : (void *)&u.v6.sin6_addr;
-			if (inet_ntop(u.s.sa_family, sin_addr, ss->buffer, sizeof(ss->buffer))) {
-				result->data = ss->buffer;
-				return SOCKET_OPEN;
-			}
+			enable_write(ss, s, false);
 		}
-		result->data = NULL;
-		return SOCKET_OPEN;
+		return report_open(ss, s, result);
 	}
 }
 
@@ -1486,10 +2822,19 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 	struct socket *ns = new_fd(ss, id, client_fd, PROTOCOL_TCP, s->opaque, false);
 	if (ns == NULL) {
 		close(client_fd);
+		free_socket(ss, get_socket(ss, id));
+		return 0;
+	}
+#ifdef SKYNET_TLS
+	if (s->tls >= 0 && tls_attach(ss, ns, s->tls, NULL, 0)) {
+		fprintf(stderr, "socket-server: tls accept failed %s.\n", tls_error());
+		close(client_fd);
+		free_socket(ss, ns);
 		return 0;
 	}
+#endif
 	// accept new one connection
-	stat_read(ss,s,1);
+	stat_accept(ss,s);
 
 	ns->type = SOCKET_TYPE_PACCEPT;
 	result->opaque = s->opaque;
@@ -1504,6 +2849,32 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 	return 1;
 }
 
+#ifdef SKYNET_TLS
+
+// @socket线程，推进 tls 握手，返回 1 表示握手完成，0 表示还在进行中，-1 表示失败
+// 握手需要等待可读还是可写由 SSL 决定，这期间发送队列里的数据不会发送
+static int
+tls_handshake(struct socket_server *ss, struct socket *s) {
+	ERR_clear_error();
+	int r = SSL_do_handshake(s->ssl);
+	if (r == 1) {
+		s->tls_state = SSL_session_reused(s->ssl) ? TLS_RESUMED : TLS_ESTABLISHED;
+		enable_write(ss, s, !send_buffer_empty(s));
+		return 1;
+	}
+	switch (SSL_get_error(s->ssl, r)) {
+	case SSL_ERROR_WANT_READ:
+		enable_write(ss, s, false);
+		return 0;
+	case SSL_ERROR_WANT_WRITE:
+		enable_write(ss, s, true);
+		return 0;
+	}
+	return -1;
+}
+
+#endif
+
 static inline void 
 clear_closed_event(struct socket_server *ss, struct socket_message * result, int type) {
 	if (type == SOCKET_CLOSE || type == SOCKET_ERR) {
@@ -1543,19 +2914,34 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 				// 处理所有来自worker线程请求后，设置标识，下面循环处理网络上的读写事件
 				// 即下面的逻辑
 				ss->checkctrl = 0;
+#ifdef __linux__
+				if (ss->udp_pending_n > 0) {
+					flush_udp_pending(ss);
+				}
+#endif
 			}
 		}
 
 		// 等待网络上的读写事件
 		if (ss->event_index == ss->event_n) {
+			// 有限速的套接字时，最多等待10毫秒，以便及时补充令牌恢复发送
+			int timeout = -1;
+			if (ss->throttle_n > 0) {
+				check_throttle(ss);
+				if (ss->throttle_n > 0)
+					timeout = 10;
+			}
 			// 初始的时候，或者所有的事件处理完后，调用epoll_wait等待相应的事件到来
 			// sp_wait返回的值，为epoll_wait的返回值，即触发事件的数量
-			ss->event_n = sp_wait(ss->event_fd, ss->ev, MAX_EVENT);
+			ss->event_n = sp_wait(ss->event_fd, ss->ev, MAX_EVENT, timeout);
 			ss->checkctrl = 1;
 			if (more) {
 				*more = 0;
 			}
 			ss->event_index = 0;
+			if (ss->event_n == 0 && timeout >= 0) {
+				continue;
+			}
 			if (ss->event_n <= 0) {
 				ss->event_n = 0;
 				// epoll_wait 被信号中断了，重新epoll_wait
@@ -1578,13 +2964,19 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		struct socket_lock l;
 		socket_lock_init(s, &l);
 		switch (s->type) {
-		case SOCKET_TYPE_CONNECTING:
+		case SOCKET_TYPE_CONNECTING: {
 			// 正在等待连接的套接字，等到可写的事件了，表示连接成功了
-			return report_connect(ss, s, &l, result);
+			int type = report_connect(ss, s, &l, result);
+			if (type == -1)
+				break;	// tls 握手还没完成
+			return type;
+		}
 		case SOCKET_TYPE_LISTEN: {
 			// 监听的套接字，收到新的连接调用
 			int ok = report_accept(ss, s, result);
 			if (ok > 0) {
+				// accept again until EAGAIN
+				--ss->event_index;
 				return SOCKET_ACCEPT;
 			} if (ok < 0 ) {
 				return SOCKET_ERR;
@@ -1596,19 +2988,49 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 			fprintf(stderr, "socket-server: invalid socket\n");
 			break;
 		default:
+#ifdef SKYNET_TLS
+			if (s->tls_state == TLS_HANDSHAKE) {
+				int r = tls_handshake(ss, s);
+				if (r < 0) {
+					const char * err = tls_error();
+					force_close(ss, s, &l, result);
+					result->data = (char *)err;
+					return SOCKET_ERR;
+				}
+				if (r == 0)
+					break;
+				if (!SSL_is_server(s->ssl)) {
+					// 客户端握手完成，这时候才报告连接成功
+					return report_open(ss, s, result);
+				}
+			}
+#endif
 			if (e->read) {
 				// 有数据可读
 				int type;
 				if (s->protocol == PROTOCOL_TCP) {
 					type = forward_message_tcp(ss, s, &l, result);
 				} else {
-					type = forward_message_udp(ss, s, &l, result);
-					if (type == SOCKET_UDP) {
-						// try read again
-						--ss->event_index;
-						return SOCKET_UDP;
+					int again;
+					type = forward_message_udp(ss, s, &l, result, &again);
+					if (type == SOCKET_UDP || type == SOCKET_UDP_BATCH) {
+						if (again) {
+							// try read again
+							--ss->event_index;
+						} else if (e->write) {
+							e->read = false;
+							--ss->event_index;
+						}
+						return type;
 					}
 				}
+				if (type != SOCKET_CLOSE && type != SOCKET_ERR && tls_pending(s)) {
+					// 下次调用继续读这个套接字
+					--ss->event_index;
+					if (type == -1)
+						break;
+					return type;
+				}
 				if (e->write && type != SOCKET_CLOSE && type != SOCKET_ERR) {
 					// Try to dispatch write message next step if write flag set.
 					// 本事件不仅有读事件，还有写事件，则下次调用还需要这个event，即处理它的写事件
@@ -1673,7 +3095,7 @@ send_request(struct socket_server *ss, struct request_package *request, char typ
 
 // @worker线程，构造请求连接的request_package
 static int
-open_request(struct socket_server *ss, struct request_package *req, uintptr_t opaque, const char *addr, int port) {
+open_request(struct socket_server *ss, struct request_package *req, uintptr_t opaque, const char *addr, int port, int tls) {
 	int len = strlen(addr);
 	if (len + sizeof(req->u.open) >= 256) {
 		fprintf(stderr, "socket-server : Invalid addr %s.\n",addr);
@@ -1685,6 +3107,7 @@ open_request(struct socket_server *ss, struct request_package *req, uintptr_t op
 	req->u.open.opaque = opaque;
 	req->u.open.id = id;
 	req->u.open.port = port;
+	req->u.open.tls = tls;
 	memcpy(req->u.open.host, addr, len);
 	req->u.open.host[len] = '\0';
 
@@ -1692,26 +3115,74 @@ open_request(struct socket_server *ss, struct request_package *req, uintptr_t op
 }
 
 // @worker线程，放出请求connect指定的host和port，然后socket线程去处理连接过程
-int 
-socket_server_connect(struct socket_server *ss, uintptr_t opaque, const char * addr, int port) {
+static int
+connect_request(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int tls) {
 	struct request_package request;
-	int len = open_request(ss, &request, opaque, addr, port);
+	int len = open_request(ss, &request, opaque, addr, port, tls);
 	if (len < 0)
 		return -1;
 	send_request(ss, &request, 'O', sizeof(request.u.open) + len);
 	return request.u.open.id;
 }
 
+int 
+socket_server_connect(struct socket_server *ss, uintptr_t opaque, const char * addr, int port) {
+	return connect_request(ss, opaque, addr, port, -1);
+}
+
+// @worker线程，tls 为 socket_server_tls_context 返回的客户端 context
+int
+socket_server_connect_tls(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int tls) {
+	if (!tls_valid(ss, tls, 0))
+		return -1;
+	return connect_request(ss, opaque, addr, port, tls);
+}
+
+// 代理模式的套接字由socket线程控制可读事件 (proxy_pause)，worker线程不直接写，以免并发修改监听的事件
 static inline int
 can_direct_write(struct socket *s, int id) {
-	return s->id == id && nomore_sending_data(s) && s->type == SOCKET_TYPE_CONNECTED && s->udpconnecting == 0;
+	return s->id == id && nomore_sending_data(s) && s->type == SOCKET_TYPE_CONNECTED && s->udpconnecting == 0 && !s->ratelimit
+		&& s->tls_state == TLS_NONE && s->proxy < 0;
+}
+
+// socket线程的发送队列是空的，也没有正在处理的发送请求，只是工作线程直接发送时剩下的数据在等待套接字可写，
+// 这时候新的数据直接追加到dw链表的后面，不用经过socket线程。dw中的数据达到 WARNING_SIZE 以后，
+// 数据还是交给socket线程，对端不读数据的时候，由socket线程报警 (SOCKET_WARNING) 或者按高水位处理
+static inline int
+can_direct_queue(struct socket *s, int id) {
+	return s->id == id && s->dw.head != NULL && send_buffer_empty(s) && (s->sending & 0xffff) == 0
+		&& send_size(s) < WARNING_SIZE && s->proxy < 0
+		&& s->type == SOCKET_TYPE_CONNECTED && s->protocol == PROTOCOL_TCP && !s->ratelimit && !s->highwater
+		&& s->tls_state == TLS_NONE;
+}
+
+// @worker线程，在持有dw_lock的时候调用，把数据(从offset开始)加入dw链表，等待socket线程在套接字可写的时候发送
+static void
+append_dw_list(struct socket_server *ss, struct socket *s, const void * buffer, int sz, int offset) {
+	struct write_buffer * buf = MALLOC(SIZEOF_TCPBUFFER);
+	struct send_object so;
+	buf->userobject = send_object_init(ss, &so, (void *)buffer, sz);
+	buf->file = false;
+	buf->ptr = (char*)so.buffer + offset;
+	buf->sz = so.sz - offset;
+	buf->buffer = (void *)buffer;
+	buf->time = now_usec();
+	buf->next = NULL;
+	ATOM_ADD(&s->dw_size, buf->sz);
+	ATOM_INC(&s->dw_n);
+	if (s->dw.head == NULL) {
+		s->dw.head = s->dw.tail = buf;
+	} else {
+		s->dw.tail->next = buf;
+		s->dw.tail = buf;
+	}
 }
 
 // @worker线程，请求向指定套接字发送数据
 // return -1 when error, 0 when success
 int 
 socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		free_buffer(ss, buffer, sz);
 		return -1;
@@ -1746,28 +3217,41 @@ socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz
 			if (n<0) {
 				// ignore error, let socket thread try again
 				n = 0;
+				stat_wblock(s);
+			} else {
+				stat_write(ss,s,n);
 			}
-			stat_write(ss,s,n);
 			if (n == so.sz) {
 				// write done
+				++s->stat.wpacket;
 				socket_unlock(&l);
 				so.free_func((void *)buffer);
+				ATOM_INC(&ss->sendstat.direct);
 				return 0;
 			}
-			// write failed, put buffer into s->dw_* , and let socket thread send it. see send_buffer()
-			s->dw_buffer = buffer;
-			s->dw_size = sz;
-			s->dw_offset = n;
+			// write failed, put buffer into s->dw , and let socket thread send it. see send_buffer()
+			append_dw_list(ss, s, buffer, sz, n);
 
-			sp_write(ss->event_fd, s->fd, s, true);
+			enable_write(ss, s, true);
 
 			socket_unlock(&l);
+			ATOM_INC(&ss->sendstat.partial);
+			return 0;
+		}
+		socket_unlock(&l);
+	} else if (can_direct_queue(s,id) && socket_trylock(&l)) {
+		if (can_direct_queue(s,id)) {
+			// the socket is waiting for writable (EPOLLOUT is on), queue it after the direct write buffers
+			append_dw_list(ss, s, buffer, sz, 0);
+			socket_unlock(&l);
+			ATOM_INC(&ss->sendstat.queued);
 			return 0;
 		}
 		socket_unlock(&l);
 	}
 
-	inc_sending_ref(s, id);
+	ATOM_INC(&ss->sendstat.request);
+	inc_sending_ref(ss, s, id);
 
 	struct request_package request;
 	request.u.send.id = id;
@@ -1782,13 +3266,13 @@ socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz
 // return -1 when error, 0 when success
 int 
 socket_server_send_lowpriority(struct socket_server *ss, int id, const void * buffer, int sz) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		free_buffer(ss, buffer, sz);
 		return -1;
 	}
 
-	inc_sending_ref(s, id);
+	inc_sending_ref(ss, s, id);
 
 	struct request_package request;
 	request.u.send.id = id;
@@ -1799,6 +3283,42 @@ socket_server_send_lowpriority(struct socket_server *ss, int id, const void * bu
 	return 0;
 }
 
+// @worker线程，请求发送文件fd中从offset开始的size字节数据，fd的所有权交给socket线程
+// return -1 when error, 0 when success
+int
+socket_server_sendfile(struct socket_server *ss, int id, int fd, int64_t offset, int size) {
+	struct socket * s = get_socket(ss, id);
+	if (s->id != id || s->type == SOCKET_TYPE_INVALID || size < 0) {
+		close(fd);
+		return -1;
+	}
+	if (size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	inc_sending_ref(ss, s, id);
+
+	struct request_package request;
+	request.u.sendfile.id = id;
+	request.u.sendfile.fd = fd;
+	request.u.sendfile.size = size;
+	request.u.sendfile.offset = offset;
+
+	send_request(ss, &request, 'F', sizeof(request.u.sendfile));
+	return 0;
+}
+
+// @worker线程，请求把两个已经连接的套接字互相代理
+void
+socket_server_proxy(struct socket_server *ss, uintptr_t opaque, int id, int peer) {
+	struct request_package request;
+	request.u.proxy.id = id;
+	request.u.proxy.peer = peer;
+	request.u.proxy.opaque = opaque;
+	send_request(ss, &request, 'R', sizeof(request.u.proxy));
+}
+
 // 在timer线程退出的时候调用，用来唤醒 sokcet线程，在timer线程中调用
 void
 socket_server_exit(struct socket_server *ss) {
@@ -1832,7 +3352,7 @@ socket_server_shutdown(struct socket_server *ss, uintptr_t opaque, int id) {
 // 参数 protocol 类型为 IPPROTO_TCP 或者是 IPPROTO_UDP
 // 接口工作：创建网络套接字、绑定到相应的地址
 static int
-do_bind(const char *host, int port, int protocol, int *family) {
+do_bind(const char *host, int port, int protocol, int *family, bool reuseport) {
 	int fd;
 	int status;
 	int reuse = 1;
@@ -1866,6 +3386,17 @@ do_bind(const char *host, int port, int protocol, int *family) {
 	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *)&reuse, sizeof(int))==-1) {
 		goto _failed;
 	}
+	if (reuseport) {
+#ifdef SO_REUSEPORT
+		// 多个套接字可以监听同一个端口，由内核把新连接分配给它们
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (void *)&reuse, sizeof(int))==-1) {
+			goto _failed;
+		}
+#else
+		fprintf(stderr, "socket-server : SO_REUSEPORT is not supported.\n");
+		goto _failed;
+#endif
+	}
 	status = bind(fd, (struct sockaddr *)ai_list->ai_addr, ai_list->ai_addrlen);
 	if (status != 0)
 		goto _failed;
@@ -1881,9 +3412,9 @@ _failed_fd:
 
 // @worker线程，返回相应监听的fd
 static int
-do_listen(const char * host, int port, int backlog) {
+do_listen(const char * host, int port, int backlog, bool reuseport) {
 	int family = 0;
-	int listen_fd = do_bind(host, port, IPPROTO_TCP, &family);
+	int listen_fd = do_bind(host, port, IPPROTO_TCP, &family, reuseport);
 	if (listen_fd < 0) {
 		return -1;
 	}
@@ -1891,6 +3422,8 @@ do_listen(const char * host, int port, int backlog) {
 		close(listen_fd);
 		return -1;
 	}
+	// socket线程会一直accept到返回EAGAIN为止，所以监听的fd必须是非阻塞的
+	sp_nonblocking(listen_fd);
 	return listen_fd;
 }
 
@@ -1898,9 +3431,9 @@ do_listen(const char * host, int port, int backlog) {
 // 在worker线程创建好创建好套接字相关的信息
 // 请求socket线程做的工作是，初始化对应的结构体和监听相关事件
 // 参数 opaque 通常是服务对应的handle
-int 
-socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog) {
-	int fd = do_listen(addr, port, backlog);
+static int
+listen_request(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog, bool reuseport, int tls) {
+	int fd = do_listen(addr, port, backlog, reuseport);
 	if (fd < 0) {
 		return -1;
 	}
@@ -1913,10 +3446,133 @@ socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * ad
 	request.u.listen.opaque = opaque;
 	request.u.listen.id = id;
 	request.u.listen.fd = fd;
+	request.u.listen.tls = tls;
 	send_request(ss, &request, 'L', sizeof(request.u.listen));
 	return id;
 }
 
+int 
+socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog) {
+	return listen_request(ss, opaque, addr, port, backlog, false, -1);
+}
+
+// @worker线程，以SO_REUSEPORT方式监听，多个服务可以各自监听同一个端口，分担新连接
+int
+socket_server_listen_reuseport(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog) {
+	return listen_request(ss, opaque, addr, port, backlog, true, -1);
+}
+
+// @worker线程，监听套接字accept的连接都使用 tls，tls 为 socket_server_tls_context 返回的服务端 context
+int
+socket_server_listen_tls(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog, int reuseport, int tls) {
+	if (!tls_valid(ss, tls, 1))
+		return -1;
+	return listen_request(ss, opaque, addr, port, backlog, reuseport != 0, tls);
+}
+
+#ifdef SKYNET_TLS
+
+static char *
+tls_strdup(const char *str) {
+	if (str == NULL)
+		return NULL;
+	size_t sz = strlen(str);
+	char * ret = MALLOC(sz + 1);
+	memcpy(ret, str, sz + 1);
+	return ret;
+}
+
+static int
+tls_strequal(const char *a, const char *b) {
+	if (a == NULL || b == NULL)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+static SSL_CTX *
+tls_create_context(struct socket_server *ss, int server, const char *cert, const char *key, const char *ca) {
+	SSL_CTX * ctx = SSL_CTX_new(server ? TLS_server_method() : TLS_client_method());
+	if (ctx == NULL)
+		return NULL;
+	SSL_CTX_set_app_data(ctx, ss);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+	SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+	if (cert && SSL_CTX_use_certificate_chain_file(ctx, cert) != 1)
+		goto _failed;
+	if (key && SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1)
+		goto _failed;
+	if (cert && key && SSL_CTX_check_private_key(ctx) != 1)
+		goto _failed;
+	if (ca) {
+		if (SSL_CTX_load_verify_locations(ctx, ca, NULL) != 1)
+			goto _failed;
+		SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+	}
+	if (server) {
+		// 服务端用内置的缓存和 session ticket 恢复会话
+		static const unsigned char sid_ctx[] = "skynet";
+		SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	} else {
+		// 客户端的 session 保存在 ss->tls_session 中，见 tls_new_session
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(ctx, tls_new_session);
+	}
+	return ctx;
+_failed:
+	SSL_CTX_free(ctx);
+	return NULL;
+}
+
+#endif
+
+// @worker线程，创建 tls context，参数相同的 context 只创建一次
+// server 为真时 cert 和 key 是证书链和私钥的 pem 文件；ca 不为 NULL 时校验对端的证书
+// 返回 context 的下标，失败或者没有编译 tls 支持(SKYNET_TLS)时返回 -1
+int
+socket_server_tls_context(struct socket_server *ss, int server, const char *cert, const char *key, const char *ca) {
+#ifdef SKYNET_TLS
+	int i;
+	int ret = -1;
+	server = server ? 1 : 0;
+	spinlock_lock(&ss->tls_lock);
+	for (i=0;i<ss->tls_n;i++) {
+		struct tls_context *tc = &ss->tls_ctx[i];
+		if (tc->server == server && tls_strequal(tc->cert, cert) && tls_strequal(tc->key, key) && tls_strequal(tc->ca, ca)) {
+			ret = i;
+			goto _done;
+		}
+	}
+	if (ss->tls_n >= MAX_TLS_CONTEXT) {
+		fprintf(stderr, "socket-server: too many tls context.\n");
+		goto _done;
+	}
+	SSL_CTX * ctx = tls_create_context(ss, server, cert, key, ca);
+	if (ctx == NULL) {
+		fprintf(stderr, "socket-server: create tls context failed : %s.\n", tls_error());
+		goto _done;
+	}
+	struct tls_context *tc = &ss->tls_ctx[ss->tls_n];
+	tc->server = server;
+	tc->cert = tls_strdup(cert);
+	tc->key = tls_strdup(key);
+	tc->ca = tls_strdup(ca);
+	tc->ctx = ctx;
+	ret = ss->tls_n;
+	__sync_synchronize();
+	++ss->tls_n;
+_done:
+	spinlock_unlock(&ss->tls_lock);
+	return ret;
+#else
+	(void)ss; (void)server; (void)cert; (void)key; (void)ca;
+	fprintf(stderr, "socket-server: tls is not supported, build with TLS_LIB.\n");
+	return -1;
+#endif
+}
+
 // @worker线程，请求bind和监听fd
 int
 socket_server_bind(struct socket_server *ss, uintptr_t opaque, int fd) {
@@ -1949,6 +3605,44 @@ socket_server_nodelay(struct socket_server *ss, int id) {
 	send_request(ss, &request, 'T', sizeof(request.u.setopt));
 }
 
+// 获取工作线程发送数据(socket_server_send)的统计
+void
+socket_server_sendstat(struct socket_server *ss, struct socket_sendstat *stat) {
+	*stat = ss->sendstat;
+}
+
+// @worker线程，设置发送缓存的高水位 hwm (字节，0表示不限制)，超过时按照 policy 处理
+// rate 为每秒最多发送的字节数，0表示不限速
+void
+socket_server_limit(struct socket_server *ss, int id, int64_t hwm, int policy, int rate) {
+	struct socket * s = get_socket(ss, id);
+	if (s->id == id && rate > 0) {
+		// 不再从worker线程直接发送，之后的数据都由socket线程限速发送
+		s->ratelimit = true;
+	}
+	if (s->id == id && hwm > 0) {
+		// 追加到dw链表的数据不经过 send_socket 的高水位检查
+		s->highwater = true;
+	}
+	struct request_package request;
+	request.u.limit.id = id;
+	request.u.limit.hwm = hwm;
+	request.u.limit.policy = policy;
+	request.u.limit.rate = rate;
+	send_request(ss, &request, 'M', sizeof(request.u.limit));
+}
+
+// @worker线程，设置套接字的分帧模式，header 为包头的字节数(2或4)，0表示取消，max<=0 表示不限制包的大小
+// 应该在 socket_server_start 之前调用，这样上报的第一个数据就是完整的包
+void
+socket_server_framing(struct socket_server *ss, int id, int header, int max) {
+	struct request_package request;
+	request.u.framing.id = id;
+	request.u.framing.header = header;
+	request.u.framing.max = max;
+	send_request(ss, &request, 'H', sizeof(request.u.framing));
+}
+
 void 
 socket_server_userobject(struct socket_server *ss, struct socket_object_interface *soi) {
 	ss->soi = *soi;
@@ -1962,7 +3656,7 @@ socket_server_udp(struct socket_server *ss, uintptr_t opaque, const char * addr,
 	int family;
 	if (port != 0 || addr != NULL) {
 		// bind
-		fd = do_bind(addr, port, IPPROTO_UDP, &family);
+		fd = do_bind(addr, port, IPPROTO_UDP, &family, false);
 		if (fd < 0) {
 			return -1;
 		}
@@ -1992,7 +3686,7 @@ socket_server_udp(struct socket_server *ss, uintptr_t opaque, const char * addr,
 
 int 
 socket_server_udp_send(struct socket_server *ss, int id, const struct socket_udp_address *addr, const void *buffer, int sz) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		free_buffer(ss, buffer, sz);
 		return -1;
@@ -2032,6 +3726,7 @@ socket_server_udp_send(struct socket_server *ss, int id, const struct socket_udp
 			if (n >= 0) {
 				// sendto succ
 				stat_write(ss,s,n);
+				++s->stat.wpacket;
 				socket_unlock(&l);
 				so.free_func((void *)buffer);
 				return 0;
@@ -2054,7 +3749,7 @@ socket_server_udp_send(struct socket_server *ss, int id, const struct socket_udp
 
 int
 socket_server_udp_connect(struct socket_server *ss, int id, const char * addr, int port) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		return -1;
 	}
@@ -2176,17 +3871,45 @@ query_info(struct socket *s, struct socket_info *si) {
 	si->write = s->stat.write;
 	si->rtime = s->stat.rtime;
 	si->wtime = s->stat.wtime;
-	si->wbuffer = s->wb_size;
+	si->wbuffer = send_size(s);
+	si->tls = s->tls_state;
+	si->rpacket = s->stat.rpacket;
+	si->wpacket = s->stat.wpacket;
+	si->rcall = s->stat.rcall;
+	si->wcall = s->stat.wcall;
+	si->eagain = s->stat.eagain;
+	si->wqueue = s->wb_n + s->dw_n;
+	si->wbmax = s->stat.wb_max;
 
 	return 1;
 }
 
+// 只遍历活动链表，先在 free_lock 的保护下复制下标，查询的时候不持有锁
 struct socket_info *
 socket_server_info(struct socket_server *ss) {
 	int i;
+	int n = 0;
+	int cap = ss->active_n + 16;
+	int *index = MALLOC(cap * sizeof(int));
+	for (;;) {
+		spinlock_lock(&ss->free_lock);
+		if (ss->active_n <= cap) {
+			int idx = ss->active_head;
+			while (idx >= 0) {
+				index[n++] = idx;
+				idx = get_socket(ss, idx)->active_next;
+			}
+			spinlock_unlock(&ss->free_lock);
+			break;
+		}
+		cap = ss->active_n + 16;
+		spinlock_unlock(&ss->free_lock);
+		FREE(index);
+		index = MALLOC(cap * sizeof(int));
+	}
 	struct socket_info * si = NULL;
-	for (i=0;i<MAX_SOCKET;i++) {
-		struct socket * s = &ss->slot[i];
+	for (i=0;i<n;i++) {
+		struct socket * s = get_socket(ss, index[i]);
 		int id = s->id;
 		struct socket_info temp;
 		if (query_info(s, &temp) && s->id == id) {
@@ -2196,5 +3919,11 @@ socket_server_info(struct socket_server *ss) {
 			*si = temp;
 		}
 	}
+	FREE(index);
 	return si;
 }
+
+void
+socket_server_histogram(struct socket_server *ss, struct socket_histogram *hist) {
+	*hist = ss->hist;
+}
@@ -12,6 +12,12 @@
 #define SOCKET_EXIT 5
 #define SOCKET_UDP 6
 #define SOCKET_WARNING 7
+#define SOCKET_UDP_BATCH 8
+
+// policy when the send buffer of a socket is over the high-water mark, see socket_server_limit
+#define SOCKET_HWM_DROP 0	// drop the low priority data
+#define SOCKET_HWM_CLOSE 1	// close the socket
+#define SOCKET_HWM_PAUSE 2	// report SOCKET_WARNING, and report it again with ud = 0 when the buffer is empty
 
 struct socket_server;
 
@@ -22,7 +28,7 @@ struct socket_message {
 	char * data;
 };
 
-struct socket_server * socket_server_create(uint64_t time);
+struct socket_server * socket_server_create(uint64_t time, int max_socket);
 void socket_server_release(struct socket_server *);
 void socket_server_updatetime(struct socket_server *, uint64_t time);
 int socket_server_poll(struct socket_server *, struct socket_message *result, int *more);
@@ -35,14 +41,26 @@ void socket_server_start(struct socket_server *, uintptr_t opaque, int id);
 // return -1 when error
 int socket_server_send(struct socket_server *, int id, const void * buffer, int sz);
 int socket_server_send_lowpriority(struct socket_server *, int id, const void * buffer, int sz);
+// send [offset, offset+size) of the file fd, the socket server owns fd after calling it
+int socket_server_sendfile(struct socket_server *, int id, int fd, int64_t offset, int size);
+// forward the data read from id to peer and vice versa in socket thread
+void socket_server_proxy(struct socket_server *, uintptr_t opaque, int id, int peer);
 
 // ctrl command below returns id
 int socket_server_listen(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog);
+// listen with SO_REUSEPORT, so several listen sockets (in different services) can share one port
+int socket_server_listen_reuseport(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog);
 int socket_server_connect(struct socket_server *, uintptr_t opaque, const char * addr, int port);
+// tls (build with SKYNET_TLS) : create a context once, and use its index to listen or connect. return -1 when failed
+int socket_server_tls_context(struct socket_server *, int server, const char *cert, const char *key, const char *ca);
+int socket_server_listen_tls(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog, int reuseport, int tls);
+int socket_server_connect_tls(struct socket_server *, uintptr_t opaque, const char * addr, int port, int tls);
 int socket_server_bind(struct socket_server *, uintptr_t opaque, int fd);
 
 // for tcp
 void socket_server_nodelay(struct socket_server *, int id);
+void socket_server_framing(struct socket_server *, int id, int header, int max);
+void socket_server_limit(struct socket_server *, int id, int64_t hwm, int policy, int rate);
 
 struct socket_udp_address;
 
@@ -68,4 +86,7 @@ void socket_server_userobject(struct socket_server *, struct socket_object_inter
 
 struct socket_info * socket_server_info(struct socket_server *);
 
+void socket_server_sendstat(struct socket_server *, struct socket_sendstat *);
+void socket_server_histogram(struct socket_server *, struct socket_histogram *);
+
 #endif
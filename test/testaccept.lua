@@ -0,0 +1,95 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"	-- import skynet.kill
+
+-- accept rate benchmark : skynet.newservice("testaccept", listener_number)
+-- listener_number > 1 launches several listen services sharing the port with SO_REUSEPORT
+
+local mode, arg = ...
+
+local PORT = 8007
+local CLIENT = 16
+local CONNECT = 500
+
+if mode == "listener" then
+
+skynet.start(function()
+	local count = 0
+	local id = socket.listen("127.0.0.1", PORT, 1024, arg == "true")
+	socket.start(id, function(fd)
+		count = count + 1
+		socket.close_fd(fd)
+	end)
+	skynet.dispatch("lua", function(_,_, cmd)
+		if cmd == "count" then
+			skynet.ret(skynet.pack(count))
+		else
+			socket.close(id)
+			skynet.ret(skynet.pack(count))
+			skynet.exit()
+		end
+	end)
+end)
+
+elseif mode == "client" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		local n = 0
+		for i=1,CONNECT do
+			local fd = socket.open("127.0.0.1", PORT)
+			if fd then
+				n = n + 1
+				socket.close(fd)
+			end
+		end
+		skynet.ret(skynet.pack(n))
+	end)
+end)
+
+else
+
+local function bench(listener_number)
+	local reuseport = listener_number > 1
+	local listeners = {}
+	for i=1,listener_number do
+		table.insert(listeners, skynet.newservice(SERVICE_NAME, "listener", tostring(reuseport)))
+	end
+	local clients = {}
+	for i=1,CLIENT do
+		table.insert(clients, skynet.newservice(SERVICE_NAME, "client"))
+	end
+	local start = skynet.now()
+	local done = 0
+	local connected = 0
+	local co = coroutine.running()
+	for _, c in ipairs(clients) do
+		skynet.fork(function()
+			local n = skynet.call(c, "lua")
+			connected = connected + n
+			done = done + 1
+			if done == CLIENT then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	local ti = skynet.now() - start
+	local accepted = {}
+	for _, l in ipairs(listeners) do
+		table.insert(accepted, skynet.call(l, "lua", "close"))
+	end
+	for _, c in ipairs(clients) do
+		skynet.kill(c)
+	end
+	print(string.format("listener %d : %d connections in %d cs, %.0f/s, accepted %s",
+		listener_number, connected, ti, connected / math.max(ti, 1) * 100, table.concat(accepted, " ")))
+end
+
+skynet.start(function()
+	bench(1)
+	bench(tonumber(mode) or 4)
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,26 @@
+local skynet = require "skynet"
+
+-- a gc heavy agent : small tables and strings die young.
+-- set snlua_arena = 1 in config to compare with the arena allocator for lua vm.
+
+local N = 500000
+local LIVE = 10000
+
+skynet.start(function()
+	print("snlua_arena", skynet.getenv "snlua_arena" or "0")
+	local ring = {}
+	collectgarbage()
+	local ti = skynet.hpc()
+	for i = 1, N do
+		ring[i % LIVE] = { id = i, name = "player" .. i, pos = { x = i, y = -i } }
+	end
+	ti = (skynet.hpc() - ti) / 1000000
+	local sum = 0
+	for _, v in pairs(ring) do
+		assert(v.name == "player" .. v.id and v.pos.y == -v.id)
+		sum = sum + 1
+	end
+	assert(sum == LIVE)
+	print(string.format("%d objects : %.1f ms, %.1f KB", N, ti, collectgarbage "count"))
+	skynet.exit()
+end)
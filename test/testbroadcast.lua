@@ -0,0 +1,100 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- broadcast many small packages to several connections, and report the write syscalls (linux only)
+
+local mode = ...
+
+local PORT = 8003
+local CLIENT = 16
+local PACKAGE = 2000
+local MESSAGE = "0123456789abcdef0123456789abcdef"
+
+local function syscw()
+	local f = io.open("/proc/self/io")
+	if not f then
+		return 0
+	end
+	local n = 0
+	for line in f:lines() do
+		local v = line:match "^syscw: (%d+)"
+		if v then
+			n = tonumber(v)
+		end
+	end
+	f:close()
+	return n
+end
+
+if mode == "client" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		-- low priority round and high priority round
+		local total = 2 * PACKAGE * #MESSAGE
+		local id = assert(socket.open("127.0.0.1", PORT))
+		local n = 0
+		while n < total do
+			local str = socket.read(id)
+			if not str then
+				break
+			end
+			n = n + #str
+		end
+		socket.close(id)
+		skynet.ret(skynet.pack(n))
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local clients = {}
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.start(lid, function(id)
+		socket.start(id)
+		table.insert(clients, id)
+	end)
+
+	local ready = 0
+	local co = coroutine.running()
+	for i=1,CLIENT do
+		local c = skynet.newservice(SERVICE_NAME, "client")
+		skynet.fork(function()
+			local n = skynet.call(c, "lua")
+			ready = ready + 1
+			if ready == CLIENT then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	while #clients < CLIENT do
+		skynet.sleep(1)
+	end
+
+	local function broadcast(name, write)
+		local w = syscw()
+		local stat = socket.sendstat()
+		local start = skynet.now()
+		for i=1,PACKAGE do
+			for _, id in ipairs(clients) do
+				write(id, MESSAGE)
+			end
+		end
+		local ti = skynet.now() - start
+		local stat2 = socket.sendstat()
+		print(string.format("broadcast (%s) %d packages to %d clients : %d cs, %d write syscalls, direct %d partial %d queued %d request %d",
+			name, PACKAGE, CLIENT, ti, syscw() - w,
+			stat2.direct - stat.direct, stat2.partial - stat.partial, stat2.queued - stat.queued, stat2.request - stat.request))
+	end
+	-- high priority packages may be written by the worker thread directly
+	broadcast("write", socket.write)
+	skynet.sleep(50)
+	-- low priority packages are always queued in socket thread
+	broadcast("lwrite", socket.lwrite)
+	skynet.wait(co)
+	socket.close(lid)
+	skynet.exit()
+end)
+
+end
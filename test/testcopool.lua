@@ -0,0 +1,75 @@
+local skynet = require "skynet"
+
+-- a fork heavy service : bursts of forks, each one calls the echo service after a deep recursion (grows its stack)
+
+local BURST = 4000
+local ROUND = 10
+local DEPTH = 100
+local mode = ...
+
+if mode == "echo" then
+	skynet.start(function()
+		skynet.dispatch("lua", function(_, _, n)
+			skynet.ret(skynet.pack(n))
+		end)
+	end)
+	return
+end
+
+local function deep(n)
+	if n == 0 then
+		return 0
+	end
+	return 1 + deep(n - 1)
+end
+
+local function burst(echo)
+	local co = coroutine.running()
+	local done = 0
+	for i = 1, BURST do
+		skynet.fork(function()
+			assert(deep(DEPTH) == DEPTH)
+			assert(skynet.call(echo, "lua", i) == i)
+			done = done + 1
+			if done == BURST then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+end
+
+local function stat()
+	return string.format("created %d, reused %d, live %d, pool %d",
+		skynet.stat "coroutine_created", skynet.stat "coroutine_reused", skynet.stat "coroutine_live", skynet.stat "coroutine_pool")
+end
+
+local function bench(echo, size)
+	skynet.coroutine_pool(size)
+	local peak = 0
+	local ti = skynet.hpc()
+	for i = 1, ROUND do
+		burst(echo)
+		peak = math.max(peak, collectgarbage "count")
+	end
+	ti = (skynet.hpc() - ti) / 1000000000
+	skynet.yield()	-- let the last fork return to the pool
+	collectgarbage()
+	print(string.format("pool %d : %d rpc in forks %.0f rpc/s, peak %.0f KB, after gc %.0f KB (%s)",
+		size, BURST * ROUND, BURST * ROUND / ti, peak, collectgarbage "count", stat()))
+	assert(skynet.stat "coroutine_pool" <= size)
+end
+
+skynet.start(function()
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+	bench(echo, 1024)	-- the default size, smaller than the bursts
+	bench(echo, BURST)
+	assert(skynet.stat "coroutine_created" > skynet.stat "coroutine_live")
+
+	skynet.coroutine_pool(16)
+	assert(skynet.stat "coroutine_pool" == 16)
+	assert(skynet.stat "coroutine_live" == 17)	-- and the running one
+	collectgarbage()
+	print(string.format("pool 16 : %.0f KB (%s)", collectgarbage "count", stat()))
+	skynet.exit()
+end)
@@ -0,0 +1,185 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local socketdriver = require "skynet.socketdriver"
+local netpack = require "skynet.netpack"
+require "skynet.manager"	-- import skynet.launch
+
+-- send length-prefixed packages in fragments, and check the socket thread (framing mode) splits them correctly
+
+local PACKAGE = 200
+
+local packages = {}
+for i=1,PACKAGE do
+	packages[i] = string.rep(string.char(i % 26 + 65), i * 7 % 300) .. i
+end
+
+local function client(port)
+	local id = assert(socket.open("127.0.0.1", port))
+	local stream = {}
+	for i=1,PACKAGE do
+		stream[i] = string.pack(">s2", packages[i])
+	end
+	stream = table.concat(stream)
+	-- write the stream in fragments of different sizes
+	local offset = 1
+	local n = 1
+	while offset <= #stream do
+		local sz = n * 37 % 500 + 1
+		socket.write(id, stream:sub(offset, offset + sz - 1))
+		offset = offset + sz
+		n = n + 1
+		if n % 4 == 0 then
+			skynet.sleep(0)
+		end
+	end
+	return id
+end
+
+local received
+local waiting
+
+local function push(msg)
+	table.insert(received, msg)
+	if #received == PACKAGE then
+		skynet.wakeup(waiting)
+	end
+end
+
+local function wait(name)
+	waiting = coroutine.running()
+	skynet.wait(waiting)
+	for i=1,PACKAGE do
+		assert(received[i] == packages[i], i)
+	end
+	print(name, #received, "packages ok")
+end
+
+local function test_socket()
+	received = {}
+	local lid = socket.listen("127.0.0.1", 8011)
+	socket.start(lid, function(id)
+		socketdriver.framing(id, 2)
+		socket.start(id)
+		skynet.fork(function()
+			while true do
+				local str = socket.read(id)
+				if not str then
+					return
+				end
+				-- always whole packages
+				local offset = 1
+				while offset <= #str do
+					local msg
+					msg, offset = string.unpack(">s2", str, offset)
+					push(msg)
+				end
+			end
+		end)
+	end)
+	local id = client(8011)
+	wait "socket"
+	socket.close(id)
+	socket.close(lid)
+end
+
+local function test_luagate()
+	received = {}
+	local gate
+	local CMD = {}
+	function CMD.open(fd)
+		skynet.send(gate, "lua", "accept", fd)
+	end
+	function CMD.data(fd, msg)
+		push(msg)
+	end
+	function CMD.close() end
+	skynet.dispatch("lua", function(_, _, cmd, subcmd, ...)
+		if cmd == "socket" then
+			CMD[subcmd](...)
+		end
+	end)
+	gate = skynet.newservice("gate")
+	skynet.call(gate, "lua", "open", { address = "127.0.0.1", port = 8012, watchdog = skynet.self() })
+	local id = client(8012)
+	wait "lua gate"
+	socket.close(id)
+	skynet.call(gate, "lua", "close")
+	skynet.kill(gate)
+end
+
+local function test_cgate()
+	received = {}
+	local gate
+	skynet.register_protocol {
+		name = "text",
+		id = skynet.PTYPE_TEXT,
+		pack = function(m) return tostring(m) end,
+		unpack = skynet.tostring,
+		dispatch = function(_, _, msg)
+			skynet.ignoreret()	-- session is fd
+			local fd, cmd, data = msg:match "^(%d+) (%a+) ?(.*)"
+			if cmd == "open" then
+				skynet.send(gate, "text", "start " .. fd)
+			elseif cmd == "data" then
+				push(data)
+			end
+		end,
+	}
+	gate = skynet.launch("gate", string.format("S :%08x 127.0.0.1:8013 0 16", skynet.self()))
+	local id = client(8013)
+	wait "c gate"
+	socket.close(id)
+	skynet.kill(gate)
+end
+
+-- the c gate forwards the packages to the agent (this service), in vector messages when vector is true
+local vector
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = function(msg, sz)
+		if vector then
+			return netpack.unpackv(msg, sz)
+		end
+		return skynet.tostring(msg, sz)
+	end,
+	dispatch = function(_, _, ...)
+		skynet.ignoreret()	-- session is fd
+		for i = 1, select("#", ...) do
+			push((select(i, ...)))
+		end
+	end,
+}
+
+local function test_cgateagent(v)
+	received = {}
+	vector = v
+	local gate
+	skynet.dispatch("text", function(_, _, msg)
+		skynet.ignoreret()	-- session is fd
+		local fd, cmd = msg:match "^(%d+) (%a+)"
+		if cmd == "open" then
+			skynet.send(gate, "text", string.format("forward %s :%08x :0", fd, skynet.self()))
+			if vector then
+				skynet.send(gate, "text", "vector " .. fd)
+			end
+			skynet.send(gate, "text", "start " .. fd)
+		end
+	end)
+	local port = vector and 8021 or 8020
+	gate = skynet.launch("gate", string.format("S :%08x 127.0.0.1:%d 0 16", skynet.self(), port))
+	local id = client(port)
+	wait(vector and "c gate vector" or "c gate agent")
+	socket.close(id)
+	skynet.kill(gate)
+end
+
+skynet.start(function()
+	test_socket()
+	test_luagate()
+	test_cgate()
+	test_cgateagent(false)
+	test_cgateagent(true)
+	skynet.exit()
+end)
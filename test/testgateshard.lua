@@ -0,0 +1,115 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"	-- import skynet.launch
+
+-- the c gate with 4 shards : the connections are spread over the shard gates,
+-- and a connection handed over by the "direct" command is read by this service (the agent) directly
+
+local PORT = 8019
+local SHARD = 4
+local CLIENT = 16
+local PACKAGE = 50
+
+local gate
+local received = {}	-- fd -> packages
+local owners = {}
+local direct = {}	-- fd -> true when handed over
+local opened = 0
+local waiting
+
+local function check_done()
+	local n = 0
+	for _, packages in pairs(received) do
+		if #packages == PACKAGE then
+			n = n + 1
+		end
+	end
+	if n == CLIENT and waiting then
+		skynet.wakeup(waiting)
+	end
+end
+
+local function read_direct(fd)
+	socket.start(fd)
+	local packages = received[fd]
+	while #packages < PACKAGE do
+		local str = assert(socket.read(fd))
+		-- always whole packages
+		local offset = 1
+		while offset <= #str do
+			local msg
+			msg, offset = string.unpack(">s2", str, offset)
+			table.insert(packages, msg)
+		end
+	end
+	check_done()
+end
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(m) return tostring(m) end,
+	unpack = skynet.tostring,
+	dispatch = function(_, source, msg)
+		skynet.ignoreret()	-- session is fd
+		local fd, cmd, data = msg:match "^(%d+) (%a+) ?(.*)"
+		fd = tonumber(fd)
+		if cmd == "open" then
+			owners[source] = (owners[source] or 0) + 1
+			received[fd] = {}
+			opened = opened + 1
+			if opened % 2 == 0 then
+				-- the command can be sent to the listening gate, it forwards it to the owner
+				direct[fd] = true
+				skynet.send(gate, "text", "direct " .. fd)
+			else
+				skynet.send(gate, "text", "start " .. fd)
+			end
+		elseif cmd == "direct" then
+			skynet.fork(read_direct, fd)
+		elseif cmd == "data" then
+			table.insert(received[fd], data)
+			check_done()
+		end
+	end,
+}
+
+local function client(i)
+	local id = assert(socket.open("127.0.0.1", PORT))
+	local stream = {}
+	for j = 1, PACKAGE do
+		stream[j] = string.pack(">s2", "client " .. i .. " package " .. j)
+	end
+	socket.write(id, table.concat(stream))
+	return id
+end
+
+skynet.start(function()
+	gate = skynet.launch("gate", string.format("S :%08x 127.0.0.1:%d 0 64 %d", skynet.self(), PORT, SHARD))
+	local clients = {}
+	for i = 1, CLIENT do
+		clients[i] = client(i)
+	end
+	waiting = coroutine.running()
+	skynet.wait(waiting)
+	local n = 0
+	for _ in pairs(owners) do
+		n = n + 1
+	end
+	local ndirect = 0
+	for fd, packages in pairs(received) do
+		for j = 1, PACKAGE do
+			assert(packages[j]:match "^client %d+ package (%d+)$" == tostring(j))
+		end
+		if direct[fd] then
+			ndirect = ndirect + 1
+		end
+	end
+	print(string.format("%d clients (%d direct) on %d gates, %d packages each ok", CLIENT, ndirect, n, PACKAGE))
+	assert(n == SHARD)
+	for _, id in ipairs(clients) do
+		socket.close(id)
+	end
+	skynet.kill(gate)
+	skynet.exit()
+end)
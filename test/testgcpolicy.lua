@@ -0,0 +1,65 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.kill
+
+-- a big service (a lot of live objects) handles the requests which make garbage.
+-- In the default mode the collector steps in the middle of the requests, in the idle mode it only runs between them.
+
+local N = 20000
+local mode = ...
+
+local function percentile(t, p)
+	table.sort(t)
+	return t[math.max(1, #t * p // 1)]
+end
+
+if mode == "server" then
+	local policy = select(2, ...)
+	skynet.start(function()
+		local data = {}
+		for i = 1, 200000 do
+			data[i] = { id = i, name = "item" .. i }
+		end
+		if policy == "idle" then
+			skynet.gcpolicy { idle = true, budget = 1 }
+		end
+		local cost = {}
+		skynet.dispatch("lua", function(_, _, cmd)
+			if cmd == "stat" then
+				skynet.ret(skynet.pack(percentile(cost, 0.99), percentile(cost, 1), skynet.stat "gc", collectgarbage "count"))
+				return
+			end
+			local ti = skynet.hpc()
+			local t = {}
+			for i = 1, 100 do
+				t[i] = { i, data[i].name }
+			end
+			cost[#cost+1] = skynet.hpc() - ti
+			skynet.ret()
+		end)
+	end)
+	return
+end
+
+local function test(policy)
+	local s = skynet.newservice(SERVICE_NAME, "server", policy)
+	local rtt = {}
+	local ti = skynet.hpc()
+	for i = 1, N do
+		local t = skynet.hpc()
+		skynet.call(s, "lua", "req")
+		rtt[i] = skynet.hpc() - t
+	end
+	ti = (skynet.hpc() - ti) / 1000000
+	local p99, max, gc, kb = skynet.call(s, "lua", "stat")
+	local stat = skynet.call(s, "debug", "STAT")
+	assert(stat.gc == gc and gc > 0)
+	print(string.format("%-7s %d requests %.0f ms, handler p99 %.1f us max %.1f us, rtt p99 %.1f us, gc %.1f ms, mem %.0f KB",
+		policy, N, ti, p99 / 1000, max / 1000, percentile(rtt, 0.99) / 1000, gc * 1000, kb))
+	skynet.kill(s)
+end
+
+skynet.start(function()
+	test "default"
+	test "idle"
+	skynet.exit()
+end)
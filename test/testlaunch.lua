@@ -0,0 +1,57 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.kill
+
+-- launch the services one by one (skynet.newservice), and at once (skynet.newservices).
+-- set snlua_pool = 1000 (N) in config to launch them from the prewarmed lua vm pool. The launcher refills the pool
+-- only while it's idle, so with a smaller pool (64) only the first launches of the burst are faster.
+
+local N = 1000
+local mode = ...
+
+if mode == "empty" then
+	skynet.start(function()
+		skynet.dispatch("lua", function()
+			skynet.ret(skynet.pack(skynet.self()))
+		end)
+	end)
+	return
+end
+
+local function wait_pool()
+	local snlua = require "skynet.snlua"
+	local n, size
+	repeat
+		skynet.sleep(10)
+		n, size = snlua.prewarm(0)
+	until n >= math.min(size, N)
+	return size
+end
+
+local function check(list)
+	for i = 1, N do
+		assert(skynet.call(list[i], "lua") == list[i])
+		skynet.kill(list[i])
+	end
+end
+
+skynet.start(function()
+	local size = wait_pool()
+	print("snlua pool", size)
+	local list = {}
+	local ti = skynet.hpc()
+	for i = 1, N do
+		list[i] = skynet.newservice(SERVICE_NAME, "empty")
+	end
+	ti = (skynet.hpc() - ti) / 1000000
+	print(string.format("newservice %d : %.1f ms, %.1f us each", N, ti, ti * 1000 / N))
+	check(list)
+
+	wait_pool()
+	ti = skynet.hpc()
+	list = skynet.newservices(N, SERVICE_NAME, "empty")
+	ti = (skynet.hpc() - ti) / 1000000
+	print(string.format("newservices %d : %.1f ms, %.1f us each", N, ti, ti * 1000 / N))
+	assert(#list == N)
+	check(list)
+	skynet.exit()
+end)
@@ -0,0 +1,81 @@
+local skynet = require "skynet"
+
+-- skynet.unpacklazy decodes the fields of a table on access, and a lazy table is forwarded (packed) by copying the bytes.
+-- Compare routing a large request by one field : unpack + pack vs unpacklazy + pack.
+
+local N = 2000
+
+local records = {}
+for i = 1, 1000 do
+	records[i] = { uid = i, name = "player" .. i, items = { i, i + 1, i + 2 } }
+end
+local request = { cmd = "sync", target = 42, records = records, extra = { [1.5] = "float key", [true] = "bool key" } }
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local function check()
+	local msg, sz = skynet.pack("route", request, 1, nil, "tail")
+	local cmd, lazy, n, none, tail = skynet.unpacklazy(msg, sz)
+	skynet.trash(msg, sz)
+	assert(cmd == "route" and n == 1 and none == nil and tail == "tail")
+	assert(type(lazy) == "userdata")
+	assert(lazy.cmd == "sync" and lazy.target == 42 and lazy.missing == nil)
+	assert(#lazy.records == 1000 and lazy.records[500].name == "player500" and lazy.records[500].items[3] == 502)
+	assert(lazy.extra[1.5] == "float key" and lazy.extra[true] == "bool key")
+	local t = {}
+	for k, v in pairs(lazy) do
+		t[k] = v
+	end
+	assert(equal(t, request))
+	assert(not pcall(function() lazy.cmd = "x" end))
+	-- forward the lazy table, and the nested one
+	local r = table.pack(skynet.unpack(skynet.packstring(lazy, lazy.records[7])))
+	assert(equal(r[1], request) and equal(r[2], records[7]))
+	-- the dictionary mode can't be skipped, it's unpacked eagerly
+	r = skynet.unpacklazy(skynet.packdict(lazy))
+	assert(type(r) == "table" and equal(r, request))
+end
+
+local function bench(name, unpack)
+	local msg, sz = skynet.pack("route", request)
+	local t = skynet.hpc()
+	for i = 1, N do
+		local cmd, req = unpack(msg, sz)
+		assert(req.target == 42)
+		local m, s = skynet.pack(cmd, req)
+		skynet.trash(m, s)
+	end
+	t = (skynet.hpc() - t) / N
+	skynet.trash(msg, sz)
+	print(string.format("%-8s route %d bytes : %.0f ns", name, sz, t))
+end
+
+skynet.start(function()
+	check()
+	bench("unpack", skynet.unpack)
+	bench("lazy", skynet.unpacklazy)
+	-- lazydispatch : the requests of this service are lazy
+	skynet.lazydispatch("lua", function(_, _, cmd, req)
+		assert(cmd == "route" and type(req) == "userdata")
+		skynet.ret(skynet.pack(req.target, req))
+	end)
+	local target, req = skynet.call(skynet.self(), "lua", "route", request)
+	assert(target == 42 and type(req) == "table" and equal(req, request))
+	print("lazydispatch ok")
+	skynet.exit()
+end)
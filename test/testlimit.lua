@@ -0,0 +1,137 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- test the send buffer high-water mark policies and the rate limit of socket.limit
+-- The slow reader is a bash process (linux only), it connects, sleeps 1s, then reads all.
+
+local mode = ...
+
+local PORT = 8014
+local BLOCK = string.rep("x", 64 * 1024)
+local COUNT = 256	-- 16M in total
+local HWM = 1024 * 1024
+
+if mode == "server" then
+
+local function write_all(id, write)
+	for i=1,COUNT do
+		write(id, BLOCK)
+	end
+end
+
+local policy = {}
+
+function policy.drop(id)
+	socket.limit(id, HWM, "drop")
+	socket.write(id, BLOCK)
+	write_all(id, socket.lwrite)
+end
+
+function policy.close(id)
+	socket.limit(id, HWM, "close")
+	write_all(id, socket.write)
+end
+
+function policy.pause(id)
+	local co
+	local warnings = {}
+	socket.limit(id, HWM, "pause")
+	socket.warning(id, function(_, size)
+		table.insert(warnings, size)
+		if size == 0 and co then
+			skynet.wakeup(co)
+		end
+	end)
+	for i=1,COUNT do
+		socket.write(id, BLOCK)
+		skynet.sleep(0)	-- the warning message can be dispatched
+		if #warnings > 0 and warnings[#warnings] > 0 then
+			-- backpressure, wait until the buffer is empty
+			co = coroutine.running()
+			skynet.wait(co)
+			co = nil
+		end
+	end
+	while warnings[#warnings] ~= 0 do
+		co = coroutine.running()
+		skynet.wait(co)
+		co = nil
+	end
+	return #warnings
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, name)
+		local lid = socket.listen("127.0.0.1", PORT)
+		local co = coroutine.running()
+		local ret
+		socket.start(lid, function(id)
+			socket.start(id)
+			ret = policy[name](id) or 0
+			socket.close(id)
+			skynet.wakeup(co)
+		end)
+		skynet.wait(co)
+		socket.close(lid)
+		skynet.ret(skynet.pack(ret))
+	end)
+end)
+
+else
+
+local function slow_reader()
+	local f = io.popen(string.format("bash -c 'exec 3<>/dev/tcp/127.0.0.1/%d; sleep 1; cat <&3 | wc -c'", PORT))
+	local n = tonumber(f:read "a")
+	f:close()
+	return n
+end
+
+local function test_policy(name)
+	local server = skynet.newservice(SERVICE_NAME, "server")
+	local ret
+	skynet.fork(function()
+		ret = skynet.call(server, "lua", name)
+	end)
+	skynet.sleep(10)	-- wait for listening
+	local n = slow_reader()
+	while ret == nil do
+		skynet.sleep(1)
+	end
+	skynet.kill(server)
+	print(string.format("policy %s : recv %d/%d bytes %s", name, n, (COUNT+1) * #BLOCK, ret > 0 and ("warnings " .. ret) or ""))
+	return n
+end
+
+local function test_rate()
+	local RATE = 200 * 1024
+	local SIZE = 400 * 1024
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.start(lid, function(id)
+		socket.start(id)
+		socket.limit(id, 0, "drop", RATE)
+		socket.write(id, string.rep("y", SIZE))
+		socket.close(id)
+	end)
+	local id = assert(socket.open("127.0.0.1", PORT))
+	local start = skynet.now()
+	local r = socket.readall(id)
+	local ti = skynet.now() - start
+	socket.close(id)
+	socket.close(lid)
+	print(string.format("rate %d bytes/s : recv %d bytes in %d cs", RATE, #r, ti))
+	assert(#r == SIZE)
+	-- 400K at 200K/s should take about 2s
+	assert(ti >= 150 and ti < 300)
+end
+
+skynet.start(function()
+	require "skynet.manager"
+	local total = (COUNT + 1) * #BLOCK
+	assert(test_policy "drop" < total)
+	assert(test_policy "close" < total)
+	assert(test_policy "pause" == COUNT * #BLOCK)
+	test_rate()
+	skynet.exit()
+end)
+
+end
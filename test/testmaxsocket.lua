@@ -0,0 +1,73 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- the socket slots are allocated in segments of 4096 (socket_server.c). Open more udp sockets than one segment,
+-- close them and open them again : the closed slots are reused with new ids, and no more segment is allocated.
+-- set maxsocket = 4096 (or less) in config to check the limit instead.
+
+local N = 4096 + 100
+local SEGMENT = 4096
+local MAX = tonumber(skynet.getenv "maxsocket") or 65536
+
+local function open(n)
+	local ids = {}
+	for i = 1, n do
+		local ok, id = pcall(socket.udp, function() end, "127.0.0.1", 0)
+		if not ok then
+			return ids, id
+		end
+		ids[i] = id
+	end
+	return ids
+end
+
+local function close(ids)
+	for _, id in ipairs(ids) do
+		socket.close(id)
+	end
+end
+
+skynet.start(function()
+	-- maxsocket is rounded up to a power of 2, the slot of an id is id & mask
+	local p = 8
+	while p < 24 and (1 << p) < MAX do
+		p = p + 1
+	end
+	local mask = (1 << p) - 1
+	local base = #socket.netstat()
+
+	local ids, err = open(N)
+	if #ids < N then
+		assert(err:find "udp init failed" and base + #ids == mask + 1, err)
+		print(string.format("maxsocket %d : %d sockets opened, then %s", MAX, #ids, err))
+		close(ids)
+		skynet.exit()
+		return
+	end
+	local slots = {}
+	for _, id in ipairs(ids) do
+		local slot = id & mask
+		assert(slots[slot] == nil)
+		slots[slot] = id
+	end
+	close(ids)
+	assert(#socket.netstat() == base)
+
+	local again = open(N)
+	assert(#again == N)
+	local reused = 0
+	for _, id in ipairs(again) do
+		local slot = id & mask
+		assert(slot < 2 * SEGMENT, "allocate a new segment")
+		local old = slots[slot]
+		if old then
+			-- the same slot gets a new id
+			assert(id ~= old and (id - old) & mask == 0)
+			reused = reused + 1
+		end
+	end
+	close(again)
+	assert(#socket.netstat() == base)
+	print(string.format("%d sockets opened twice, %d slots reused", N, reused))
+	skynet.exit()
+end)
@@ -0,0 +1,53 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"	-- import skynet.kill
+
+-- a burst of small packages in one write : the lua gate queues them in the netpack ring (it expands a few times),
+-- then pops them in batches (netpack.popn), and they should be dispatched in order
+
+local PORT = 8022
+local PACKAGE = 5000
+
+local received = {}
+local waiting
+local gate
+local CMD = {}
+
+function CMD.open(fd)
+	skynet.send(gate, "lua", "accept", fd)
+end
+
+function CMD.data(fd, msg)
+	table.insert(received, msg)
+	if #received == PACKAGE then
+		skynet.wakeup(waiting)
+	end
+end
+
+function CMD.close() end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, cmd, subcmd, ...)
+		if cmd == "socket" then
+			CMD[subcmd](...)
+		end
+	end)
+	gate = skynet.newservice("gate")
+	skynet.call(gate, "lua", "open", { address = "127.0.0.1", port = PORT, watchdog = skynet.self() })
+	local id = assert(socket.open("127.0.0.1", PORT))
+	local stream = {}
+	for i = 1, PACKAGE do
+		stream[i] = string.pack(">s2", tostring(i))
+	end
+	socket.write(id, table.concat(stream))
+	waiting = coroutine.running()
+	skynet.wait(waiting)
+	for i = 1, PACKAGE do
+		assert(received[i] == tostring(i), i)
+	end
+	print(PACKAGE, "packages ok")
+	socket.close(id)
+	skynet.call(gate, "lua", "close")
+	skynet.kill(gate)
+	skynet.exit()
+end)
@@ -0,0 +1,74 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- check the counters of socket.netstat and the histograms, and print the netstat command of debug_console
+
+local PORT = 8017
+local CONSOLE = 8018
+
+local function find(id)
+	for _, v in ipairs(socket.netstat()) do
+		if v.id == id then
+			return v
+		end
+	end
+end
+
+local function console(cmd)
+	local id = assert(socket.open("127.0.0.1", CONSOLE))
+	socket.write(id, cmd .. "\n")
+	local lines = {}
+	while true do
+		local line = assert(socket.readline(id))
+		if line == "<CMD OK>" or line == "<CMD Error>" then
+			break
+		end
+		if line ~= "Welcome to skynet console" then
+			table.insert(lines, line)
+		end
+	end
+	socket.close(id)
+	return lines
+end
+
+skynet.start(function()
+	skynet.newservice("debug_console", CONSOLE)
+	local server
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.start(lid, function(id)
+		server = id
+		socket.start(id)
+		for i = 1, 100 do
+			socket.write(id, string.rep("x", i * 100))
+		end
+	end)
+	local id = assert(socket.open("127.0.0.1", PORT))
+	local total = 0
+	for i = 1, 100 do
+		total = total + i * 100
+	end
+	assert(#socket.read(id, total) == total)
+	local s = find(server)
+	local c = find(id)
+	print(string.format("server : wpacket %d wcall %d eagain %d wbmax %d wqueue %d", s.wpacket, s.wcall, s.eagain, s.wbmax, s.wqueue))
+	print(string.format("client : rpacket %d rcall %d read %d", c.rpacket, c.rcall, c.read))
+	assert(s.wpacket == 100 and s.wqueue == 0 and s.write == total)
+	assert(c.read == total and c.rpacket > 0 and c.rcall >= c.rpacket)
+
+	local hist = socket.histogram()
+	local reads = 0
+	for _, n in ipairs(hist.rsize) do
+		reads = reads + n
+	end
+	assert(reads >= c.rpacket)
+
+	for _, line in ipairs(console "netstat write 2") do
+		print(line)
+	end
+	for _, line in ipairs(console "netstat histogram") do
+		print(line)
+	end
+	socket.close(id)
+	socket.close(lid)
+	skynet.exit()
+end)
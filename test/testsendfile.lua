@@ -0,0 +1,123 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+local FILE = "lualib/skynet.lua"
+local FILE_PORT = 8004
+local ECHO_PORT = 8005
+local PROXY_PORT = 8006
+local SLOW_PORT = 8007
+local SLOW_PROXY_PORT = 8008
+
+local function readfile(filename)
+	local f = assert(io.open(filename, "rb"))
+	local content = f:read "a"
+	f:close()
+	return content
+end
+
+local function file_server()
+	local lid = socket.listen("127.0.0.1", FILE_PORT)
+	socket.start(lid, function(id)
+		socket.start(id)
+		socket.write(id, "HEAD")
+		assert(socket.sendfile(id, FILE))
+		assert(socket.sendfile(id, FILE, 10, 20))
+		socket.write(id, "TAIL")
+		socket.close(id)
+	end)
+end
+
+local function echo_server()
+	local lid = socket.listen("127.0.0.1", ECHO_PORT)
+	socket.start(lid, function(id)
+		socket.start(id)
+		skynet.fork(function()
+			while true do
+				local str = socket.read(id)
+				if not str then
+					socket.close(id)
+					return
+				end
+				socket.write(id, str)
+			end
+		end)
+	end)
+end
+
+local function proxy_server()
+	local lid = socket.listen("127.0.0.1", PROXY_PORT)
+	socket.start(lid, function(id)
+		local upstream = assert(socket.open("127.0.0.1", ECHO_PORT))
+		socket.proxy(id, upstream)
+	end)
+end
+
+-- the upstream of this proxy reads nothing until it's told
+local slow = {}
+local function slow_proxy_server()
+	local lid = socket.listen("127.0.0.1", SLOW_PORT)
+	socket.start(lid, function(id)
+		slow.id = id
+	end)
+	lid = socket.listen("127.0.0.1", SLOW_PROXY_PORT)
+	socket.start(lid, function(id)
+		slow.upstream = assert(socket.open("127.0.0.1", SLOW_PORT))
+		socket.proxy(id, slow.upstream)
+	end)
+end
+
+local function netstat(id)
+	for _, v in ipairs(socket.netstat()) do
+		if v.id == id then
+			return v
+		end
+	end
+end
+
+-- the proxy stops reading the client while the send buffer of the upstream is full, instead of buffering all the data
+local function test_backpressure()
+	local BIG = 16 * 1024 * 1024
+	local id = assert(socket.open("127.0.0.1", SLOW_PROXY_PORT))
+	local chunk = string.rep("x", 64 * 1024)
+	for i = 1, BIG // #chunk do
+		socket.write(id, chunk)
+	end
+	skynet.sleep(100)
+	local info = netstat(slow.upstream)
+	assert(info.wbmax > 0 and info.wbmax <= 512 * 1024, info.wbmax)	-- half of the warning size
+	print("proxy backpressure : upstream buffer max", info.wbmax, "client buffer", netstat(id).wbuffer)
+	socket.start(slow.id)
+	assert(#socket.read(slow.id, BIG) == BIG)
+	-- the upstream closes, so does the client side of the proxy
+	socket.close(slow.id)
+	assert(socket.read(id) == false)
+	socket.close(id)
+	skynet.sleep(10)
+	assert(netstat(slow.upstream) == nil)
+	print("proxy close ok")
+end
+
+skynet.start(function()
+	file_server()
+	echo_server()
+	proxy_server()
+	slow_proxy_server()
+
+	local content = readfile(FILE)
+	local id = assert(socket.open("127.0.0.1", FILE_PORT))
+	local r = socket.readall(id)
+	socket.close(id)
+	assert(r == "HEAD" .. content .. content:sub(11, 30) .. "TAIL")
+	print("sendfile", #r, "bytes ok")
+
+	local id = assert(socket.open("127.0.0.1", PROXY_PORT))
+	for i = 1, 10 do
+		local msg = "hello " .. i
+		socket.write(id, msg)
+		assert(socket.read(id, #msg) == msg)
+	end
+	socket.close(id)
+	print("proxy ok")
+	test_backpressure()
+	skynet.exit()
+end)
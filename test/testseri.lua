@@ -0,0 +1,120 @@
+local skynet = require "skynet"
+
+-- benchmark skynet.pack / skynet.unpack over typical rpc payloads, and check they round trip
+-- skynet.packdict (dictionary mode) is compared with skynet.pack for the arrays of records
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local array = {}
+for i = 1, 1000 do
+	array[i] = i * 7
+end
+
+local records = {}
+for i = 1, 100 do
+	records[i] = { uid = 10000 + i, level = i % 60, name = "player" .. i, online = i % 2 == 0, pos = { x = i * 1.5, y = -i } }
+end
+
+local payloads = {
+	{ name = "small tuple", n = 200000, args = { "set", 1001, "hello world", true } },
+	{ name = "1k array", n = 5000, args = { array } },
+	{ name = "nested records", n = 5000, args = { { cmd = "sync", records = records } } },
+	{ name = "large string", n = 2000, args = { string.rep("x", 256 * 1024) } },
+}
+
+local function bench(p, pack)
+	pack = pack or skynet.pack
+	local args = p.args
+	local msg, sz = pack(table.unpack(args))
+	local r = table.pack(skynet.unpack(msg, sz))
+	skynet.trash(msg, sz)
+	assert(r.n == #args and equal(args, { table.unpack(r, 1, r.n) }), p.name)
+	r = table.pack(skynet.unpack(skynet.packstring(table.unpack(args))))
+	assert(equal(args, { table.unpack(r, 1, r.n) }), p.name)
+
+	local t = skynet.hpc()
+	for i = 1, p.n do
+		msg, sz = pack(table.unpack(args))
+		skynet.trash(msg, sz)
+	end
+	local pack_time = (skynet.hpc() - t) / p.n
+	msg, sz = pack(table.unpack(args))
+	t = skynet.hpc()
+	for i = 1, p.n do
+		skynet.unpack(msg, sz)
+	end
+	local unpack = (skynet.hpc() - t) / p.n
+	skynet.trash(msg, sz)
+	print(string.format("%-16s size %8d  pack %10.0f ns  unpack %10.0f ns", p.name, sz, pack_time, unpack))
+end
+
+-- many distinct keys : the indexes need the following integer, and the dictionary becomes full
+local wide = {}
+for i = 1, 2000 do
+	wide["key" .. i] = { "key" .. (i % 50), i }
+end
+
+local dict_payloads = {
+	{ name = "records", n = 5000, args = { records } },
+	{ name = "records dict", n = 5000, args = { records }, pack = skynet.packdict },
+	{ name = "wide", n = 200, args = { wide } },
+	{ name = "wide dict", n = 200, args = { wide }, pack = skynet.packdict },
+}
+
+-- __pairs makes fresh strings and runs the gc during packdict, a collected string must not be
+-- mistaken for a new one allocated at the same address
+local function test_gc_pairs()
+	local N = 200
+	local proxy = setmetatable({}, { __pairs = function()
+		return function(_, k)
+			local i = (k and tonumber(k:sub(2)) or 0) + 1
+			if i <= N then
+				collectgarbage()
+				return string.format("k%d", i), string.format("v%d", i)
+			end
+		end
+	end })
+	-- the strings of the result are checked without keeping them, so they are garbage in the next pack
+	local function check(t)
+		local n = 0
+		for k, v in pairs(t) do
+			assert(k:sub(2) == v:sub(2) and k:sub(1,1) == "k" and v:sub(1,1) == "v", k)
+			n = n + 1
+		end
+		assert(n == N)
+	end
+	for i = 1, 10 do
+		local r = table.pack(skynet.unpack(skynet.packdict(proxy, proxy)))
+		assert(r.n == 2)
+		check(r[1])
+		check(r[2])
+		r = nil
+	end
+	print("packdict with __pairs ok")
+end
+
+skynet.start(function()
+	test_gc_pairs()
+	for _, p in ipairs(payloads) do
+		bench(p)
+	end
+	for _, p in ipairs(dict_payloads) do
+		bench(p, p.pack)
+	end
+	skynet.exit()
+end)
@@ -0,0 +1,135 @@
+local skynet = require "skynet"
+
+-- the sessions waiting for response are kept in c (lua-skynet.c), the callback finds the coroutine of a response
+
+local N = 100000
+local CONCURRENT = 1000
+local mode = ...
+
+if mode == "slave" then
+	skynet.start(function()
+		skynet.dispatch("lua", function(_, _, cmd, n)
+			if cmd == "sleep" then
+				skynet.sleep(n)
+			end
+			skynet.ret(skynet.pack(n))
+		end)
+	end)
+	return
+end
+
+-- the filter swaps the responses of two calls, the coroutine popped with the original session must not be lost
+if mode == "filter" then
+	require "skynet.manager"	-- import skynet.filter
+	local slave = tonumber(select(2, ...))
+	local a, b
+	skynet.filter(function(ptype, msg, sz, session, source)
+		if ptype == skynet.PTYPE_RESPONSE and a and (session == a or session == b) then
+			session = session == a and b or a
+		end
+		return ptype, msg, sz, session, source
+	end, function()
+		local r1, r2
+		local co1 = skynet.fork(function() r1 = skynet.call(slave, "lua", "sleep", 10) end)
+		local co2 = skynet.fork(function() r2 = skynet.call(slave, "lua", "sleep", 20) end)
+		skynet.yield()
+		a, b = skynet.task(co1), skynet.task(co2)
+		assert(a and b)
+		skynet.sleep(40)
+		assert(r1 == 20 and r2 == 10, "filter lost a coroutine")
+		-- a session woken by skynet.wakeup is put back as "BREAK"
+		local c = require "skynet.core"
+		c.waitsession(a, "BREAK")
+		assert(skynet.task(a):match "^BREAK" and c.popsession(a) == "BREAK")
+		assert(skynet.task() == 0)
+		print("filter ok")
+	end)
+	return
+end
+
+-- many sessions wait at the same time and are responded out of order
+local function test_concurrent(slave)
+	local co = coroutine.running()
+	local done = 0
+	for i = 1, CONCURRENT do
+		skynet.fork(function()
+			assert(skynet.call(slave, "lua", "sleep", i % 7) == i % 7)
+			done = done + 1
+			if done == CONCURRENT then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.yield()
+	local n = skynet.task()
+	local t = {}
+	skynet.task(t)
+	local m = 0
+	for session, traceback in pairs(t) do
+		assert(type(traceback) == "string")
+		m = m + 1
+	end
+	assert(n == m and n > 0 and n <= CONCURRENT)
+	skynet.wait(co)
+	assert(done == CONCURRENT)
+	print("concurrent ok", n)
+end
+
+local function test_wakeup()
+	local token = {}
+	local r
+	local co = skynet.fork(function()
+		r = skynet.sleep(10, token)
+	end)
+	skynet.yield()
+	local session = skynet.task(co)
+	assert(session and skynet.task(session) ~= "No session")
+	skynet.wakeup(token)
+	skynet.yield()
+	assert(r == "BREAK")
+	-- the timer responds later, and it's dropped
+	assert(skynet.task(session):match "^BREAK")
+	print("wakeup ok")
+end
+
+-- rpc/s depends on the slave and the scheduler, the cpu time of this service (the caller) is the cost of dispatching
+local function bench(slave)
+	local cpu = skynet.stat "cpu"
+	local ti = skynet.hpc()
+	for i = 1, N do
+		skynet.call(slave, "lua", "echo", i)
+	end
+	ti = (skynet.hpc() - ti) / 1000000000
+	cpu = skynet.stat "cpu" - cpu
+	print(string.format("%d calls : %.0f rpc/s, caller cpu %.2f us/call", N, N / ti, cpu * 1000000 / N))
+
+	local co = coroutine.running()
+	local done = 0
+	cpu = skynet.stat "cpu"
+	ti = skynet.hpc()
+	for i = 1, 100 do
+		skynet.fork(function()
+			for j = 1, N // 100 do
+				skynet.call(slave, "lua", "echo", j)
+			end
+			done = done + 1
+			if done == 100 then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	ti = (skynet.hpc() - ti) / 1000000000
+	cpu = skynet.stat "cpu" - cpu
+	print(string.format("%d calls in 100 forks : %.0f rpc/s, caller cpu %.2f us/call", N, N / ti, cpu * 1000000 / N))
+end
+
+skynet.start(function()
+	local slave = skynet.newservice(SERVICE_NAME, "slave")
+	test_concurrent(slave)
+	test_wakeup()
+	skynet.newservice(SERVICE_NAME, "filter", slave)
+	bench(slave)
+	assert(skynet.task() == 0)
+	skynet.exit()
+end)
@@ -0,0 +1,102 @@
+local skynet = require "skynet"
+local sharetable = require "skynet.sharetable"
+
+-- the memory of the agents which copy the config table in their own vm, and the agents which share it
+
+local AGENT = 50
+local mode = ...
+
+local config = [[
+local items = {}
+for i = 1, 2000 do
+	items[i] = {
+		id = i,
+		name = "item" .. i,
+		desc = string.rep("long description ", 4) .. i,
+		attrs = { hp = i * 10, atk = i, tags = { "weapon", "rare" } },
+	}
+end
+return { items = items, version = "1.0" }
+]]
+
+local function checksum(c)
+	local sum = 0
+	for _, item in ipairs(c.items) do
+		assert(item.name == "item" .. item.id)
+		sum = sum + item.attrs.hp + item.attrs.atk + #item.desc + #item.attrs.tags
+	end
+	return sum
+end
+
+if mode == "agent" then
+	local share = select(2, ...) == "share"
+	skynet.start(function()
+		local c
+		if share then
+			c = sharetable.query "config"
+		else
+			c = load(config)()
+		end
+		local sum = checksum(c)
+		collectgarbage()
+		skynet.dispatch("lua", function()
+			skynet.ret(skynet.pack(collectgarbage "count", sum))
+		end)
+	end)
+	return
+end
+
+local function agents(how)
+	local kb = 0
+	local sum
+	local list = {}
+	for i = 1, AGENT do
+		list[i] = skynet.newservice(SERVICE_NAME, "agent", how)
+	end
+	for i = 1, AGENT do
+		local k, s = skynet.call(list[i], "lua")
+		kb = kb + k
+		assert(sum == nil or sum == s)
+		sum = s
+		skynet.kill(list[i])
+	end
+	return kb / AGENT, sum
+end
+
+skynet.start(function()
+	require "skynet.manager"	-- import skynet.kill
+	local local_key = "version"	-- a string of this vm before sharing
+	sharetable.new("config", config)
+	local c = sharetable.query "config"
+	assert(c[local_key] == "1.0" and #c.items == 2000)
+	local n = 0
+	for k, v in pairs(c) do
+		if k == local_key then
+			n = n + 1
+		end
+	end
+	assert(n == 1)
+	-- any write to a shared table is an error
+	local function readonly(f, ...)
+		local ok, err = pcall(f, ...)
+		assert(not ok and err:find "attempt to modify a shared table", err)
+	end
+	readonly(function() c.newkey = true end)
+	readonly(function() c.version = "2.0" end)
+	readonly(function() c.items[1].id = 0 end)
+	readonly(rawset, c, "version", "2.0")
+	readonly(rawset, c.items, 1, false)
+	readonly(table.insert, c.items, false)
+	readonly(setmetatable, c, {})
+	assert(c.version == "1.0" and c.items[1].id == 1 and #c.items == 2000 and getmetatable(c) == nil)
+	assert(not pcall(sharetable.new, "func", { f = print }))
+	local t = { x = 1 }
+	sharetable.new("t", t)
+	assert(sharetable.query "t".x == 1)
+
+	local copy_kb, copy_sum = agents "copy"
+	local share_kb, share_sum = agents "share"
+	assert(copy_sum == share_sum)
+	print(string.format("%d agents, per agent : copy %.1f KB, share %.1f KB", AGENT, copy_kb, share_kb))
+	skynet.exit()
+end)
@@ -0,0 +1,161 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local redis = require "skynet.db.redis"
+local internal = require "http.internal"
+local sockethelper = require "http.sockethelper"
+
+-- benchmark the socket buffer (socket.read / socket.readline) with the parsing patterns of the db drivers :
+-- the redis driver against a fake redis server (lrange replies many bulk strings, parsed by readline and read),
+-- the mysql packets (4 bytes header then the body) in a stream written in fragments,
+-- a long line received in many fragments (readline goes on from the last searched position),
+-- and a http chunked body of many chunks parsed by http.internal.
+
+local REDIS_PORT = 8023
+local MYSQL_PORT = 8024
+local REDIS_ITEM = 1000
+local REDIS_REQUEST = 200
+local MYSQL_PACKET = 100000
+local LINE_PORT = 8025
+local LINE_SIZE = 4 * 1024 * 1024
+local HTTP_PORT = 8026
+local HTTP_CHUNK = 20000
+
+local function fake_redis(id)
+	socket.start(id)
+	local items = { "*" .. REDIS_ITEM }
+	for i = 1, REDIS_ITEM do
+		local v = string.format("value%05d", i)
+		table.insert(items, "$" .. #v)
+		table.insert(items, v)
+	end
+	table.insert(items, "")
+	local reply = table.concat(items, "\r\n")
+	while true do
+		local line = socket.readline(id, "\r\n")
+		if not line then
+			return
+		end
+		local n = assert(tonumber(line:match "^%*(%d+)"))
+		local cmd
+		for i = 1, n do
+			local len = tonumber(socket.readline(id, "\r\n"):sub(2))
+			local arg = socket.read(id, len + 2)
+			cmd = cmd or arg:sub(1, -3)
+		end
+		if cmd == "LRANGE" then
+			socket.write(id, reply)
+		else
+			socket.write(id, "+OK\r\n")
+		end
+	end
+end
+
+local function bench_redis()
+	local lid = socket.listen("127.0.0.1", REDIS_PORT)
+	socket.start(lid, function(id)
+		skynet.fork(fake_redis, id)
+	end)
+	local db = redis.connect { host = "127.0.0.1", port = REDIS_PORT }
+	assert(db:set("key", "value") == "OK")
+	local t = skynet.hpc()
+	for i = 1, REDIS_REQUEST do
+		local r = db:lrange("list", 0, -1)
+		assert(#r == REDIS_ITEM and r[REDIS_ITEM] == string.format("value%05d", REDIS_ITEM))
+	end
+	t = (skynet.hpc() - t) / 1e6
+	print(string.format("redis : %d lrange of %d items, %.1f ms", REDIS_REQUEST, REDIS_ITEM, t))
+	db:disconnect()
+	socket.close(lid)
+end
+
+local function bench_mysql()
+	local lid = socket.listen("127.0.0.1", MYSQL_PORT)
+	socket.start(lid, function(id)
+		socket.start(id)
+		local packets = {}
+		for i = 1, MYSQL_PACKET do
+			local body = string.rep("x", i % 97)
+			packets[i] = string.pack("<I3B", #body, i & 0xff) .. body
+		end
+		local stream = table.concat(packets)
+		-- write in fragments which split the headers and the bodies
+		local offset = 1
+		while offset <= #stream do
+			socket.write(id, stream:sub(offset, offset + 1500))
+			offset = offset + 1501
+		end
+	end)
+	local id = assert(socket.open("127.0.0.1", MYSQL_PORT))
+	local t = skynet.hpc()
+	for i = 1, MYSQL_PACKET do
+		local header = socket.read(id, 4)
+		local len, seq = string.unpack("<I3B", header)
+		assert(len == i % 97 and seq == i & 0xff)
+		if len > 0 then
+			socket.read(id, len)
+		end
+	end
+	t = (skynet.hpc() - t) / 1e6
+	print(string.format("mysql : %d packets, %.1f ms", MYSQL_PACKET, t))
+	socket.close(id)
+	socket.close(lid)
+end
+
+-- write str in fragments, and yield between them, so the receiver gets many small messages
+local function write_fragments(id, str, sz)
+	local offset = 1
+	while offset <= #str do
+		socket.write(id, str:sub(offset, offset + sz - 1))
+		offset = offset + sz
+		if offset % (sz * 16) < sz then
+			skynet.sleep(0)
+		end
+	end
+end
+
+local function bench_line()
+	local line = string.rep("x", LINE_SIZE)
+	local lid = socket.listen("127.0.0.1", LINE_PORT)
+	socket.start(lid, function(id)
+		socket.start(id)
+		write_fragments(id, "+" .. line .. "\r\n", 1500)
+	end)
+	local id = assert(socket.open("127.0.0.1", LINE_PORT))
+	local t = skynet.hpc()
+	local r = socket.readline(id, "\r\n")
+	t = (skynet.hpc() - t) / 1e6
+	assert(r == "+" .. line)
+	print(string.format("line : %dK in 1500 bytes fragments, %.1f ms", LINE_SIZE // 1024, t))
+	socket.close(id)
+	socket.close(lid)
+end
+
+local function bench_http()
+	local chunk = string.rep("y", 200)
+	local lid = socket.listen("127.0.0.1", HTTP_PORT)
+	socket.start(lid, function(id)
+		socket.start(id)
+		local body = {}
+		for i = 1, HTTP_CHUNK do
+			body[i] = string.format("%x\r\n%s\r\n", #chunk, chunk)
+		end
+		table.insert(body, "0\r\n\r\n")
+		write_fragments(id, table.concat(body), 4096)
+	end)
+	local id = assert(socket.open("127.0.0.1", HTTP_PORT))
+	local t = skynet.hpc()
+	local body = internal.recvchunkedbody(sockethelper.readfunc(id), nil, {}, "")
+	t = (skynet.hpc() - t) / 1e6
+	assert(body == string.rep(chunk, HTTP_CHUNK))
+	print(string.format("http : %d chunks, %.1f ms", HTTP_CHUNK, t))
+	socket.close(id)
+	socket.close(lid)
+end
+
+skynet.start(function()
+	bench_redis()
+	bench_mysql()
+	bench_line()
+	bench_http()
+	skynet.exit()
+end)
@@ -0,0 +1,72 @@
+local skynet = require "skynet"
+local sproto = require "sproto"
+
+-- the protocol of examples/proto.lua : the client requests, the agent dispatches and responds (see examples/agent.lua)
+package.path = "./examples/?.lua;" .. package.path
+local proto = require "proto"
+
+local N = 100000
+
+local function padding(s)
+	local n = #s % 8
+	if n == 0 then
+		return s
+	end
+	return s .. string.rep("\0", 8 - n)
+end
+
+-- 0 pack of strings with zeros, runs of nonzero bytes (0xff segments) and odd sizes
+local function test_pack()
+	math.randomseed(0)
+	for i = 1, 1000 do
+		local t = {}
+		local sz = math.random(0, 4096)
+		local zero = math.random()
+		for j = 1, sz do
+			t[j] = math.random() < zero and 0 or math.random(1, 255)
+		end
+		local s = string.char(table.unpack(t))
+		local p = sproto.pack(s)
+		assert(sproto.unpack(p) == padding(s))
+		if i % 2 == 0 then
+			local h = math.random(0, sz)
+			assert(sproto.pack(s:sub(1, h), s:sub(h + 1)) == p)
+		end
+	end
+	print("pack/unpack ok")
+end
+
+local function test_rpc()
+	-- agent side
+	local host = sproto.new(proto.c2s):host "package"
+	-- client side
+	local client = sproto.new(proto.s2c):host "package"
+	local request = client:attach(sproto.new(proto.c2s))
+
+	local value = string.rep("value", 10)
+	local ti = skynet.hpc()
+	for i = 1, N do
+		local msg = request("set", { what = "key" .. i, value = value })
+		local type, name, args, response = host:dispatch(msg)
+		assert(type == "REQUEST" and name == "set" and args.what == "key" .. i and args.value == value and response == nil)
+
+		msg = request("get", { what = "key" .. i }, i)
+		type, name, args, response = host:dispatch(msg)
+		assert(name == "get" and args.what == "key" .. i)
+		msg = response { result = value }
+
+		local session, result
+		type, session, result = client:dispatch(msg)
+		assert(type == "RESPONSE" and session == i and result.result == value)
+	end
+	ti = (skynet.hpc() - ti) / 1000000
+	print(string.format("%d set/get rpc : %.1f ms, %.2f us/message", N, ti, ti * 1000 / (N * 3)))
+end
+
+skynet.start(function()
+	test_pack()
+	test_rpc()
+	local ok = pcall(sproto.new(proto.c2s).decode, sproto.new(proto.c2s), "package", "", 1)
+	assert(not ok)
+	skynet.exit()
+end)
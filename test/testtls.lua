@@ -0,0 +1,85 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- tls echo in the socket thread, skynet must be built with tls : make linux TLS_LIB=/usr/lib TLS_INC=/usr/include
+-- The self-signed certificates are generated by the openssl command line.
+
+local PORT = 8015
+local DIR = "/tmp/skynet_testtls"
+
+local function gencert(name)
+	local cert = DIR .. "/" .. name .. ".pem"
+	local key = DIR .. "/" .. name .. ".key"
+	assert(os.execute(string.format("openssl req -x509 -newkey rsa:2048 -nodes -keyout %s -out %s -days 1 -subj /CN=%s -addext subjectAltName=IP:127.0.0.1 2>/dev/null",
+		key, cert, name)), "openssl failed")
+	return cert, key
+end
+
+local function tls_state(id)
+	for _, v in ipairs(socket.netstat()) do
+		if v.id == id then
+			return v.tls
+		end
+	end
+end
+
+local function echo(opts, size)
+	local id, err = socket.open("127.0.0.1", PORT, opts)
+	if not id then
+		return nil, err
+	end
+	for i = 1, 10 do
+		local msg = "hello " .. i
+		socket.write(id, msg)
+		assert(socket.read(id, #msg) == msg)
+	end
+	local data = string.rep("0123456789abcdef", size // 16)
+	socket.write(id, data)
+	assert(socket.read(id, #data) == data)
+	local state = tls_state(id)
+	socket.close(id)
+	return state
+end
+
+skynet.start(function()
+	-- a client context without certificate, it fails when skynet is built without tls
+	if not require "skynet.socketdriver".tls_context(false) then
+		print("tls is not supported, skip testtls")
+		skynet.exit()
+		return
+	end
+	os.execute("mkdir -p " .. DIR)
+	local cert, key = gencert "server"
+	local other = gencert "other"
+
+	local lid = socket.listen("127.0.0.1", PORT, { tls = { cert = cert, key = key } })
+	socket.start(lid, function(id)
+		socket.start(id)
+		skynet.fork(function()
+			while true do
+				local str = socket.read(id)
+				if not str then
+					socket.close(id)
+					return
+				end
+				socket.write(id, str)
+			end
+		end)
+	end)
+
+	local state = echo({ tls = true }, 1024 * 1024)
+	print("tls echo", state)
+	assert(state == "established")
+	state = echo({ tls = true }, 1024)
+	print("tls reconnect", state)
+	assert(state == "resumed")
+	state = echo({ tls = { ca = cert } }, 1024)
+	print("tls verify", state)
+	local ok, err = echo({ tls = { ca = other } }, 1024)
+	print("tls verify other ca", ok, err)
+	assert(ok == nil)
+
+	socket.close(lid)
+	os.execute("rm -rf " .. DIR)
+	skynet.exit()
+end)
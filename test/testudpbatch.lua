@@ -0,0 +1,44 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- send bursts of udp packages, the server may receive them in batch (SKYNET_SOCKET_TYPE_UDP_BATCH)
+-- udp may lost packages when the receive buffer is full, so the count may be less than N
+
+local N = 1000
+
+skynet.start(function()
+	local count = 0
+	local server
+	server = socket.udp(function(str, from)
+		count = count + 1
+		socket.sendto(server, from, str)
+	end, "127.0.0.1", 8766)
+
+	local echo = 0
+	local c = socket.udp(function(str, from)
+		echo = echo + 1
+	end)
+	socket.udp_connect(c, "127.0.0.1", 8766)
+	local start = skynet.now()
+	for i=1,N do
+		socket.write(c, "hello " .. i)
+		if i % 50 == 0 then
+			skynet.sleep(0)
+		end
+	end
+	while echo < N and skynet.now() - start < 300 do
+		skynet.sleep(1)
+	end
+	print(string.format("udp send %d packages, server recv %d, client recv %d, %d cs", N, count, echo, skynet.now() - start))
+	-- recvmmsg / sendmmsg 一次系统调用只算一次 rcall / wcall
+	for _, v in ipairs(socket.netstat()) do
+		if v.id == server or v.id == c then
+			print(string.format("%s : rpacket %d rcall %d wpacket %d wcall %d", v.id == server and "server" or "client",
+				v.rpacket, v.rcall, v.wpacket, v.wcall))
+			assert(v.rcall <= v.rpacket + v.eagain and v.wcall <= v.wpacket + v.eagain)
+		end
+	end
+	socket.close(c)
+	socket.close(server)
+	skynet.exit()
+end)